@@ -0,0 +1,446 @@
+/*
+  Copyright (C) 2024 Sam Lantinga <slouken@libsdl.org>
+
+  This software is provided 'as-is', without any express or implied
+  warranty.  In no event will the authors be held liable for any damages
+  arising from the use of this software.
+
+  Permission is granted to anyone to use this software for any purpose,
+  including commercial applications, and to alter it and redistribute it
+  freely.
+*/
+#include "audio_interleave.h"
+
+
+//--------------------------------------------------------------------------------------------------
+// 128-bit vector helpers
+//
+// The kernels interleave channels by transposing blocks of samples with unpack (SSE2) or zip (NEON)
+// operations, where UnpackLo<E> and UnpackHi<E> interleave E byte elements from the low and high
+// halves of two vectors.
+//--------------------------------------------------------------------------------------------------
+#if defined( SDL_SSE2_INTRINSICS )
+#define HAVE_VECTOR_INTERLEAVE
+
+typedef __m128i Vec_t;
+
+static inline Vec_t VecLoad( const Uint8 *p ) { return _mm_loadu_si128( (const __m128i *)p ); }
+static inline void VecStore( Uint8 *p, Vec_t v ) { _mm_storeu_si128( (__m128i *)p, v ); }
+static inline void VecStoreLow( Uint8 *p, Vec_t v ) { _mm_storel_epi64( (__m128i *)p, v ); }
+static inline void VecStoreHigh( Uint8 *p, Vec_t v ) { _mm_storel_epi64( (__m128i *)p, _mm_unpackhi_epi64( v, v ) ); }
+
+template < int E > static inline Vec_t UnpackLo( Vec_t a, Vec_t b );
+template < int E > static inline Vec_t UnpackHi( Vec_t a, Vec_t b );
+template <> inline Vec_t UnpackLo< 1 >( Vec_t a, Vec_t b ) { return _mm_unpacklo_epi8( a, b ); }
+template <> inline Vec_t UnpackHi< 1 >( Vec_t a, Vec_t b ) { return _mm_unpackhi_epi8( a, b ); }
+template <> inline Vec_t UnpackLo< 2 >( Vec_t a, Vec_t b ) { return _mm_unpacklo_epi16( a, b ); }
+template <> inline Vec_t UnpackHi< 2 >( Vec_t a, Vec_t b ) { return _mm_unpackhi_epi16( a, b ); }
+template <> inline Vec_t UnpackLo< 4 >( Vec_t a, Vec_t b ) { return _mm_unpacklo_epi32( a, b ); }
+template <> inline Vec_t UnpackHi< 4 >( Vec_t a, Vec_t b ) { return _mm_unpackhi_epi32( a, b ); }
+template <> inline Vec_t UnpackLo< 8 >( Vec_t a, Vec_t b ) { return _mm_unpacklo_epi64( a, b ); }
+template <> inline Vec_t UnpackHi< 8 >( Vec_t a, Vec_t b ) { return _mm_unpackhi_epi64( a, b ); }
+
+#elif defined( SDL_NEON_INTRINSICS )
+#define HAVE_VECTOR_INTERLEAVE
+
+typedef uint8x16_t Vec_t;
+
+static inline Vec_t VecLoad( const Uint8 *p ) { return vld1q_u8( p ); }
+static inline void VecStore( Uint8 *p, Vec_t v ) { vst1q_u8( p, v ); }
+static inline void VecStoreLow( Uint8 *p, Vec_t v ) { vst1_u8( p, vget_low_u8( v ) ); }
+static inline void VecStoreHigh( Uint8 *p, Vec_t v ) { vst1_u8( p, vget_high_u8( v ) ); }
+
+template < int E > static inline Vec_t UnpackLo( Vec_t a, Vec_t b );
+template < int E > static inline Vec_t UnpackHi( Vec_t a, Vec_t b );
+template <> inline Vec_t UnpackLo< 1 >( Vec_t a, Vec_t b ) { return vzipq_u8( a, b ).val[ 0 ]; }
+template <> inline Vec_t UnpackHi< 1 >( Vec_t a, Vec_t b ) { return vzipq_u8( a, b ).val[ 1 ]; }
+template <> inline Vec_t UnpackLo< 2 >( Vec_t a, Vec_t b ) { return vreinterpretq_u8_u16( vzipq_u16( vreinterpretq_u16_u8( a ), vreinterpretq_u16_u8( b ) ).val[ 0 ] ); }
+template <> inline Vec_t UnpackHi< 2 >( Vec_t a, Vec_t b ) { return vreinterpretq_u8_u16( vzipq_u16( vreinterpretq_u16_u8( a ), vreinterpretq_u16_u8( b ) ).val[ 1 ] ); }
+template <> inline Vec_t UnpackLo< 4 >( Vec_t a, Vec_t b ) { return vreinterpretq_u8_u32( vzipq_u32( vreinterpretq_u32_u8( a ), vreinterpretq_u32_u8( b ) ).val[ 0 ] ); }
+template <> inline Vec_t UnpackHi< 4 >( Vec_t a, Vec_t b ) { return vreinterpretq_u8_u32( vzipq_u32( vreinterpretq_u32_u8( a ), vreinterpretq_u32_u8( b ) ).val[ 1 ] ); }
+template <> inline Vec_t UnpackLo< 8 >( Vec_t a, Vec_t b ) { return vcombine_u8( vget_low_u8( a ), vget_low_u8( b ) ); }
+template <> inline Vec_t UnpackHi< 8 >( Vec_t a, Vec_t b ) { return vcombine_u8( vget_high_u8( a ), vget_high_u8( b ) ); }
+
+#endif
+
+
+//--------------------------------------------------------------------------------------------------
+// Scalar kernel, with the channel count known at compile time so the inner loop is unrolled
+//--------------------------------------------------------------------------------------------------
+template < typename T, int N >
+static void InterleaveScalar( const Uint8 * const *ppSrc, int nStart, int nSamples, Uint8 *pDst )
+{
+	const T *pSrc[ N ];
+	for ( int c = 0; c < N; ++c )
+	{
+		pSrc[ c ] = (const T *)ppSrc[ c ];
+	}
+
+	T *pOut = (T *)pDst + nStart * N;
+	for ( int i = nStart; i < nSamples; ++i )
+	{
+		for ( int c = 0; c < N; ++c )
+		{
+			*pOut++ = pSrc[ c ][ i ];
+		}
+	}
+}
+
+template < typename T, int N >
+static void InterleaveKernel( const Uint8 * const *ppSrc, int nSamples, Uint8 *pDst )
+{
+	InterleaveScalar< T, N >( ppSrc, 0, nSamples, pDst );
+}
+
+static void InterleaveMono( const Uint8 * const *ppSrc, int nSampleSize, int nSamples, Uint8 *pDst )
+{
+	SDL_memcpy( pDst, ppSrc[ 0 ], (size_t)nSamples * nSampleSize );
+}
+
+
+#ifdef HAVE_VECTOR_INTERLEAVE
+//--------------------------------------------------------------------------------------------------
+// Vector kernels, processing 16 bytes of each channel per iteration
+//--------------------------------------------------------------------------------------------------
+template < typename T >
+static void InterleaveVector2( const Uint8 * const *ppSrc, int nSamples, Uint8 *pDst )
+{
+	const int E = sizeof( T );
+	const int K = 16 / E;
+	const Uint8 *pA = ppSrc[ 0 ];
+	const Uint8 *pB = ppSrc[ 1 ];
+	int i;
+
+	for ( i = 0; i + K <= nSamples; i += K )
+	{
+		Vec_t a = VecLoad( pA + i * E );
+		Vec_t b = VecLoad( pB + i * E );
+		VecStore( pDst, UnpackLo< E >( a, b ) );
+		VecStore( pDst + 16, UnpackHi< E >( a, b ) );
+		pDst += 32;
+	}
+	InterleaveScalar< T, 2 >( ppSrc, i, nSamples, pDst - i * 2 * E );
+}
+
+// Transpose 4 channels of K samples into 4 vectors holding K/4 interleaved samples each
+template < int E >
+static inline void Transpose4( Vec_t a, Vec_t b, Vec_t c, Vec_t d, Vec_t *pOut )
+{
+	Vec_t ab0 = UnpackLo< E >( a, b );
+	Vec_t ab1 = UnpackHi< E >( a, b );
+	Vec_t cd0 = UnpackLo< E >( c, d );
+	Vec_t cd1 = UnpackHi< E >( c, d );
+	pOut[ 0 ] = UnpackLo< 2 * E >( ab0, cd0 );
+	pOut[ 1 ] = UnpackHi< 2 * E >( ab0, cd0 );
+	pOut[ 2 ] = UnpackLo< 2 * E >( ab1, cd1 );
+	pOut[ 3 ] = UnpackHi< 2 * E >( ab1, cd1 );
+}
+
+template < typename T >
+static void InterleaveVector4( const Uint8 * const *ppSrc, int nSamples, Uint8 *pDst )
+{
+	const int E = sizeof( T );
+	const int K = 16 / E;
+	int i;
+
+	for ( i = 0; i + K <= nSamples; i += K )
+	{
+		Vec_t out[ 4 ];
+		Transpose4< E >( VecLoad( ppSrc[ 0 ] + i * E ), VecLoad( ppSrc[ 1 ] + i * E ),
+		                 VecLoad( ppSrc[ 2 ] + i * E ), VecLoad( ppSrc[ 3 ] + i * E ), out );
+		for ( int v = 0; v < 4; ++v )
+		{
+			VecStore( pDst, out[ v ] );
+			pDst += 16;
+		}
+	}
+	InterleaveScalar< T, 4 >( ppSrc, i, nSamples, pDst - i * 4 * E );
+}
+
+// 8 channels of 1 or 2 byte samples, a full 8 way transpose
+template < typename T >
+static void InterleaveVector8( const Uint8 * const *ppSrc, int nSamples, Uint8 *pDst )
+{
+	const int E = sizeof( T );
+	const int K = 16 / E;
+	int i;
+
+	for ( i = 0; i + K <= nSamples; i += K )
+	{
+		Vec_t v[ 8 ], n[ 8 ], p[ 8 ];
+		for ( int c = 0; c < 8; ++c )
+		{
+			v[ c ] = VecLoad( ppSrc[ c ] + i * E );
+		}
+		for ( int c = 0; c < 8; c += 2 )
+		{
+			n[ c + 0 ] = UnpackLo< E >( v[ c ], v[ c + 1 ] );
+			n[ c + 1 ] = UnpackHi< E >( v[ c ], v[ c + 1 ] );
+		}
+		p[ 0 ] = UnpackLo< 2 * E >( n[ 0 ], n[ 2 ] );
+		p[ 1 ] = UnpackHi< 2 * E >( n[ 0 ], n[ 2 ] );
+		p[ 2 ] = UnpackLo< 2 * E >( n[ 1 ], n[ 3 ] );
+		p[ 3 ] = UnpackHi< 2 * E >( n[ 1 ], n[ 3 ] );
+		p[ 4 ] = UnpackLo< 2 * E >( n[ 4 ], n[ 6 ] );
+		p[ 5 ] = UnpackHi< 2 * E >( n[ 4 ], n[ 6 ] );
+		p[ 6 ] = UnpackLo< 2 * E >( n[ 5 ], n[ 7 ] );
+		p[ 7 ] = UnpackHi< 2 * E >( n[ 5 ], n[ 7 ] );
+		for ( int c = 0; c < 4; ++c )
+		{
+			VecStore( pDst, UnpackLo< 4 * E >( p[ c ], p[ c + 4 ] ) );
+			VecStore( pDst + 16, UnpackHi< 4 * E >( p[ c ], p[ c + 4 ] ) );
+			pDst += 32;
+		}
+	}
+	InterleaveScalar< T, 8 >( ppSrc, i, nSamples, pDst - i * 8 * E );
+}
+
+// 8 channels of 4 byte samples, as two 4 way transposes written side by side
+static void InterleaveVector8_32( const Uint8 * const *ppSrc, int nSamples, Uint8 *pDst )
+{
+	int i;
+
+	for ( i = 0; i + 4 <= nSamples; i += 4 )
+	{
+		Vec_t lo[ 4 ], hi[ 4 ];
+		Transpose4< 4 >( VecLoad( ppSrc[ 0 ] + i * 4 ), VecLoad( ppSrc[ 1 ] + i * 4 ),
+		                 VecLoad( ppSrc[ 2 ] + i * 4 ), VecLoad( ppSrc[ 3 ] + i * 4 ), lo );
+		Transpose4< 4 >( VecLoad( ppSrc[ 4 ] + i * 4 ), VecLoad( ppSrc[ 5 ] + i * 4 ),
+		                 VecLoad( ppSrc[ 6 ] + i * 4 ), VecLoad( ppSrc[ 7 ] + i * 4 ), hi );
+		for ( int v = 0; v < 4; ++v )
+		{
+			VecStore( pDst, lo[ v ] );
+			VecStore( pDst + 16, hi[ v ] );
+			pDst += 32;
+		}
+	}
+	InterleaveScalar< Uint32, 8 >( ppSrc, i, nSamples, pDst - i * 8 * 4 );
+}
+
+// 6 channels (5.1) of 4 byte samples, a 4 way transpose followed by the remaining channel pair
+static void InterleaveVector6_32( const Uint8 * const *ppSrc, int nSamples, Uint8 *pDst )
+{
+	int i;
+
+	for ( i = 0; i + 4 <= nSamples; i += 4 )
+	{
+		Vec_t front[ 4 ];
+		Transpose4< 4 >( VecLoad( ppSrc[ 0 ] + i * 4 ), VecLoad( ppSrc[ 1 ] + i * 4 ),
+		                 VecLoad( ppSrc[ 2 ] + i * 4 ), VecLoad( ppSrc[ 3 ] + i * 4 ), front );
+		Vec_t e = VecLoad( ppSrc[ 4 ] + i * 4 );
+		Vec_t f = VecLoad( ppSrc[ 5 ] + i * 4 );
+		Vec_t back0 = UnpackLo< 4 >( e, f );
+		Vec_t back1 = UnpackHi< 4 >( e, f );
+
+		VecStore( pDst + 0, front[ 0 ] );
+		VecStoreLow( pDst + 16, back0 );
+		VecStore( pDst + 24, front[ 1 ] );
+		VecStoreHigh( pDst + 40, back0 );
+		VecStore( pDst + 48, front[ 2 ] );
+		VecStoreLow( pDst + 64, back1 );
+		VecStore( pDst + 72, front[ 3 ] );
+		VecStoreHigh( pDst + 88, back1 );
+		pDst += 96;
+	}
+	InterleaveScalar< Uint32, 6 >( ppSrc, i, nSamples, pDst - i * 6 * 4 );
+}
+#endif // HAVE_VECTOR_INTERLEAVE
+
+
+//--------------------------------------------------------------------------------------------------
+// Kernel table, indexed by sample size and channel count
+//--------------------------------------------------------------------------------------------------
+typedef void (*InterleaveFunc_t)( const Uint8 * const *ppSrc, int nSamples, Uint8 *pDst );
+
+#define SCALAR_KERNELS( T ) \
+	{ nullptr, nullptr, InterleaveKernel< T, 2 >, InterleaveKernel< T, 3 >, InterleaveKernel< T, 4 >, \
+	  InterleaveKernel< T, 5 >, InterleaveKernel< T, 6 >, InterleaveKernel< T, 7 >, InterleaveKernel< T, 8 > }
+
+static const InterleaveFunc_t s_ScalarKernels[ 3 ][ 9 ] =
+{
+	SCALAR_KERNELS( Uint8 ),
+	SCALAR_KERNELS( Uint16 ),
+	SCALAR_KERNELS( Uint32 ),
+};
+
+#ifdef HAVE_VECTOR_INTERLEAVE
+static const InterleaveFunc_t s_Kernels[ 3 ][ 9 ] =
+{
+	{ nullptr, nullptr, InterleaveVector2< Uint8 >, InterleaveKernel< Uint8, 3 >, InterleaveVector4< Uint8 >,
+	  InterleaveKernel< Uint8, 5 >, InterleaveKernel< Uint8, 6 >, InterleaveKernel< Uint8, 7 >, InterleaveVector8< Uint8 > },
+	{ nullptr, nullptr, InterleaveVector2< Uint16 >, InterleaveKernel< Uint16, 3 >, InterleaveVector4< Uint16 >,
+	  InterleaveKernel< Uint16, 5 >, InterleaveKernel< Uint16, 6 >, InterleaveKernel< Uint16, 7 >, InterleaveVector8< Uint16 > },
+	{ nullptr, nullptr, InterleaveVector2< Uint32 >, InterleaveKernel< Uint32, 3 >, InterleaveVector4< Uint32 >,
+	  InterleaveKernel< Uint32, 5 >, InterleaveVector6_32, InterleaveKernel< Uint32, 7 >, InterleaveVector8_32 },
+};
+#else
+#define s_Kernels s_ScalarKernels
+#endif
+
+static int GetSampleSizeIndex( int nSampleSize )
+{
+	switch ( nSampleSize )
+	{
+	case 1:
+		return 0;
+	case 2:
+		return 1;
+	case 4:
+		return 2;
+	default:
+		return -1;
+	}
+}
+
+
+//--------------------------------------------------------------------------------------------------
+// Generic interleaving for any sample size and channel count
+//--------------------------------------------------------------------------------------------------
+static void InterleaveGeneric( const Uint8 * const *ppSrc, int nChannels, int nSampleSize, int nSamples, Uint8 *pDst )
+{
+	int nFrameSize = nChannels * nSampleSize;
+
+	for ( int c = 0; c < nChannels; ++c )
+	{
+		const Uint8 *pSrc = ppSrc[ c ];
+		Uint8 *pOut = pDst + c * nSampleSize;
+		for ( int i = nSamples; i--; )
+		{
+			SDL_memcpy( pOut, pSrc, nSampleSize );
+			pSrc += nSampleSize;
+			pOut += nFrameSize;
+		}
+	}
+}
+
+
+//--------------------------------------------------------------------------------------------------
+// Interleave planar audio samples
+//--------------------------------------------------------------------------------------------------
+void InterleaveAudioSamples( const Uint8 * const *ppSrc, int nChannels, int nSampleSize, int nSamples, Uint8 *pDst )
+{
+	int iSize = GetSampleSizeIndex( nSampleSize );
+	if ( nChannels == 1 )
+	{
+		InterleaveMono( ppSrc, nSampleSize, nSamples, pDst );
+	}
+	else if ( iSize >= 0 && nChannels <= 8 )
+	{
+		s_Kernels[ iSize ][ nChannels ]( ppSrc, nSamples, pDst );
+	}
+	else
+	{
+		InterleaveGeneric( ppSrc, nChannels, nSampleSize, nSamples, pDst );
+	}
+}
+
+
+//--------------------------------------------------------------------------------------------------
+// The original interleaving loop, allocating a buffer and copying one sample at a time
+//--------------------------------------------------------------------------------------------------
+static void InterleaveReference( const Uint8 * const *ppSrc, int nChannels, int nSampleSize, int nSamples, Uint8 *pDst )
+{
+	Uint8 *pData = (Uint8 *)SDL_malloc( (size_t)nSamples * nChannels * nSampleSize );
+	if ( !pData )
+	{
+		return;
+	}
+	InterleaveGeneric( ppSrc, nChannels, nSampleSize, nSamples, pData );
+	SDL_memcpy( pDst, pData, (size_t)nSamples * nChannels * nSampleSize );
+	SDL_free( pData );
+}
+
+
+//--------------------------------------------------------------------------------------------------
+// Compare the interleaving kernels against the original loop
+//--------------------------------------------------------------------------------------------------
+bool BenchmarkInterleaveAudio()
+{
+	// A typical decoded frame, with an odd sample count so the scalar tails are exercised too
+	const int nSamples = 1023;
+	const int nIterations = 2000;
+	static const int s_SampleSizes[] = { 1, 2, 4 };
+	static const char *s_SampleNames[] = { "U8", "S16", "S32/F32" };
+	Uint8 *pPlanes[ 8 ];
+	bool bResult = true;
+
+	Uint8 *pSrc = (Uint8 *)SDL_malloc( 8 * nSamples * 4 );
+	Uint8 *pExpected = (Uint8 *)SDL_malloc( 8 * nSamples * 4 );
+	Uint8 *pActual = (Uint8 *)SDL_malloc( 8 * nSamples * 4 );
+	if ( !pSrc || !pExpected || !pActual )
+	{
+		SDL_free( pSrc );
+		SDL_free( pExpected );
+		SDL_free( pActual );
+		return false;
+	}
+	for ( int i = 0; i < 8 * nSamples * 4; ++i )
+	{
+		pSrc[ i ] = (Uint8)SDL_rand( 256 );
+	}
+
+#if defined( SDL_SSE2_INTRINSICS )
+	SDL_Log( "Interleave benchmark, SSE2 kernels, %d samples per frame\n", nSamples );
+#elif defined( SDL_NEON_INTRINSICS )
+	SDL_Log( "Interleave benchmark, NEON kernels, %d samples per frame\n", nSamples );
+#else
+	SDL_Log( "Interleave benchmark, scalar kernels, %d samples per frame\n", nSamples );
+#endif
+	SDL_Log( "%-8s %8s %12s %12s %12s %8s", "format", "channels", "original ns", "scalar ns", "kernel ns", "speedup" );
+
+	for ( int iSize = 0; iSize < (int)SDL_arraysize( s_SampleSizes ); ++iSize )
+	{
+		int nSampleSize = s_SampleSizes[ iSize ];
+		for ( int nChannels = 1; nChannels <= 8; ++nChannels )
+		{
+			for ( int c = 0; c < nChannels; ++c )
+			{
+				pPlanes[ c ] = pSrc + c * nSamples * nSampleSize;
+			}
+			size_t unLength = (size_t)nSamples * nChannels * nSampleSize;
+
+			InterleaveReference( pPlanes, nChannels, nSampleSize, nSamples, pExpected );
+			SDL_memset( pActual, 0, unLength );
+			InterleaveAudioSamples( pPlanes, nChannels, nSampleSize, nSamples, pActual );
+			if ( SDL_memcmp( pExpected, pActual, unLength ) != 0 )
+			{
+				SDL_Log( "Interleave mismatch: %s, %d channels\n", s_SampleNames[ iSize ], nChannels );
+				bResult = false;
+				continue;
+			}
+
+			Uint64 unStart = SDL_GetTicksNS();
+			for ( int n = 0; n < nIterations; ++n )
+			{
+				InterleaveReference( pPlanes, nChannels, nSampleSize, nSamples, pExpected );
+			}
+			Uint64 unReference = ( SDL_GetTicksNS() - unStart ) / nIterations;
+
+			Uint64 unScalar = 0;
+			if ( nChannels > 1 )
+			{
+				unStart = SDL_GetTicksNS();
+				for ( int n = 0; n < nIterations; ++n )
+				{
+					s_ScalarKernels[ iSize ][ nChannels ]( pPlanes, nSamples, pActual );
+				}
+				unScalar = ( SDL_GetTicksNS() - unStart ) / nIterations;
+			}
+
+			unStart = SDL_GetTicksNS();
+			for ( int n = 0; n < nIterations; ++n )
+			{
+				InterleaveAudioSamples( pPlanes, nChannels, nSampleSize, nSamples, pActual );
+			}
+			Uint64 unKernel = SDL_max( ( SDL_GetTicksNS() - unStart ) / nIterations, 1 );
+
+			SDL_Log( "%-8s %8d %12" SDL_PRIu64 " %12" SDL_PRIu64 " %12" SDL_PRIu64 " %7.1fx",
+			         s_SampleNames[ iSize ], nChannels, unReference, unScalar, unKernel, (double)unReference / unKernel );
+		}
+	}
+
+	SDL_free( pSrc );
+	SDL_free( pExpected );
+	SDL_free( pActual );
+	return bResult;
+}
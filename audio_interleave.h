@@ -0,0 +1,31 @@
+/*
+  Copyright (C) 2024 Sam Lantinga <slouken@libsdl.org>
+
+  This software is provided 'as-is', without any express or implied
+  warranty.  In no event will the authors be held liable for any damages
+  arising from the use of this software.
+
+  Permission is granted to anyone to use this software for any purpose,
+  including commercial applications, and to alter it and redistribute it
+  freely.
+*/
+#ifndef AUDIO_INTERLEAVE_H
+#define AUDIO_INTERLEAVE_H
+
+#include <SDL3/SDL.h>
+
+//--------------------------------------------------------------------------------------------------
+// Interleave planar audio samples
+//
+// nSampleSize is 1, 2 or 4 bytes (U8, S16, S32 and F32). Channel counts 1 through 8 use dedicated
+// kernels, with SSE2 or NEON versions for the common layouts. Other channel counts fall back to a
+// generic loop.
+//--------------------------------------------------------------------------------------------------
+extern void InterleaveAudioSamples( const Uint8 * const *ppSrc, int nChannels, int nSampleSize, int nSamples, Uint8 *pDst );
+
+//--------------------------------------------------------------------------------------------------
+// Compare the interleaving kernels against a simple per-sample copy and log the results
+//--------------------------------------------------------------------------------------------------
+extern bool BenchmarkInterleaveAudio();
+
+#endif // AUDIO_INTERLEAVE_H
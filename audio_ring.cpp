@@ -0,0 +1,239 @@
+/*
+  Copyright (C) 2024 Sam Lantinga <slouken@libsdl.org>
+
+  This software is provided 'as-is', without any express or implied
+  warranty.  In no event will the authors be held liable for any damages
+  arising from the use of this software.
+
+  Permission is granted to anyone to use this software for any purpose,
+  including commercial applications, and to alter it and redistribute it
+  freely.
+*/
+#include "audio_ring.h"
+
+
+//--------------------------------------------------------------------------------------------------
+// CAudioRingBuffer destructor
+//--------------------------------------------------------------------------------------------------
+CAudioRingBuffer::~CAudioRingBuffer()
+{
+	SDL_free( m_pBuffer );
+}
+
+
+//--------------------------------------------------------------------------------------------------
+// Initialize the ring buffer
+//--------------------------------------------------------------------------------------------------
+bool CAudioRingBuffer::BInit( int nCapacity, int nFrameSize )
+{
+	if ( nFrameSize <= 0 )
+	{
+		SDL_SetError( "Invalid audio frame size %d", nFrameSize );
+		return false;
+	}
+
+	// Frames like 5.1 S16 aren't a power of two in size, so the capacity is a whole number of
+	// frames instead and the positions run over twice the capacity, which tells full from empty
+	int nSize = ( ( SDL_max( nCapacity, 1 ) + nFrameSize - 1 ) / nFrameSize ) * nFrameSize;
+
+	SDL_free( m_pBuffer );
+	m_pBuffer = (Uint8 *)SDL_malloc( nSize );
+	if ( !m_pBuffer )
+	{
+		m_nCapacity = 0;
+		return false;
+	}
+	m_nCapacity = nSize;
+	m_nFrameSize = nFrameSize;
+	SDL_SetAtomicInt( &m_nWritePos, 0 );
+	SDL_SetAtomicInt( &m_nReadPos, 0 );
+	return true;
+}
+
+
+//--------------------------------------------------------------------------------------------------
+// Return the number of bytes available to read
+//--------------------------------------------------------------------------------------------------
+int CAudioRingBuffer::GetAvailable()
+{
+	int nWritePos = SDL_GetAtomicInt( &m_nWritePos );
+	int nReadPos = SDL_GetAtomicInt( &m_nReadPos );
+	int nAvailable = nWritePos - nReadPos;
+	return ( nAvailable < 0 ) ? nAvailable + 2 * m_nCapacity : nAvailable;
+}
+
+
+//--------------------------------------------------------------------------------------------------
+// Return the number of bytes that can be written
+//--------------------------------------------------------------------------------------------------
+int CAudioRingBuffer::GetSpace()
+{
+	return m_nCapacity - GetAvailable();
+}
+
+
+//--------------------------------------------------------------------------------------------------
+// Write data into the ring buffer, called only from the producer thread
+//--------------------------------------------------------------------------------------------------
+int CAudioRingBuffer::Write( const void *pData, int nLength )
+{
+	int nWritePos = SDL_GetAtomicInt( &m_nWritePos );
+	nLength = SDL_min( nLength, GetSpace() );
+	nLength -= ( nLength % m_nFrameSize );
+	if ( nLength <= 0 )
+	{
+		return 0;
+	}
+
+	int nOffset = GetOffset( nWritePos );
+	int nFirst = SDL_min( nLength, m_nCapacity - nOffset );
+	SDL_memcpy( m_pBuffer + nOffset, pData, nFirst );
+	SDL_memcpy( m_pBuffer, (const Uint8 *)pData + nFirst, nLength - nFirst );
+
+	// Publish the data after it has been copied
+	nWritePos += nLength;
+	if ( nWritePos >= 2 * m_nCapacity )
+	{
+		nWritePos -= 2 * m_nCapacity;
+	}
+	SDL_SetAtomicInt( &m_nWritePos, nWritePos );
+	return nLength;
+}
+
+
+//--------------------------------------------------------------------------------------------------
+// Read data from the ring buffer, called only from the consumer thread
+//--------------------------------------------------------------------------------------------------
+int CAudioRingBuffer::Read( void *pData, int nLength )
+{
+	int nReadPos = SDL_GetAtomicInt( &m_nReadPos );
+	nLength = SDL_min( nLength, GetAvailable() );
+	nLength -= ( nLength % m_nFrameSize );
+	if ( nLength <= 0 )
+	{
+		return 0;
+	}
+
+	int nOffset = GetOffset( nReadPos );
+	int nFirst = SDL_min( nLength, m_nCapacity - nOffset );
+	SDL_memcpy( pData, m_pBuffer + nOffset, nFirst );
+	SDL_memcpy( (Uint8 *)pData + nFirst, m_pBuffer, nLength - nFirst );
+
+	// Release the space after the data has been copied out
+	nReadPos += nLength;
+	if ( nReadPos >= 2 * m_nCapacity )
+	{
+		nReadPos -= 2 * m_nCapacity;
+	}
+	SDL_SetAtomicInt( &m_nReadPos, nReadPos );
+	return nLength;
+}
+
+
+//--------------------------------------------------------------------------------------------------
+// Pass a counting pattern through the ring in odd sized pieces, like the audio thread and callback
+//--------------------------------------------------------------------------------------------------
+bool CAudioRingBuffer::BSelfTest()
+{
+	// 100 ms at 48 kHz, with the frame sizes that aren't a power of two in the middle
+	const int nRingFrames = 4800;
+	const int nTotalBytes = 16 * 1024 * 1024;
+	const int nMaxChunk = 8192;
+	static const struct
+	{
+		const char *pszName;
+		int nFrameSize;
+	} s_Formats[] =
+	{
+		{ "stereo S16", 2 * 2 },
+		{ "5.1 S16", 6 * 2 },
+		{ "stereo F32", 2 * 4 },
+		{ "5.1 F32", 6 * 4 },
+		{ "7.1 F32", 8 * 4 },
+	};
+	bool bResult = true;
+
+	Uint8 *pWrite = (Uint8 *)SDL_malloc( nMaxChunk );
+	Uint8 *pRead = (Uint8 *)SDL_malloc( nMaxChunk );
+	if ( !pWrite || !pRead )
+	{
+		SDL_free( pWrite );
+		SDL_free( pRead );
+		return false;
+	}
+
+	SDL_Log( "Audio ring self test, %d frame ring, %d MB per format\n", nRingFrames, nTotalBytes / ( 1024 * 1024 ) );
+
+	for ( int iFormat = 0; iFormat < (int)SDL_arraysize( s_Formats ) && bResult; ++iFormat )
+	{
+		int nFrameSize = s_Formats[ iFormat ].nFrameSize;
+		CAudioRingBuffer ring;
+		if ( !ring.BInit( nRingFrames * nFrameSize - 1, nFrameSize ) )
+		{
+			bResult = false;
+			break;
+		}
+
+		// Every byte of a frame holds the frame number, so a read that starts part way through a
+		// frame or loses data shows up as a mismatch
+		Uint32 unFramesWritten = 0;
+		Uint32 unFramesRead = 0;
+		int nPending = 0;
+		int nRead = 0;
+		while ( nRead < nTotalBytes && bResult )
+		{
+			if ( nPending == 0 )
+			{
+				nPending = 1 + SDL_rand( nMaxChunk );
+				for ( int i = 0; i < nPending / nFrameSize; ++i )
+				{
+					SDL_memset( pWrite + i * nFrameSize, (Uint8)( unFramesWritten + i ), nFrameSize );
+				}
+			}
+
+			int nWritten = ring.Write( pWrite, nPending );
+			if ( nWritten % nFrameSize != 0 )
+			{
+				SDL_Log( "%s: wrote %d bytes, not a whole number of frames\n", s_Formats[ iFormat ].pszName, nWritten );
+				bResult = false;
+				break;
+			}
+			unFramesWritten += nWritten / nFrameSize;
+			SDL_memmove( pWrite, pWrite + nWritten, nPending - nWritten );
+			nPending -= nWritten;
+			if ( nPending < nFrameSize )
+			{
+				// The partial frame left over can never be written
+				nPending = 0;
+			}
+
+			int nLength = ring.Read( pRead, 1 + SDL_rand( nMaxChunk ) );
+			if ( nLength % nFrameSize != 0 || ring.GetAvailable() % nFrameSize != 0 )
+			{
+				SDL_Log( "%s: read %d bytes, not a whole number of frames\n", s_Formats[ iFormat ].pszName, nLength );
+				bResult = false;
+				break;
+			}
+			for ( int i = 0; i < nLength; ++i )
+			{
+				if ( pRead[ i ] != (Uint8)( unFramesRead + i / nFrameSize ) )
+				{
+					SDL_Log( "%s: data mismatch at byte %d\n", s_Formats[ iFormat ].pszName, nRead + i );
+					bResult = false;
+					break;
+				}
+			}
+			unFramesRead += nLength / nFrameSize;
+			nRead += nLength;
+		}
+
+		if ( bResult )
+		{
+			SDL_Log( "%s: %d byte frames, %d byte capacity, passed\n", s_Formats[ iFormat ].pszName, nFrameSize, ring.GetCapacity() );
+		}
+	}
+
+	SDL_free( pWrite );
+	SDL_free( pRead );
+	return bResult;
+}
@@ -0,0 +1,59 @@
+/*
+  Copyright (C) 2024 Sam Lantinga <slouken@libsdl.org>
+
+  This software is provided 'as-is', without any express or implied
+  warranty.  In no event will the authors be held liable for any damages
+  arising from the use of this software.
+
+  Permission is granted to anyone to use this software for any purpose,
+  including commercial applications, and to alter it and redistribute it
+  freely.
+*/
+#ifndef AUDIO_RING_H
+#define AUDIO_RING_H
+
+#include <SDL3/SDL.h>
+
+
+//--------------------------------------------------------------------------------------------------
+// A lock-free single producer, single consumer ring buffer of audio data
+//
+// The audio thread writes decoded samples and the SDL audio callback reads them, so neither side
+// ever waits on a lock held by the other. Data is only ever stored and returned in whole sample
+// frames, so the reader never starts part way through a frame.
+//--------------------------------------------------------------------------------------------------
+class CAudioRingBuffer
+{
+public:
+	CAudioRingBuffer() { }
+	~CAudioRingBuffer();
+
+	// The capacity is rounded up to a whole number of nFrameSize byte frames
+	bool BInit( int nCapacity, int nFrameSize );
+
+	// Returns the number of bytes written, a whole number of frames which may be less than
+	// requested if the buffer is full
+	int Write( const void *pData, int nLength );
+
+	// Returns the number of bytes read, a whole number of frames which may be less than requested
+	// if the buffer is empty
+	int Read( void *pData, int nLength );
+
+	int GetCapacity() const { return m_nCapacity; }
+	int GetAvailable();
+	int GetSpace();
+
+	// Check that odd sized reads and writes keep frames intact, returns false on the first error
+	static bool BSelfTest();
+
+private:
+	int GetOffset( int nPos ) const { return ( nPos < m_nCapacity ) ? nPos : nPos - m_nCapacity; }
+
+	Uint8 *m_pBuffer = nullptr;
+	int m_nCapacity = 0;
+	int m_nFrameSize = 1;
+	SDL_AtomicInt m_nWritePos = { 0 };
+	SDL_AtomicInt m_nReadPos = { 0 };
+};
+
+#endif // AUDIO_RING_H
@@ -0,0 +1,125 @@
+/*
+  Copyright (C) 2024 Sam Lantinga <slouken@libsdl.org>
+
+  This software is provided 'as-is', without any express or implied
+  warranty.  In no event will the authors be held liable for any damages
+  arising from the use of this software.
+
+  Permission is granted to anyone to use this software for any purpose,
+  including commercial applications, and to alter it and redistribute it
+  freely.
+*/
+#include "av_clock.h"
+
+
+static const char *s_SourceNames[] =
+{
+	"audio",
+	"video",
+	"external",
+};
+
+
+//--------------------------------------------------------------------------------------------------
+// Convert between clock sources and their names
+//--------------------------------------------------------------------------------------------------
+bool CMasterClock::BParseSource( const char *pszName, ESource *peSource )
+{
+	for ( int i = 0; i < (int)SDL_arraysize( s_SourceNames ); ++i )
+	{
+		if ( SDL_strcmp( pszName, s_SourceNames[ i ] ) == 0 )
+		{
+			*peSource = (ESource)i;
+			return true;
+		}
+	}
+	return false;
+}
+
+const char *CMasterClock::GetSourceName( ESource eSource )
+{
+	return s_SourceNames[ eSource ];
+}
+
+
+//--------------------------------------------------------------------------------------------------
+// Return the clock currently in use
+//--------------------------------------------------------------------------------------------------
+CMasterClock::ESource CMasterClock::GetActiveSource() const
+{
+	if ( m_eSource == k_ESourceAudio && !m_AudioClock.BValid() )
+	{
+		return k_ESourceExternal;
+	}
+	return m_eSource;
+}
+
+
+//--------------------------------------------------------------------------------------------------
+// Stop following the audio clock
+//--------------------------------------------------------------------------------------------------
+void CMasterClock::InvalidateAudio( Uint64 unNowNS )
+{
+	if ( m_AudioClock.BValid() )
+	{
+		m_ExternalClock.Set( m_AudioClock.Get( unNowNS ), unNowNS );
+		m_AudioClock.Invalidate();
+	}
+}
+
+
+//--------------------------------------------------------------------------------------------------
+// Update the clocks when a video frame is shown
+//--------------------------------------------------------------------------------------------------
+void CMasterClock::SetVideoTime( double flPTS, Uint64 unNowNS )
+{
+	m_VideoClock.Set( flPTS, unNowNS );
+
+	// The external clock free-runs from the first frame shown
+	if ( !m_ExternalClock.BValid() )
+	{
+		m_ExternalClock.Set( flPTS, unNowNS );
+	}
+}
+
+
+//--------------------------------------------------------------------------------------------------
+// Return the master clock time
+//--------------------------------------------------------------------------------------------------
+double CMasterClock::GetTime( Uint64 unNowNS, double flDefaultPTS ) const
+{
+	const CClock *pClock;
+
+	switch ( GetActiveSource() )
+	{
+	case k_ESourceAudio:
+		pClock = &m_AudioClock;
+		break;
+	case k_ESourceVideo:
+		pClock = &m_VideoClock;
+		break;
+	default:
+		pClock = &m_ExternalClock;
+		break;
+	}
+
+	if ( !pClock->BValid() )
+	{
+		return flDefaultPTS;
+	}
+	return pClock->Get( unNowNS );
+}
+
+
+//--------------------------------------------------------------------------------------------------
+// Return the difference between a video timestamp and the audio clock
+//--------------------------------------------------------------------------------------------------
+bool CMasterClock::BGetAudioDrift( double flVideoPTS, Uint64 unNowNS, double *pflDrift ) const
+{
+	if ( !m_AudioClock.BValid() )
+	{
+		return false;
+	}
+	*pflDrift = flVideoPTS - m_AudioClock.Get( unNowNS );
+	return true;
+}
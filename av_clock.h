@@ -0,0 +1,92 @@
+/*
+  Copyright (C) 2024 Sam Lantinga <slouken@libsdl.org>
+
+  This software is provided 'as-is', without any express or implied
+  warranty.  In no event will the authors be held liable for any damages
+  arising from the use of this software.
+
+  Permission is granted to anyone to use this software for any purpose,
+  including commercial applications, and to alter it and redistribute it
+  freely.
+*/
+#ifndef AV_CLOCK_H
+#define AV_CLOCK_H
+
+#include <SDL3/SDL.h>
+
+
+//--------------------------------------------------------------------------------------------------
+// A clock that advances in real time from the last presentation timestamp it was set to
+//--------------------------------------------------------------------------------------------------
+class CClock
+{
+public:
+	void Set( double flPTS, Uint64 unTimeNS )
+	{
+		m_flPTS = flPTS;
+		m_unTimeNS = unTimeNS;
+		m_bValid = true;
+	}
+
+	void Invalidate() { m_bValid = false; }
+
+	bool BValid() const { return m_bValid; }
+
+	double Get( Uint64 unNowNS ) const
+	{
+		return m_flPTS + (double)(Sint64)( unNowNS - m_unTimeNS ) / SDL_NS_PER_SECOND;
+	}
+
+private:
+	double m_flPTS = 0.0;
+	Uint64 m_unTimeNS = 0;
+	bool m_bValid = false;
+};
+
+
+//--------------------------------------------------------------------------------------------------
+// The clock that video presentation is synchronized to
+//
+// When following audio, the master clock falls back to the external clock until audio is playing.
+//--------------------------------------------------------------------------------------------------
+class CMasterClock
+{
+public:
+	enum ESource
+	{
+		k_ESourceAudio,
+		k_ESourceVideo,
+		k_ESourceExternal
+	};
+
+	static bool BParseSource( const char *pszName, ESource *peSource );
+	static const char *GetSourceName( ESource eSource );
+
+	void SetSource( ESource eSource ) { m_eSource = eSource; }
+	ESource GetSource() const { return m_eSource; }
+
+	// Returns the clock currently in use, which may differ from the requested source
+	ESource GetActiveSource() const;
+
+	void SetAudioTime( double flPTS, Uint64 unNowNS ) { m_AudioClock.Set( flPTS, unNowNS ); }
+
+	// Called when audio stops, the external clock continues from the audio clock
+	void InvalidateAudio( Uint64 unNowNS );
+
+	// Called when a video frame is shown, starting the external clock if needed
+	void SetVideoTime( double flPTS, Uint64 unNowNS );
+
+	// Returns the master clock time, or flDefaultPTS if no clock has been started
+	double GetTime( Uint64 unNowNS, double flDefaultPTS ) const;
+
+	// Returns the difference between a video timestamp and the audio clock, if audio is playing
+	bool BGetAudioDrift( double flVideoPTS, Uint64 unNowNS, double *pflDrift ) const;
+
+private:
+	ESource m_eSource = k_ESourceAudio;
+	CClock m_AudioClock;
+	CClock m_VideoClock;
+	CClock m_ExternalClock;
+};
+
+#endif // AV_CLOCK_H
@@ -0,0 +1,251 @@
+/*
+  Copyright (C) 2024 Sam Lantinga <slouken@libsdl.org>
+
+  This software is provided 'as-is', without any express or implied
+  warranty.  In no event will the authors be held liable for any damages
+  arising from the use of this software.
+
+  Permission is granted to anyone to use this software for any purpose,
+  including commercial applications, and to alter it and redistribute it
+  freely.
+*/
+#include "av_pool.h"
+
+
+//--------------------------------------------------------------------------------------------------
+// CFramePool destructor
+//--------------------------------------------------------------------------------------------------
+CFramePool::~CFramePool()
+{
+	for ( int i = 0; i < m_nFrames; ++i )
+	{
+		av_frame_free( &m_ppFrames[ i ] );
+	}
+	SDL_free( m_ppFrames );
+}
+
+
+//--------------------------------------------------------------------------------------------------
+// Initialize the frame pool
+//--------------------------------------------------------------------------------------------------
+bool CFramePool::BInit( int nMaxFrames )
+{
+	m_ppFrames = (AVFrame **)SDL_calloc( nMaxFrames, sizeof( *m_ppFrames ) );
+	if ( !m_ppFrames )
+	{
+		return false;
+	}
+	m_nMaxFrames = nMaxFrames;
+	return true;
+}
+
+
+//--------------------------------------------------------------------------------------------------
+// Return a new reference to a frame
+//--------------------------------------------------------------------------------------------------
+AVFrame *CFramePool::Clone( const AVFrame *pFrame )
+{
+	AVFrame *pClone = nullptr;
+
+	SDL_LockSpinlock( &m_Lock );
+	if ( m_nFrames > 0 )
+	{
+		pClone = m_ppFrames[ --m_nFrames ];
+		++m_Stats.unHits;
+	}
+	else
+	{
+		++m_Stats.unMisses;
+	}
+	SDL_UnlockSpinlock( &m_Lock );
+
+	if ( !pClone )
+	{
+		pClone = av_frame_alloc();
+		if ( !pClone )
+		{
+			return nullptr;
+		}
+	}
+
+	if ( av_frame_ref( pClone, pFrame ) < 0 )
+	{
+		av_frame_free( &pClone );
+		return nullptr;
+	}
+
+	SDL_LockSpinlock( &m_Lock );
+	++m_Stats.nInUse;
+	m_Stats.nPeakInUse = SDL_max( m_Stats.nPeakInUse, m_Stats.nInUse );
+	SDL_UnlockSpinlock( &m_Lock );
+
+	return pClone;
+}
+
+
+//--------------------------------------------------------------------------------------------------
+// Unreference a frame and keep it for reuse
+//--------------------------------------------------------------------------------------------------
+void CFramePool::Free( AVFrame **ppFrame )
+{
+	AVFrame *pFrame = *ppFrame;
+	if ( !pFrame )
+	{
+		return;
+	}
+	*ppFrame = nullptr;
+
+	av_frame_unref( pFrame );
+
+	SDL_LockSpinlock( &m_Lock );
+	--m_Stats.nInUse;
+	if ( m_nFrames < m_nMaxFrames )
+	{
+		m_ppFrames[ m_nFrames++ ] = pFrame;
+		pFrame = nullptr;
+	}
+	SDL_UnlockSpinlock( &m_Lock );
+
+	av_frame_free( &pFrame );
+}
+
+
+//--------------------------------------------------------------------------------------------------
+// Return the pool counters
+//--------------------------------------------------------------------------------------------------
+CFramePool::SStats CFramePool::GetStats()
+{
+	SDL_LockSpinlock( &m_Lock );
+	SStats stats = m_Stats;
+	SDL_UnlockSpinlock( &m_Lock );
+	return stats;
+}
+
+
+//--------------------------------------------------------------------------------------------------
+// CPacketArena destructor
+//--------------------------------------------------------------------------------------------------
+CPacketArena::~CPacketArena()
+{
+	// Each pool is freed once the packets still using its buffers have been released
+	for ( int i = 0; i < k_nSizeClasses; ++i )
+	{
+		av_buffer_pool_uninit( &m_SizeClasses[ i ].pPool );
+	}
+}
+
+
+//--------------------------------------------------------------------------------------------------
+// Initialize the packet arena
+//--------------------------------------------------------------------------------------------------
+bool CPacketArena::BInit( size_t unMaxBytes )
+{
+	for ( int i = 0; i < k_nSizeClasses; ++i )
+	{
+		SSizeClass *pSizeClass = &m_SizeClasses[ i ];
+		pSizeClass->pArena = this;
+		pSizeClass->pPool = av_buffer_pool_init2( (size_t)1 << ( k_nMinSizeShift + i ), pSizeClass, AllocBuffer, nullptr );
+		if ( !pSizeClass->pPool )
+		{
+			SDL_SetError( "av_buffer_pool_init2() failed" );
+			return false;
+		}
+	}
+	m_unMaxBytes = unMaxBytes;
+	return true;
+}
+
+
+//--------------------------------------------------------------------------------------------------
+// Called by a size class pool when it has no free buffers
+//--------------------------------------------------------------------------------------------------
+#if LIBAVUTIL_VERSION_MAJOR < 57
+AVBufferRef *CPacketArena::AllocBuffer( void *pOpaque, int nSize )
+{
+	return ( (SSizeClass *)pOpaque )->pArena->AllocBuffer( (size_t)nSize );
+}
+#else
+AVBufferRef *CPacketArena::AllocBuffer( void *pOpaque, size_t unSize )
+{
+	return ( (SSizeClass *)pOpaque )->pArena->AllocBuffer( unSize );
+}
+#endif
+
+AVBufferRef *CPacketArena::AllocBuffer( size_t unSize )
+{
+	SDL_LockSpinlock( &m_Lock );
+	if ( m_Stats.unPeakBytes + unSize > m_unMaxBytes )
+	{
+		++m_Stats.unOverflows;
+		SDL_UnlockSpinlock( &m_Lock );
+		return nullptr;
+	}
+	m_Stats.unPeakBytes += unSize;
+	++m_Stats.unMisses;
+	SDL_UnlockSpinlock( &m_Lock );
+
+	AVBufferRef *pBuffer = av_buffer_alloc( unSize );
+	if ( !pBuffer )
+	{
+		SDL_LockSpinlock( &m_Lock );
+		m_Stats.unPeakBytes -= unSize;
+		SDL_UnlockSpinlock( &m_Lock );
+	}
+	return pBuffer;
+}
+
+
+//--------------------------------------------------------------------------------------------------
+// Move a packet's payload into an arena buffer
+//--------------------------------------------------------------------------------------------------
+bool CPacketArena::BMovePayload( AVPacket *pPacket )
+{
+	if ( pPacket->size <= 0 )
+	{
+		return false;
+	}
+
+	// Decoders can read past the end of the payload, so the padding has to come along
+	size_t unSize = (size_t)pPacket->size + AV_INPUT_BUFFER_PADDING_SIZE;
+	int iSizeClass = 0;
+	while ( iSizeClass < k_nSizeClasses && ( (size_t)1 << ( k_nMinSizeShift + iSizeClass ) ) < unSize )
+	{
+		++iSizeClass;
+	}
+
+	SDL_LockSpinlock( &m_Lock );
+	++m_unRequests;
+	if ( iSizeClass == k_nSizeClasses )
+	{
+		++m_Stats.unOverflows;
+		SDL_UnlockSpinlock( &m_Lock );
+		return false;
+	}
+	SDL_UnlockSpinlock( &m_Lock );
+
+	AVBufferRef *pBuffer = av_buffer_pool_get( m_SizeClasses[ iSizeClass ].pPool );
+	if ( !pBuffer )
+	{
+		return false;
+	}
+
+	SDL_memcpy( pBuffer->data, pPacket->data, pPacket->size );
+	SDL_memset( pBuffer->data + pPacket->size, 0, AV_INPUT_BUFFER_PADDING_SIZE );
+	av_buffer_unref( &pPacket->buf );
+	pPacket->buf = pBuffer;
+	pPacket->data = pBuffer->data;
+	return true;
+}
+
+
+//--------------------------------------------------------------------------------------------------
+// Return the arena counters
+//--------------------------------------------------------------------------------------------------
+CPacketArena::SStats CPacketArena::GetStats()
+{
+	SDL_LockSpinlock( &m_Lock );
+	SStats stats = m_Stats;
+	stats.unHits = m_unRequests - m_Stats.unMisses - m_Stats.unOverflows;
+	SDL_UnlockSpinlock( &m_Lock );
+	return stats;
+}
@@ -0,0 +1,120 @@
+/*
+  Copyright (C) 2024 Sam Lantinga <slouken@libsdl.org>
+
+  This software is provided 'as-is', without any express or implied
+  warranty.  In no event will the authors be held liable for any damages
+  arising from the use of this software.
+
+  Permission is granted to anyone to use this software for any purpose,
+  including commercial applications, and to alter it and redistribute it
+  freely.
+*/
+#ifndef AV_POOL_H
+#define AV_POOL_H
+
+#include <SDL3/SDL.h>
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavutil/buffer.h>
+}
+
+
+//--------------------------------------------------------------------------------------------------
+// Recycles AVFrame structures, so holding on to a reference to a frame doesn't allocate
+//
+// Frames can be taken and returned from any thread. Up to nMaxFrames unused frames are kept, any
+// more are freed when they are returned.
+//--------------------------------------------------------------------------------------------------
+class CFramePool
+{
+public:
+	struct SStats
+	{
+		Uint64 unHits;
+		Uint64 unMisses;
+		int nInUse;
+		int nPeakInUse;
+	};
+
+	CFramePool() { }
+	~CFramePool();
+
+	bool BInit( int nMaxFrames );
+
+	// Return a new reference to a frame, like av_frame_clone()
+	AVFrame *Clone( const AVFrame *pFrame );
+
+	// Unreference a frame and return it to the pool, like av_frame_free()
+	void Free( AVFrame **ppFrame );
+
+	SStats GetStats();
+
+private:
+	SDL_SpinLock m_Lock = 0;
+	AVFrame **m_ppFrames = nullptr;
+	int m_nMaxFrames = 0;
+	int m_nFrames = 0;
+	SStats m_Stats = { };
+};
+
+
+//--------------------------------------------------------------------------------------------------
+// Holds demuxed packet payloads in recycled buffers
+//
+// The demuxer allocates a new buffer for every packet, and those buffers live for as long as the
+// packet is queued. Over long playback sessions the mix of sizes fragments the heap. Payloads are
+// copied into buffers from power of two size classes that are kept and reused, so the demuxer's
+// buffer is freed straight away and the queued data only ever uses the arena. The arena stops
+// growing at unMaxBytes, packets that don't fit keep their original buffer.
+//--------------------------------------------------------------------------------------------------
+class CPacketArena
+{
+public:
+	struct SStats
+	{
+		Uint64 unHits;
+		Uint64 unMisses;
+		Uint64 unOverflows;		// Packets that didn't fit in the arena
+		size_t unPeakBytes;		// Buffers are kept once allocated, so this is also the current size
+	};
+
+	CPacketArena() { }
+	~CPacketArena();
+
+	bool BInit( size_t unMaxBytes );
+
+	// Move a packet's payload into the arena, returns false if it kept its own buffer
+	bool BMovePayload( AVPacket *pPacket );
+
+	SStats GetStats();
+
+private:
+	enum
+	{
+		k_nMinSizeShift = 10,	// 1 KB
+		k_nMaxSizeShift = 23,	// 8 MB
+		k_nSizeClasses = k_nMaxSizeShift - k_nMinSizeShift + 1
+	};
+
+	struct SSizeClass
+	{
+		CPacketArena *pArena;
+		AVBufferPool *pPool;
+	};
+
+#if LIBAVUTIL_VERSION_MAJOR < 57
+	static AVBufferRef *AllocBuffer( void *pOpaque, int nSize );
+#else
+	static AVBufferRef *AllocBuffer( void *pOpaque, size_t unSize );
+#endif
+	AVBufferRef *AllocBuffer( size_t unSize );
+
+	SDL_SpinLock m_Lock = 0;
+	SSizeClass m_SizeClasses[ k_nSizeClasses ] = { };
+	size_t m_unMaxBytes = 0;
+	Uint64 m_unRequests = 0;
+	SStats m_Stats = { };
+};
+
+#endif // AV_POOL_H
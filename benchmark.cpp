@@ -0,0 +1,286 @@
+/*
+  Copyright (C) 2024 Sam Lantinga <slouken@libsdl.org>
+
+  This software is provided 'as-is', without any express or implied
+  warranty.  In no event will the authors be held liable for any damages
+  arising from the use of this software.
+
+  Permission is granted to anyone to use this software for any purpose,
+  including commercial applications, and to alter it and redistribute it
+  freely.
+*/
+#include "benchmark.h"
+
+
+//--------------------------------------------------------------------------------------------------
+// CTimingStats destructor
+//--------------------------------------------------------------------------------------------------
+CTimingStats::~CTimingStats()
+{
+	SDL_free( m_pSamples );
+}
+
+
+//--------------------------------------------------------------------------------------------------
+// Add a sample to the distribution
+//--------------------------------------------------------------------------------------------------
+void CTimingStats::AddSample( float flValue )
+{
+	if ( m_nCount == m_nAllocated )
+	{
+		int nAllocated = m_nAllocated ? m_nAllocated * 2 : 1024;
+		float *pSamples = (float *)SDL_realloc( m_pSamples, nAllocated * sizeof( *pSamples ) );
+		if ( !pSamples )
+		{
+			return;
+		}
+		m_pSamples = pSamples;
+		m_nAllocated = nAllocated;
+	}
+
+	m_pSamples[ m_nCount++ ] = flValue;
+	m_flTotal += flValue;
+}
+
+
+//--------------------------------------------------------------------------------------------------
+// Summarize the distribution
+//--------------------------------------------------------------------------------------------------
+static int SDLCALL CompareSamples( const void *a, const void *b )
+{
+	float flA = *(const float *)a;
+	float flB = *(const float *)b;
+	return ( flA < flB ) ? -1 : ( flA > flB );
+}
+
+void CTimingStats::GetSummary( SSummary *pSummary )
+{
+	SDL_zerop( pSummary );
+
+	pSummary->nCount = m_nCount;
+	if ( m_nCount == 0 )
+	{
+		return;
+	}
+
+	SDL_qsort( m_pSamples, m_nCount, sizeof( *m_pSamples ), CompareSamples );
+
+	// Use the nearest rank for percentiles
+	auto Percentile = [this]( int nPercent ) {
+		int nRank = ( nPercent * m_nCount + 99 ) / 100;
+		return m_pSamples[ SDL_clamp( nRank - 1, 0, m_nCount - 1 ) ];
+	};
+
+	pSummary->flMin = m_pSamples[ 0 ];
+	pSummary->flMean = (float)( m_flTotal / m_nCount );
+	pSummary->flP50 = Percentile( 50 );
+	pSummary->flP95 = Percentile( 95 );
+	pSummary->flP99 = Percentile( 99 );
+	pSummary->flMax = m_pSamples[ m_nCount - 1 ];
+}
+
+
+//--------------------------------------------------------------------------------------------------
+// CBenchmark destructor
+//--------------------------------------------------------------------------------------------------
+CBenchmark::~CBenchmark()
+{
+	for ( int i = 0; i < m_nInfo; ++i )
+	{
+		SDL_free( m_Info[ i ].pszValue );
+	}
+	for ( int i = 0; i < m_nStats; ++i )
+	{
+		delete m_Stats[ i ].pStats;
+	}
+}
+
+
+//--------------------------------------------------------------------------------------------------
+// Mark the start and end of the measured run
+//--------------------------------------------------------------------------------------------------
+void CBenchmark::Start()
+{
+	m_unStartTime = SDL_GetTicksNS();
+	m_unStopTime = 0;
+}
+
+void CBenchmark::Stop()
+{
+	if ( !m_unStopTime )
+	{
+		m_unStopTime = SDL_GetTicksNS();
+	}
+}
+
+
+//--------------------------------------------------------------------------------------------------
+// Describe the run
+//--------------------------------------------------------------------------------------------------
+void CBenchmark::SetInfo( const char *pszKey, const char *pszValue )
+{
+	int i;
+	for ( i = 0; i < m_nInfo; ++i )
+	{
+		if ( SDL_strcmp( m_Info[ i ].pszKey, pszKey ) == 0 )
+		{
+			break;
+		}
+	}
+	if ( i == m_nInfo )
+	{
+		if ( m_nInfo == k_nMaxEntries )
+		{
+			return;
+		}
+		m_Info[ m_nInfo ].pszKey = pszKey;
+		m_Info[ m_nInfo ].pszValue = nullptr;
+		++m_nInfo;
+	}
+
+	SDL_free( m_Info[ i ].pszValue );
+	m_Info[ i ].pszValue = SDL_strdup( pszValue ? pszValue : "" );
+}
+
+
+//--------------------------------------------------------------------------------------------------
+// Record a count in a named group
+//--------------------------------------------------------------------------------------------------
+void CBenchmark::SetCounter( const char *pszGroup, const char *pszKey, Sint64 nValue )
+{
+	int i;
+	for ( i = 0; i < m_nCounters; ++i )
+	{
+		if ( SDL_strcmp( m_Counters[ i ].pszGroup, pszGroup ) == 0 && SDL_strcmp( m_Counters[ i ].pszKey, pszKey ) == 0 )
+		{
+			break;
+		}
+	}
+	if ( i == m_nCounters )
+	{
+		if ( m_nCounters == k_nMaxEntries )
+		{
+			return;
+		}
+		m_Counters[ m_nCounters ].pszGroup = pszGroup;
+		m_Counters[ m_nCounters ].pszKey = pszKey;
+		++m_nCounters;
+	}
+	m_Counters[ i ].nValue = nValue;
+}
+
+
+//--------------------------------------------------------------------------------------------------
+// Return the stats for a named stage
+//--------------------------------------------------------------------------------------------------
+CTimingStats *CBenchmark::GetStats( const char *pszName )
+{
+	for ( int i = 0; i < m_nStats; ++i )
+	{
+		if ( SDL_strcmp( m_Stats[ i ].pszName, pszName ) == 0 )
+		{
+			return m_Stats[ i ].pStats;
+		}
+	}
+
+	if ( m_nStats == k_nMaxEntries )
+	{
+		// Keep collecting into the last entry rather than failing
+		return m_Stats[ m_nStats - 1 ].pStats;
+	}
+	m_Stats[ m_nStats ].pszName = pszName;
+	m_Stats[ m_nStats ].pStats = new CTimingStats;
+	return m_Stats[ m_nStats++ ].pStats;
+}
+
+
+//--------------------------------------------------------------------------------------------------
+// Write the results as JSON
+//--------------------------------------------------------------------------------------------------
+static void WriteJSONString( SDL_IOStream *pIO, const char *pszValue )
+{
+	SDL_WriteU8( pIO, '"' );
+	for ( const char *pszChar = pszValue; *pszChar; ++pszChar )
+	{
+		unsigned char ch = (unsigned char)*pszChar;
+		if ( ch == '"' || ch == '\\' )
+		{
+			SDL_IOprintf( pIO, "\\%c", ch );
+		}
+		else if ( ch < 0x20 )
+		{
+			SDL_IOprintf( pIO, "\\u%04x", ch );
+		}
+		else
+		{
+			SDL_WriteU8( pIO, ch );
+		}
+	}
+	SDL_WriteU8( pIO, '"' );
+}
+
+bool CBenchmark::BWriteJSON( const char *pszFile )
+{
+	SDL_IOStream *pIO = SDL_IOFromFile( pszFile, "w" );
+	if ( !pIO )
+	{
+		return false;
+	}
+
+	Uint64 unStopTime = m_unStopTime ? m_unStopTime : SDL_GetTicksNS();
+	double flWallTime = (double)( unStopTime - m_unStartTime ) / SDL_NS_PER_SECOND;
+
+	SDL_IOprintf( pIO, "{\n" );
+	for ( int i = 0; i < m_nInfo; ++i )
+	{
+		SDL_IOprintf( pIO, "  \"%s\": ", m_Info[ i ].pszKey );
+		WriteJSONString( pIO, m_Info[ i ].pszValue );
+		SDL_IOprintf( pIO, ",\n" );
+	}
+	SDL_IOprintf( pIO, "  \"frames\": %d,\n", m_nFrames );
+	SDL_IOprintf( pIO, "  \"wall_time_ms\": %.3f,\n", flWallTime * 1000.0 );
+	SDL_IOprintf( pIO, "  \"average_fps\": %.3f,\n", ( flWallTime > 0.0 ) ? m_nFrames / flWallTime : 0.0 );
+
+	// Counters are grouped into objects in the order the groups were first used
+	for ( int i = 0; i < m_nCounters; ++i )
+	{
+		bool bFirstInGroup = true;
+		for ( int j = 0; j < i; ++j )
+		{
+			if ( SDL_strcmp( m_Counters[ j ].pszGroup, m_Counters[ i ].pszGroup ) == 0 )
+			{
+				bFirstInGroup = false;
+				break;
+			}
+		}
+		if ( !bFirstInGroup )
+		{
+			continue;
+		}
+
+		SDL_IOprintf( pIO, "  \"%s\": {", m_Counters[ i ].pszGroup );
+		const char *pszSeparator = "";
+		for ( int j = i; j < m_nCounters; ++j )
+		{
+			if ( SDL_strcmp( m_Counters[ j ].pszGroup, m_Counters[ i ].pszGroup ) == 0 )
+			{
+				SDL_IOprintf( pIO, "%s \"%s\": %" SDL_PRIs64, pszSeparator, m_Counters[ j ].pszKey, m_Counters[ j ].nValue );
+				pszSeparator = ",";
+			}
+		}
+		SDL_IOprintf( pIO, " },\n" );
+	}
+
+	SDL_IOprintf( pIO, "  \"stages_ms\": {" );
+	for ( int i = 0; i < m_nStats; ++i )
+	{
+		CTimingStats::SSummary summary;
+		m_Stats[ i ].pStats->GetSummary( &summary );
+		SDL_IOprintf( pIO, "%s\n    \"%s\": { \"count\": %d, \"min\": %.3f, \"mean\": %.3f, \"p50\": %.3f, \"p95\": %.3f, \"p99\": %.3f, \"max\": %.3f }",
+			( i > 0 ) ? "," : "", m_Stats[ i ].pszName, summary.nCount,
+			summary.flMin, summary.flMean, summary.flP50, summary.flP95, summary.flP99, summary.flMax );
+	}
+	SDL_IOprintf( pIO, "\n  }\n}\n" );
+
+	return SDL_CloseIO( pIO );
+}
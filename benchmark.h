@@ -0,0 +1,121 @@
+/*
+  Copyright (C) 2024 Sam Lantinga <slouken@libsdl.org>
+
+  This software is provided 'as-is', without any express or implied
+  warranty.  In no event will the authors be held liable for any damages
+  arising from the use of this software.
+
+  Permission is granted to anyone to use this software for any purpose,
+  including commercial applications, and to alter it and redistribute it
+  freely.
+*/
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include <SDL3/SDL.h>
+
+
+//--------------------------------------------------------------------------------------------------
+// A distribution of timing samples, in milliseconds
+//--------------------------------------------------------------------------------------------------
+class CTimingStats
+{
+public:
+	struct SSummary
+	{
+		int nCount;
+		float flMin;
+		float flMean;
+		float flP50;
+		float flP95;
+		float flP99;
+		float flMax;
+	};
+
+public:
+	CTimingStats() { }
+	~CTimingStats();
+
+	void AddSample( float flValue );
+
+	int GetCount() const { return m_nCount; }
+
+	// Sorts the samples collected so far and summarizes them
+	void GetSummary( SSummary *pSummary );
+
+private:
+	float *m_pSamples = nullptr;
+	int m_nCount = 0;
+	int m_nAllocated = 0;
+	double m_flTotal = 0.0;
+};
+
+
+//--------------------------------------------------------------------------------------------------
+// Collects benchmark results and writes them as JSON
+//
+// Keys are expected to be string literals, they aren't copied.
+//--------------------------------------------------------------------------------------------------
+class CBenchmark
+{
+public:
+	CBenchmark() { }
+	~CBenchmark();
+
+	void Start();
+	void Stop();
+
+	// Count a frame that was presented
+	void AddFrame() { ++m_nFrames; }
+
+	// Describe the run, e.g. the file and decoder used
+	void SetInfo( const char *pszKey, const char *pszValue );
+
+	// Record a count in a named group, e.g. dropped frames by cause
+	void SetCounter( const char *pszGroup, const char *pszKey, Sint64 nValue );
+
+	// Return the stats for a named stage, creating them if needed
+	CTimingStats *GetStats( const char *pszName );
+
+	bool BWriteJSON( const char *pszFile );
+
+private:
+	enum
+	{
+		k_nMaxEntries = 64
+	};
+
+	struct SInfo
+	{
+		const char *pszKey;
+		char *pszValue;
+	};
+
+	struct SCounter
+	{
+		const char *pszGroup;
+		const char *pszKey;
+		Sint64 nValue;
+	};
+
+	struct SStats
+	{
+		const char *pszName;
+		CTimingStats *pStats;
+	};
+
+	Uint64 m_unStartTime = 0;
+	Uint64 m_unStopTime = 0;
+	int m_nFrames = 0;
+
+	SInfo m_Info[ k_nMaxEntries ];
+	int m_nInfo = 0;
+
+	SCounter m_Counters[ k_nMaxEntries ];
+	int m_nCounters = 0;
+
+	SStats m_Stats[ k_nMaxEntries ];
+	int m_nStats = 0;
+};
+
+#endif // BENCHMARK_H
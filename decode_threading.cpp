@@ -0,0 +1,341 @@
+/*
+  Copyright (C) 2024 Sam Lantinga <slouken@libsdl.org>
+
+  This software is provided 'as-is', without any express or implied
+  warranty.  In no event will the authors be held liable for any damages
+  arising from the use of this software.
+
+  Permission is granted to anyone to use this software for any purpose,
+  including commercial applications, and to alter it and redistribute it
+  freely.
+*/
+#include "decode_threading.h"
+
+#include <errno.h>
+#include <pthread.h>
+
+extern "C" {
+#include <libavformat/avformat.h>
+}
+
+
+static const char *s_PolicyNames[] =
+{
+	"auto",
+	"slice",
+	"frame",
+};
+
+
+//--------------------------------------------------------------------------------------------------
+// Convert between policies and their names
+//--------------------------------------------------------------------------------------------------
+bool CDecodeThreading::BParsePolicy( const char *pszName, EPolicy *pePolicy )
+{
+	for ( int i = 0; i < (int)SDL_arraysize( s_PolicyNames ); ++i )
+	{
+		if ( SDL_strcmp( pszName, s_PolicyNames[ i ] ) == 0 )
+		{
+			*pePolicy = (EPolicy)i;
+			return true;
+		}
+	}
+	return false;
+}
+
+const char *CDecodeThreading::GetPolicyName( EPolicy ePolicy )
+{
+	return s_PolicyNames[ ePolicy ];
+}
+
+
+//--------------------------------------------------------------------------------------------------
+// Parse a CPU list like "0-3" or "2,3"
+//--------------------------------------------------------------------------------------------------
+bool CDecodeThreading::BSetCPUs( const char *pszCPUs )
+{
+	cpu_set_t cpus;
+	CPU_ZERO( &cpus );
+
+	const char *pszCPU = pszCPUs;
+	while ( *pszCPU )
+	{
+		char *pszEnd;
+		long nFirst = SDL_strtol( pszCPU, &pszEnd, 10 );
+		if ( pszEnd == pszCPU )
+		{
+			return false;
+		}
+		long nLast = nFirst;
+		pszCPU = pszEnd;
+		if ( *pszCPU == '-' )
+		{
+			++pszCPU;
+			nLast = SDL_strtol( pszCPU, &pszEnd, 10 );
+			if ( pszEnd == pszCPU )
+			{
+				return false;
+			}
+			pszCPU = pszEnd;
+		}
+		if ( nFirst < 0 || nLast < nFirst || nLast >= CPU_SETSIZE )
+		{
+			return false;
+		}
+		for ( long nCPU = nFirst; nCPU <= nLast; ++nCPU )
+		{
+			CPU_SET( nCPU, &cpus );
+		}
+
+		if ( *pszCPU == ',' )
+		{
+			++pszCPU;
+		}
+		else if ( *pszCPU )
+		{
+			return false;
+		}
+	}
+
+	if ( CPU_COUNT( &cpus ) == 0 )
+	{
+		return false;
+	}
+	m_CPUs = cpus;
+	m_bCPUs = true;
+	return true;
+}
+
+
+//--------------------------------------------------------------------------------------------------
+// Return the number of CPUs the decoder threads can run on
+//--------------------------------------------------------------------------------------------------
+int CDecodeThreading::GetCPUCount() const
+{
+	if ( m_bCPUs )
+	{
+		return CPU_COUNT( &m_CPUs );
+	}
+	return SDL_GetNumLogicalCPUCores();
+}
+
+
+//--------------------------------------------------------------------------------------------------
+// Set the threading fields of a software decoder context
+//--------------------------------------------------------------------------------------------------
+void CDecodeThreading::Apply( AVCodecContext *pContext, const AVCodec *pCodec ) const
+{
+	EPolicy ePolicy = m_ePolicy;
+	int nThreads = m_nThreads;
+
+	if ( ePolicy == k_EPolicyAuto )
+	{
+		if ( pCodec->capabilities & AV_CODEC_CAP_FRAME_THREADS )
+		{
+			ePolicy = k_EPolicyFrame;
+
+			// Small frames decode quickly enough with a few threads, and each one adds latency
+			if ( nThreads == 0 )
+			{
+				nThreads = GetCPUCount();
+				if ( pContext->height > 0 && pContext->height <= 720 )
+				{
+					nThreads = SDL_min( nThreads, 4 );
+				}
+			}
+		}
+		else
+		{
+			ePolicy = k_EPolicySlice;
+		}
+	}
+
+	// A thread count of 0 lets ffmpeg use one per CPU in the calling thread's affinity mask
+	pContext->thread_count = nThreads;
+	pContext->thread_type = ( ePolicy == k_EPolicyFrame ) ? FF_THREAD_FRAME : FF_THREAD_SLICE;
+}
+
+
+//--------------------------------------------------------------------------------------------------
+// Apply the CPU set to the calling thread while the decoder creates its threads
+//--------------------------------------------------------------------------------------------------
+bool CDecodeThreading::BBeginOpen()
+{
+	if ( !m_bCPUs )
+	{
+		return true;
+	}
+
+	if ( pthread_getaffinity_np( pthread_self(), sizeof( m_SavedCPUs ), &m_SavedCPUs ) != 0 ||
+	     pthread_setaffinity_np( pthread_self(), sizeof( m_CPUs ), &m_CPUs ) != 0 )
+	{
+		SDL_SetError( "Couldn't set decoder CPU affinity" );
+		return false;
+	}
+	m_bRestoreCPUs = true;
+	return true;
+}
+
+void CDecodeThreading::EndOpen()
+{
+	if ( m_bRestoreCPUs )
+	{
+		pthread_setaffinity_np( pthread_self(), sizeof( m_SavedCPUs ), &m_SavedCPUs );
+		m_bRestoreCPUs = false;
+	}
+}
+
+
+//--------------------------------------------------------------------------------------------------
+// Measure decoding throughput and latency for each threading policy
+//
+// The packets are read up front so only decoding is timed, and frames use the default ffmpeg
+// buffers. Latency is the number of packets sent before the first frame came out, less one, which
+// covers both frame reordering and frame threading.
+//--------------------------------------------------------------------------------------------------
+bool CDecodeThreading::BBenchmark( const char *pszFile )
+{
+	enum
+	{
+		k_nMaxPackets = 300
+	};
+
+	static const struct
+	{
+		EPolicy ePolicy;
+		int nThreads;
+	} s_Configs[] =
+	{
+		{ k_EPolicySlice, 1 },
+		{ k_EPolicySlice, 0 },
+		{ k_EPolicyFrame, 2 },
+		{ k_EPolicyFrame, 4 },
+		{ k_EPolicyFrame, 0 },
+		{ k_EPolicyAuto, 0 },
+	};
+
+	AVFormatContext *pFormat = nullptr;
+	if ( avformat_open_input( &pFormat, pszFile, nullptr, nullptr ) < 0 )
+	{
+		SDL_Log( "Couldn't open %s", pszFile );
+		return false;
+	}
+
+	const AVCodec *pCodec = nullptr;
+	int iStream = av_find_best_stream( pFormat, AVMEDIA_TYPE_VIDEO, -1, -1, &pCodec, 0 );
+	if ( iStream < 0 )
+	{
+		SDL_Log( "Couldn't find a video stream in %s", pszFile );
+		avformat_close_input( &pFormat );
+		return false;
+	}
+	const AVCodecParameters *pParameters = pFormat->streams[ iStream ]->codecpar;
+
+	AVPacket *pPackets[ k_nMaxPackets ];
+	int nPackets = 0;
+	AVPacket *pPacket = av_packet_alloc();
+	while ( pPacket && nPackets < k_nMaxPackets && av_read_frame( pFormat, pPacket ) >= 0 )
+	{
+		if ( pPacket->stream_index != iStream )
+		{
+			av_packet_unref( pPacket );
+			continue;
+		}
+		pPackets[ nPackets++ ] = pPacket;
+		pPacket = av_packet_alloc();
+	}
+	av_packet_free( &pPacket );
+
+	SDL_Log( "Decoding %d packets of %s %dx%d with %s on %d CPUs", nPackets, avcodec_get_name( pCodec->id ), pParameters->width, pParameters->height, pCodec->name, SDL_GetNumLogicalCPUCores() );
+
+	bool bSuccess = ( nPackets > 0 );
+	AVFrame *pFrame = av_frame_alloc();
+	for ( int iConfig = 0; iConfig < (int)SDL_arraysize( s_Configs ) && bSuccess; ++iConfig )
+	{
+		CDecodeThreading threading;
+		threading.SetPolicy( s_Configs[ iConfig ].ePolicy );
+		threading.SetThreadCount( s_Configs[ iConfig ].nThreads );
+
+		AVCodecContext *pContext = avcodec_alloc_context3( nullptr );
+		if ( !pContext || avcodec_parameters_to_context( pContext, pParameters ) < 0 )
+		{
+			avcodec_free_context( &pContext );
+			bSuccess = false;
+			break;
+		}
+		threading.Apply( pContext, pCodec );
+		if ( avcodec_open2( pContext, pCodec, nullptr ) < 0 )
+		{
+			SDL_Log( "Couldn't open %s", pCodec->name );
+			avcodec_free_context( &pContext );
+			bSuccess = false;
+			break;
+		}
+
+		int nSent = 0;
+		int nFrames = 0;
+		int nLatency = -1;
+		Uint64 unStartNS = SDL_GetTicksNS();
+		for ( int i = 0; i <= nPackets; ++i )
+		{
+			// A null packet at the end drains the decoder
+			const AVPacket *pSend = ( i < nPackets ) ? pPackets[ i ] : nullptr;
+			int nResult;
+			while ( ( nResult = avcodec_send_packet( pContext, pSend ) ) == AVERROR( EAGAIN ) )
+			{
+				if ( avcodec_receive_frame( pContext, pFrame ) != 0 )
+				{
+					break;
+				}
+				if ( nLatency < 0 )
+				{
+					nLatency = nSent - 1;
+				}
+				++nFrames;
+				av_frame_unref( pFrame );
+			}
+			if ( pSend && nResult == 0 )
+			{
+				++nSent;
+			}
+
+			while ( avcodec_receive_frame( pContext, pFrame ) == 0 )
+			{
+				if ( nLatency < 0 )
+				{
+					nLatency = nSent - 1;
+				}
+				++nFrames;
+				av_frame_unref( pFrame );
+			}
+		}
+		double flSeconds = (double)( SDL_GetTicksNS() - unStartNS ) / SDL_NS_PER_SECOND;
+
+		const char *pszActive = "none";
+		if ( pContext->active_thread_type & FF_THREAD_FRAME )
+		{
+			pszActive = "frame";
+		}
+		else if ( pContext->active_thread_type & FF_THREAD_SLICE )
+		{
+			pszActive = "slice";
+		}
+
+		SDL_Log( "%-5s %2d threads (%s active): %7.1f fps, %6.2f ms/frame, latency %d frames",
+			GetPolicyName( s_Configs[ iConfig ].ePolicy ), pContext->thread_count, pszActive,
+			( flSeconds > 0.0 ) ? nFrames / flSeconds : 0.0,
+			nFrames ? flSeconds * 1000.0 / nFrames : 0.0,
+			SDL_max( nLatency, 0 ) );
+
+		avcodec_free_context( &pContext );
+	}
+	av_frame_free( &pFrame );
+
+	for ( int i = 0; i < nPackets; ++i )
+	{
+		av_packet_free( &pPackets[ i ] );
+	}
+	avformat_close_input( &pFormat );
+
+	return bSuccess;
+}
@@ -0,0 +1,75 @@
+/*
+  Copyright (C) 2024 Sam Lantinga <slouken@libsdl.org>
+
+  This software is provided 'as-is', without any express or implied
+  warranty.  In no event will the authors be held liable for any damages
+  arising from the use of this software.
+
+  Permission is granted to anyone to use this software for any purpose,
+  including commercial applications, and to alter it and redistribute it
+  freely.
+*/
+#ifndef DECODE_THREADING_H
+#define DECODE_THREADING_H
+
+#include <SDL3/SDL.h>
+#include <sched.h>
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+}
+
+
+//--------------------------------------------------------------------------------------------------
+// How software decoders spread their work across threads
+//
+// Slice threading only helps with streams that are encoded with several slices per frame, which
+// many aren't. Frame threading works on any stream, but each extra thread delays the output by a
+// frame. The auto policy uses frame threading where the decoder supports it, with fewer threads
+// for small frames that don't need them.
+//--------------------------------------------------------------------------------------------------
+class CDecodeThreading
+{
+public:
+	enum EPolicy
+	{
+		k_EPolicyAuto,		// Frame threading if the decoder supports it, sized by resolution
+		k_EPolicySlice,		// Threads decode slices of the same frame
+		k_EPolicyFrame		// Threads decode consecutive frames
+	};
+
+	static bool BParsePolicy( const char *pszName, EPolicy *pePolicy );
+	static const char *GetPolicyName( EPolicy ePolicy );
+
+	void SetPolicy( EPolicy ePolicy ) { m_ePolicy = ePolicy; }
+	EPolicy GetPolicy() const { return m_ePolicy; }
+
+	// Set the number of decoder threads, 0 picks one based on the policy and CPU count
+	void SetThreadCount( int nThreads ) { m_nThreads = nThreads; }
+
+	// Restrict the decoder threads to a list of CPUs like "2,3" or "0-3"
+	bool BSetCPUs( const char *pszCPUs );
+
+	// Set the threading fields of a software decoder context, before it is opened
+	void Apply( AVCodecContext *pContext, const AVCodec *pCodec ) const;
+
+	// Decoders create their threads in avcodec_open2(), which inherit the calling thread's
+	// affinity, so the CPU set is applied to the calling thread around the call.
+	bool BBeginOpen();
+	void EndOpen();
+
+	// Decode the start of a file with a range of policies and log frames per second and latency
+	static bool BBenchmark( const char *pszFile );
+
+private:
+	int GetCPUCount() const;
+
+	EPolicy m_ePolicy = k_EPolicyAuto;
+	int m_nThreads = 0;
+	bool m_bCPUs = false;
+	cpu_set_t m_CPUs;
+	bool m_bRestoreCPUs = false;
+	cpu_set_t m_SavedCPUs;
+};
+
+#endif // DECODE_THREADING_H
@@ -0,0 +1,107 @@
+/*
+  Copyright (C) 2024 Sam Lantinga <slouken@libsdl.org>
+
+  This software is provided 'as-is', without any express or implied
+  warranty.  In no event will the authors be held liable for any damages
+  arising from the use of this software.
+
+  Permission is granted to anyone to use this software for any purpose,
+  including commercial applications, and to alter it and redistribute it
+  freely.
+*/
+#include "decoder_pipeline.h"
+
+
+//--------------------------------------------------------------------------------------------------
+// Stop tracking a packet
+//--------------------------------------------------------------------------------------------------
+void CDecoderPipeline::RemovePacket( int iPacket )
+{
+	m_Packets[ iPacket ] = m_Packets[ --m_nPackets ];
+	SDL_SetAtomicInt( &m_nInFlight, m_nPackets );
+}
+
+
+//--------------------------------------------------------------------------------------------------
+// Record a packet that was accepted by the decoder
+//--------------------------------------------------------------------------------------------------
+void CDecoderPipeline::OnPacketSent( Sint64 nTimestamp, Uint64 unSendNS )
+{
+	if ( m_nPackets == k_nMaxPackets )
+	{
+		// Forget the oldest packet, the decoder has probably dropped it
+		int iOldest = 0;
+		for ( int i = 1; i < m_nPackets; ++i )
+		{
+			if ( m_Packets[ i ].unSendNS < m_Packets[ iOldest ].unSendNS )
+			{
+				iOldest = i;
+			}
+		}
+		RemovePacket( iOldest );
+		++m_Stats.unPacketsDropped;
+	}
+
+	SPacket *pPacket = &m_Packets[ m_nPackets++ ];
+	pPacket->nTimestamp = nTimestamp;
+	pPacket->unSendNS = unSendNS;
+	SDL_SetAtomicInt( &m_nInFlight, m_nPackets );
+
+	++m_Stats.unPacketsSent;
+	m_Stats.nMaxInFlight = SDL_max( m_Stats.nMaxInFlight, m_nPackets );
+}
+
+
+//--------------------------------------------------------------------------------------------------
+// Match a received frame to the packet it was decoded from
+//--------------------------------------------------------------------------------------------------
+Uint64 CDecoderPipeline::OnFrameReceived( Sint64 nTimestamp, Uint64 unReceiveNS )
+{
+	++m_Stats.unFramesReceived;
+
+	// Fall back to the oldest packet if the decoder didn't pass the timestamp through
+	int iMatch = -1;
+	int iOldest = -1;
+	for ( int i = 0; i < m_nPackets; ++i )
+	{
+		if ( m_Packets[ i ].nTimestamp == nTimestamp )
+		{
+			iMatch = i;
+			break;
+		}
+		if ( iOldest < 0 || m_Packets[ i ].unSendNS < m_Packets[ iOldest ].unSendNS )
+		{
+			iOldest = i;
+		}
+	}
+	if ( iMatch < 0 )
+	{
+		iMatch = iOldest;
+	}
+	if ( iMatch < 0 )
+	{
+		return 0;
+	}
+
+	Uint64 unSendNS = m_Packets[ iMatch ].unSendNS;
+	bool bMatched = ( m_Packets[ iMatch ].nTimestamp == nTimestamp );
+	RemovePacket( iMatch );
+
+	// Frames come out in presentation order, so earlier packets aren't going to produce one
+	if ( bMatched )
+	{
+		for ( int i = m_nPackets - 1; i >= 0; --i )
+		{
+			if ( m_Packets[ i ].nTimestamp < nTimestamp )
+			{
+				RemovePacket( i );
+				++m_Stats.unPacketsDropped;
+			}
+		}
+	}
+
+	Uint64 unLatencyNS = ( unReceiveNS > unSendNS ) ? ( unReceiveNS - unSendNS ) : 0;
+	m_Stats.unTotalLatencyNS += unLatencyNS;
+	m_Stats.unMaxLatencyNS = SDL_max( m_Stats.unMaxLatencyNS, unLatencyNS );
+	return unSendNS;
+}
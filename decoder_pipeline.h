@@ -0,0 +1,69 @@
+/*
+  Copyright (C) 2024 Sam Lantinga <slouken@libsdl.org>
+
+  This software is provided 'as-is', without any express or implied
+  warranty.  In no event will the authors be held liable for any damages
+  arising from the use of this software.
+
+  Permission is granted to anyone to use this software for any purpose,
+  including commercial applications, and to alter it and redistribute it
+  freely.
+*/
+#ifndef DECODER_PIPELINE_H
+#define DECODER_PIPELINE_H
+
+#include <SDL3/SDL.h>
+
+
+//--------------------------------------------------------------------------------------------------
+// Tracks the packets that have been sent to a decoder and haven't come out as frames yet
+//
+// Packets are matched to frames by timestamp. Frames come out in presentation order, so when a
+// frame is received any older packets still being tracked were dropped by the decoder, e.g. when
+// skipping non-reference frames. Packets are sent and frames received on the decode thread, the
+// number in flight can be read from any thread.
+//--------------------------------------------------------------------------------------------------
+class CDecoderPipeline
+{
+public:
+	struct SStats
+	{
+		Uint64 unPacketsSent;
+		Uint64 unFramesReceived;
+		Uint64 unPacketsDropped;	// Sent but never produced a frame
+		int nMaxInFlight;
+		Uint64 unTotalLatencyNS;	// Send to receive, for the frames that were matched
+		Uint64 unMaxLatencyNS;
+	};
+
+	void OnPacketSent( Sint64 nTimestamp, Uint64 unSendNS );
+
+	// Returns the time the frame's packet was sent, or 0 if it can't be matched
+	Uint64 OnFrameReceived( Sint64 nTimestamp, Uint64 unReceiveNS );
+
+	int GetPacketsInFlight() { return SDL_GetAtomicInt( &m_nInFlight ); }
+
+	// This should be read once decoding has stopped
+	const SStats &GetStats() const { return m_Stats; }
+
+private:
+	enum
+	{
+		k_nMaxPackets = 64
+	};
+
+	struct SPacket
+	{
+		Sint64 nTimestamp;
+		Uint64 unSendNS;
+	};
+
+	void RemovePacket( int iPacket );
+
+	SPacket m_Packets[ k_nMaxPackets ];
+	int m_nPackets = 0;
+	SDL_AtomicInt m_nInFlight = { 0 };
+	SStats m_Stats = { };
+};
+
+#endif // DECODER_PIPELINE_H
@@ -0,0 +1,203 @@
+/*
+  Copyright (C) 2024 Sam Lantinga <slouken@libsdl.org>
+
+  This software is provided 'as-is', without any express or implied
+  warranty.  In no event will the authors be held liable for any damages
+  arising from the use of this software.
+
+  Permission is granted to anyone to use this software for any purpose,
+  including commercial applications, and to alter it and redistribute it
+  freely.
+*/
+#include "frame_queue.h"
+
+
+//--------------------------------------------------------------------------------------------------
+// CFrameQueue destructor
+//--------------------------------------------------------------------------------------------------
+CFrameQueue::~CFrameQueue()
+{
+	if ( m_pFrames )
+	{
+		for ( int i = 0; i < m_nMaxFrames; ++i )
+		{
+			av_frame_free( &m_pFrames[ i ].pFrame );
+		}
+		delete[] m_pFrames;
+	}
+	if ( m_pCondition )
+	{
+		SDL_DestroyCondition( m_pCondition );
+	}
+	if ( m_pMutex )
+	{
+		SDL_DestroyMutex( m_pMutex );
+	}
+}
+
+
+//--------------------------------------------------------------------------------------------------
+// Initialize the frame queue
+//--------------------------------------------------------------------------------------------------
+bool CFrameQueue::BInit( int nMaxFrames )
+{
+	m_pMutex = SDL_CreateMutex();
+	if ( !m_pMutex )
+	{
+		return false;
+	}
+
+	m_pCondition = SDL_CreateCondition();
+	if ( !m_pCondition )
+	{
+		return false;
+	}
+
+	m_pFrames = new SQueuedFrame[ nMaxFrames ];
+	m_nMaxFrames = nMaxFrames;
+	for ( int i = 0; i < nMaxFrames; ++i )
+	{
+		m_pFrames[ i ].pFrame = av_frame_alloc();
+		if ( !m_pFrames[ i ].pFrame )
+		{
+			SDL_SetError( "av_frame_alloc() failed" );
+			return false;
+		}
+		m_pFrames[ i ].flPTS = 0.0;
+	}
+
+	return true;
+}
+
+
+//--------------------------------------------------------------------------------------------------
+// Add a frame to the queue
+//--------------------------------------------------------------------------------------------------
+bool CFrameQueue::BPut( AVFrame *pFrame, double flPTS, const CGraphSample &sample )
+{
+	SDL_LockMutex( m_pMutex );
+	while ( m_nCount == m_nMaxFrames && !m_bAborted )
+	{
+		SDL_WaitCondition( m_pCondition, m_pMutex );
+	}
+	if ( m_bAborted )
+	{
+		SDL_UnlockMutex( m_pMutex );
+		av_frame_unref( pFrame );
+		return false;
+	}
+
+	SQueuedFrame *pEntry = &m_pFrames[ ( m_nHead + m_nCount ) % m_nMaxFrames ];
+	av_frame_move_ref( pEntry->pFrame, pFrame );
+	pEntry->flPTS = flPTS;
+	pEntry->sample = sample;
+	++m_nCount;
+
+	SDL_BroadcastCondition( m_pCondition );
+	SDL_UnlockMutex( m_pMutex );
+	return true;
+}
+
+
+//--------------------------------------------------------------------------------------------------
+// Return the oldest frame in the queue
+//--------------------------------------------------------------------------------------------------
+SQueuedFrame *CFrameQueue::Peek( Sint32 nTimeoutMS )
+{
+	SDL_LockMutex( m_pMutex );
+	if ( m_nCount == 0 && !m_bEndOfStream && !m_bAborted && nTimeoutMS != 0 )
+	{
+		SDL_WaitConditionTimeout( m_pCondition, m_pMutex, nTimeoutMS );
+	}
+	SQueuedFrame *pEntry = nullptr;
+	if ( m_nCount > 0 && !m_bAborted )
+	{
+		pEntry = &m_pFrames[ m_nHead ];
+	}
+	SDL_UnlockMutex( m_pMutex );
+
+	// Only the presenter removes frames, so the entry stays valid until Pop()
+	return pEntry;
+}
+
+
+//--------------------------------------------------------------------------------------------------
+// Release the oldest frame in the queue
+//--------------------------------------------------------------------------------------------------
+void CFrameQueue::Pop()
+{
+	SDL_LockMutex( m_pMutex );
+	if ( m_nCount > 0 )
+	{
+		av_frame_unref( m_pFrames[ m_nHead ].pFrame );
+		m_nHead = ( m_nHead + 1 ) % m_nMaxFrames;
+		--m_nCount;
+	}
+	SDL_BroadcastCondition( m_pCondition );
+	SDL_UnlockMutex( m_pMutex );
+}
+
+
+//--------------------------------------------------------------------------------------------------
+// Mark that no more frames will be added
+//--------------------------------------------------------------------------------------------------
+void CFrameQueue::SetEndOfStream()
+{
+	SDL_LockMutex( m_pMutex );
+	m_bEndOfStream = true;
+	SDL_BroadcastCondition( m_pCondition );
+	SDL_UnlockMutex( m_pMutex );
+}
+
+
+//--------------------------------------------------------------------------------------------------
+// Returns true if the end of stream has been reached and the queue is empty
+//--------------------------------------------------------------------------------------------------
+bool CFrameQueue::BFinished()
+{
+	SDL_LockMutex( m_pMutex );
+	bool bFinished = ( m_bEndOfStream && m_nCount == 0 );
+	SDL_UnlockMutex( m_pMutex );
+	return bFinished;
+}
+
+
+//--------------------------------------------------------------------------------------------------
+// Wake up any waiting callers and fail further requests
+//--------------------------------------------------------------------------------------------------
+void CFrameQueue::Abort()
+{
+	SDL_LockMutex( m_pMutex );
+	m_bAborted = true;
+	SDL_BroadcastCondition( m_pCondition );
+	SDL_UnlockMutex( m_pMutex );
+}
+
+
+//--------------------------------------------------------------------------------------------------
+// Release the frames in the queue
+//--------------------------------------------------------------------------------------------------
+void CFrameQueue::Flush()
+{
+	SDL_LockMutex( m_pMutex );
+	while ( m_nCount > 0 )
+	{
+		av_frame_unref( m_pFrames[ m_nHead ].pFrame );
+		m_nHead = ( m_nHead + 1 ) % m_nMaxFrames;
+		--m_nCount;
+	}
+	SDL_BroadcastCondition( m_pCondition );
+	SDL_UnlockMutex( m_pMutex );
+}
+
+
+//--------------------------------------------------------------------------------------------------
+// Return the number of frames waiting to be presented
+//--------------------------------------------------------------------------------------------------
+int CFrameQueue::GetCount()
+{
+	SDL_LockMutex( m_pMutex );
+	int nCount = m_nCount;
+	SDL_UnlockMutex( m_pMutex );
+	return nCount;
+}
@@ -0,0 +1,80 @@
+/*
+  Copyright (C) 2024 Sam Lantinga <slouken@libsdl.org>
+
+  This software is provided 'as-is', without any express or implied
+  warranty.  In no event will the authors be held liable for any damages
+  arising from the use of this software.
+
+  Permission is granted to anyone to use this software for any purpose,
+  including commercial applications, and to alter it and redistribute it
+  freely.
+*/
+#ifndef FRAME_QUEUE_H
+#define FRAME_QUEUE_H
+
+#include <SDL3/SDL.h>
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+}
+
+#include "frame_timing.h"
+
+
+//--------------------------------------------------------------------------------------------------
+// A decoded frame waiting to be presented
+//--------------------------------------------------------------------------------------------------
+struct SQueuedFrame
+{
+	AVFrame *pFrame;
+	double flPTS;
+	CGraphSample sample;
+};
+
+
+//--------------------------------------------------------------------------------------------------
+// A small thread-safe ring of decoded frames, written by the decode thread and read by the presenter
+//--------------------------------------------------------------------------------------------------
+class CFrameQueue
+{
+public:
+	CFrameQueue() { }
+	~CFrameQueue();
+
+	bool BInit( int nMaxFrames );
+
+	// Move a frame into the queue, waiting while the queue is full
+	bool BPut( AVFrame *pFrame, double flPTS, const CGraphSample &sample );
+
+	// Return the oldest frame in the queue, waiting up to nTimeoutMS for one to arrive
+	SQueuedFrame *Peek( Sint32 nTimeoutMS );
+
+	// Release the frame returned by Peek()
+	void Pop();
+
+	// Mark that no more frames will be added
+	void SetEndOfStream();
+
+	// Returns true if the end of stream has been reached and all frames have been removed
+	bool BFinished();
+
+	// Wake up and fail any waiting callers, used at shutdown
+	void Abort();
+
+	// Release any frames still in the queue, used at shutdown once the decode thread has stopped
+	void Flush();
+
+	int GetCount();
+
+private:
+	SDL_Mutex *m_pMutex = nullptr;
+	SDL_Condition *m_pCondition = nullptr;
+	SQueuedFrame *m_pFrames = nullptr;
+	int m_nMaxFrames = 0;
+	int m_nHead = 0;
+	int m_nCount = 0;
+	bool m_bEndOfStream = false;
+	bool m_bAborted = false;
+};
+
+#endif // FRAME_QUEUE_H
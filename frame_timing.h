@@ -0,0 +1,191 @@
+/*
+  Copyright (C) 2024 Sam Lantinga <slouken@libsdl.org>
+
+  This software is provided 'as-is', without any express or implied
+  warranty.  In no event will the authors be held liable for any damages
+  arising from the use of this software.
+
+  Permission is granted to anyone to use this software for any purpose,
+  including commercial applications, and to alter it and redistribute it
+  freely.
+*/
+#ifndef FRAME_TIMING_H
+#define FRAME_TIMING_H
+
+#include <SDL3/SDL.h>
+
+enum EFrameStage
+{
+    k_FrameStageReadPacket,
+    k_FrameStageSendPacket,
+    k_FrameStageReceiveFrame,
+    k_FrameStageDecode,
+    k_FrameStageQueued,
+    k_FrameStageUpdateVideo,
+    k_FrameStageOverlayDraw,
+    k_FrameStageOverlayUpload,
+    k_FrameStagePacing,
+    k_FrameStagePresent,
+    k_FrameStageScanout,
+    k_FrameStageCount,
+};
+
+static inline const char *GetFrameStageName(EFrameStage eStage)
+{
+    switch (eStage) {
+    case k_FrameStageReadPacket:
+        return "read_packet";
+    case k_FrameStageSendPacket:
+        return "send_packet";
+    case k_FrameStageReceiveFrame:
+        return "receive_frame";
+    case k_FrameStageDecode:
+        return "decode";
+    case k_FrameStageQueued:
+        return "queued";
+    case k_FrameStageUpdateVideo:
+        return "update_video";
+    case k_FrameStageOverlayDraw:
+        return "overlay_draw";
+    case k_FrameStageOverlayUpload:
+        return "overlay_upload";
+    case k_FrameStagePacing:
+        return "pacing";
+    case k_FrameStagePresent:
+        return "present";
+    case k_FrameStageScanout:
+        return "scanout";
+    default:
+        return "unknown";
+    }
+}
+
+/* A stage may run several times for one frame, e.g. sending several packets before a frame is
+   decoded. The time spent is added up, and the span covers the first start to the last end.
+ */
+class CGraphSample
+{
+public:
+    CGraphSample() { Reset(); }
+
+    void Reset() {
+        SDL_zero(m_start);
+        SDL_zero(m_end);
+        SDL_zero(m_pending);
+        SDL_zero(m_duration);
+        SDL_zero(m_threads);
+        m_started = false;
+        m_packets_queued = 0;
+        m_frames_queued = 0;
+        m_packets_in_decoder = 0;
+        m_has_av_drift = false;
+        m_av_drift_ms = 0.0f;
+    }
+
+    bool BStarted() const {
+        return m_started;
+    }
+
+    void StartStage(EFrameStage eStage) {
+        m_pending[eStage] = SDL_GetTicksNS();
+        if (!m_start[eStage]) {
+            m_threads[eStage] = SDL_GetCurrentThreadID();
+        }
+    }
+
+    void EndStage(EFrameStage eStage) {
+        AddStage(eStage, m_pending[eStage], SDL_GetTicksNS(), m_threads[eStage] ? m_threads[eStage] : SDL_GetCurrentThreadID());
+    }
+
+    /* Add time spent in a stage that was measured elsewhere */
+    void AddStage(EFrameStage eStage, Uint64 start, Uint64 end, SDL_ThreadID thread) {
+        if (!start || end < start) {
+            return;
+        }
+        if (!m_start[eStage]) {
+            m_start[eStage] = start;
+            m_threads[eStage] = thread;
+        }
+        m_end[eStage] = end;
+        m_duration[eStage] += (end - start);
+        m_started = true;
+    }
+
+    bool BHasStage(EFrameStage eStage) const {
+        return (m_start[eStage] != 0);
+    }
+
+    /* The time at which this frame was presented */
+    float GetFrameTimeMS() const {
+        return SDL_NS_TO_US(m_start[k_FrameStagePresent]) / 1000.0f;
+    }
+
+    Uint64 GetStageStart(EFrameStage eStage) const {
+        return m_start[eStage];
+    }
+
+    Uint64 GetStageEnd(EFrameStage eStage) const {
+        return m_end[eStage];
+    }
+
+    /* The thread that started this stage */
+    SDL_ThreadID GetStageThread(EFrameStage eStage) const {
+        return m_threads[eStage];
+    }
+
+    float GetStageDuration(EFrameStage eStage) const {
+        return SDL_NS_TO_US(m_duration[eStage]) / 1000.0f;
+    }
+
+    /* Pipeline occupancy when this frame was presented */
+    void SetQueueDepth(int packets_queued, int frames_queued) {
+        m_packets_queued = packets_queued;
+        m_frames_queued = frames_queued;
+    }
+
+    int GetPacketsQueued() const {
+        return m_packets_queued;
+    }
+
+    int GetFramesQueued() const {
+        return m_frames_queued;
+    }
+
+    /* Packets inside the decoder when this frame came out */
+    void SetPacketsInDecoder(int packets_in_decoder) {
+        m_packets_in_decoder = packets_in_decoder;
+    }
+
+    int GetPacketsInDecoder() const {
+        return m_packets_in_decoder;
+    }
+
+    /* Difference between the frame timestamp and the audio clock when it was presented */
+    void SetAVDrift(float drift_ms) {
+        m_has_av_drift = true;
+        m_av_drift_ms = drift_ms;
+    }
+
+    bool BHasAVDrift() const {
+        return m_has_av_drift;
+    }
+
+    float GetAVDriftMS() const {
+        return m_av_drift_ms;
+    }
+
+private:
+    Uint64 m_start[k_FrameStageCount];
+    Uint64 m_end[k_FrameStageCount];
+    Uint64 m_pending[k_FrameStageCount];
+    Uint64 m_duration[k_FrameStageCount];
+    SDL_ThreadID m_threads[k_FrameStageCount];
+    bool m_started;
+    int m_packets_queued;
+    int m_frames_queued;
+    int m_packets_in_decoder;
+    bool m_has_av_drift;
+    float m_av_drift_ms;
+};
+
+#endif // FRAME_TIMING_H
@@ -19,7 +19,20 @@ extern "C" {
 #include <libavutil/pixdesc.h>
 }
 
+#include "audio_interleave.h"
+#include "audio_ring.h"
+#include "av_clock.h"
+#include "av_pool.h"
+#include "benchmark.h"
+#include "decode_threading.h"
+#include "decoder_pipeline.h"
+#include "frame_queue.h"
+#include "packet_queue.h"
+#include "trace.h"
+#include "video_compositor.h"
+#include "video_decoder.h"
 #include "video_display.h"
+#include "video_display_egl.h"
 
 #include "icon.h"
 
@@ -33,77 +46,157 @@ static SDL_Renderer *renderer;
 static CVideoDisplay *display;
 static SDL_Surface *overlay;
 static int video_width;
+static AVRational video_sample_aspect;
 static int video_height;
 static SDL_AudioStream *audio;
-static Uint64 video_start;
 static bool verbose;
 static bool enable_timing;
+static bool enable_pacing = true;
+static const char *benchmark_file;
+static CBenchmark benchmark;
+static const char *trace_file;
+static CTraceRecorder trace;
+
+/* Decoder probe results, saved in the preferences directory unless --decoder-cache is used */
+static const char *decoder_cache_file;
+static char *decoder_cache_path;
+static double video_decoder_open_ms;
+
+/* Enough for about 50000 frames */
+#define TRACE_MAX_EVENTS    (256 * 1024)
+
+/* Demuxed packets waiting to be decoded, filled by the demux thread */
+static int packet_queue_count = 1024;
+static int packet_queue_kb = 32 * 1024;
+static int packet_queue_ms = 2000;
+static CPacketQueue audio_packets;
+static CPacketQueue video_packets;
+
+/* Recycled packet payloads and frame references, 0 disables them */
+static int packet_arena_kb = 64 * 1024;
+static CPacketArena packet_arena;
+static int frame_pool_size = 8;
+static CFramePool frame_pool;
+
+/* Decoded frames waiting to be presented, filled by the video decode thread */
+static int frame_queue_size = 3;
+static CFrameQueue video_frames;
+static SDL_AtomicInt quitting;
+
+/* Timestamps are relative to the start of the media, or the first timestamp decoded if that isn't known */
+static SDL_SpinLock start_pts_lock;
+static bool start_pts_valid;
+static double start_pts;
+
+/* What to do with frames that are too late to be shown on time */
+typedef enum
+{
+    LATE_FRAMES_NONE,
+    LATE_FRAMES_DROP,
+    LATE_FRAMES_SKIP
+} LateFramePolicy;
+
+/* A frame is late if it's behind the master clock by more than this, or by more than a frame interval */
+#define LATE_FRAME_THRESHOLD    0.040
+#define MAX_FRAME_DELAY         1.0
+
+/* Video presentation is synchronized to the master clock */
+static CMasterClock master_clock;
+static LateFramePolicy late_frames = LATE_FRAMES_DROP;
+static SDL_AtomicInt video_skip_nonref;
+static double last_video_pts = -1.0;
+static int late_frames_dropped;
+static double av_drift_total;
+static int av_drift_count;
+
+/* Decoded audio waiting to be played, filled by the audio thread and read by the audio callback */
+static int audio_latency_ms = 100;
+static SDL_AudioSpec audio_spec;
+static CAudioRingBuffer audio_ring;
+static Uint8 *audio_callback_buffer;
+static int audio_callback_buffer_size;
+static SDL_AtomicInt audio_started;
+static SDL_AtomicInt audio_finished;
+static SDL_AtomicInt audio_underruns;
+static Uint8 *audio_interleave_buffer;
+static int audio_interleave_buffer_size;
+
+/* Maps bytes read by the audio callback to timestamps of the audio written by the audio thread */
+static SDL_SpinLock audio_clock_lock;
+static bool audio_clock_valid;
+static double audio_clock_base_pts;
+static Uint64 audio_clock_base_bytes;
+static Uint64 audio_clock_written;
+static Uint64 audio_clock_read;
+static double audio_device_latency;
 
 #define GRAPH_WIDTH (overlay->w / 2)
 
-enum EFrameStage
-{
-    k_FrameStageStartDecode,
-    k_FrameStageStartUpdate,
-    k_FrameStageStartDisplay,
-    k_FrameStageComplete,
-    k_FrameStageCount,
+static float last_graph_x;
+static int graph_sample_index;
+static CGraphSample graph_samples[2];
+
+/* Graph colors for each frame stage, stacked in this order */
+static const SDL_Color stage_colors[k_FrameStageCount] = {
+    { 0x9E, 0x9E, 0x9E, 0xFF }, /* read_packet (gray) */
+    { 0xCF, 0xCF, 0x56, 0xFF }, /* send_packet (yellow) */
+    { 0xF2, 0xA6, 0x3B, 0xFF }, /* receive_frame (orange) */
+    { 0x00, 0x00, 0x00, 0x00 }, /* decode (not drawn) */
+    { 0x00, 0x00, 0x00, 0x00 }, /* queued (not drawn) */
+    { 0x4C, 0x94, 0xFF, 0xFF }, /* update_video (blue) */
+    { 0x5C, 0xD6, 0x8A, 0xFF }, /* overlay_draw (green) */
+    { 0xC0, 0x6C, 0xF0, 0xFF }, /* overlay_upload (purple) */
+    { 0x56, 0xCF, 0xCF, 0xFF }, /* pacing (cyan) */
+    { 0xEF, 0x4F, 0x42, 0xFF }, /* present (red) */
+    { 0x00, 0x00, 0x00, 0x00 }, /* scanout (not drawn) */
 };
 
-class CGraphSample
+/* Frames waiting for the display to report when they reached the screen */
+#define MAX_PENDING_SCANOUTS    8
+typedef struct
 {
-public:
-    CGraphSample() { Reset(); }
-
-    void Reset() {
-        SDL_zero(m_timings);
-    }
-
-    bool BStarted() const {
-        return (m_timings[k_FrameStageStartDecode] != 0);
-    }
-
-    void MarkStage(EFrameStage eStage) {
-        m_timings[eStage] = SDL_GetTicksNS();
-    }
-
-    float GetFrameTimeMS() const {
-        return SDL_NS_TO_US(m_timings[k_FrameStageStartDecode]) / 1000.0f;
-    }
-
-    Uint64 GetStageTimestamp(EFrameStage eStage) const {
-        return m_timings[eStage];
-    }
+    Uint32 frame_id;
+    double pts;
+    CGraphSample sample;
+} PendingScanout;
+static PendingScanout pending_scanouts[MAX_PENDING_SCANOUTS];
+static int first_pending_scanout;
+static int num_pending_scanouts;
+static float scanout_latency_ms;
 
-    float GetStageDuration(EFrameStage eStage) const {
-        return SDL_NS_TO_US(m_timings[eStage + 1] - m_timings[eStage]) / 1000.0f;
-    }
+static Uint32 frame_time_count;
+static Uint64 frame_times[60];
+static double frame_pts[60];
+static Uint64 last_frame_time_update;
+static Uint64 last_overlay_frames;
+static Uint64 last_overlay_bytes;
+static int overlay_in_flight_max;
 
-    float GetDecodeDuration() const {
-        return GetStageDuration(k_FrameStageStartDecode);
-    }
+/* How the overlay finds out what changed each frame */
+static COverlayDamage::EMode overlay_damage_mode = COverlayDamage::k_EModeReport;
 
-    float GetUpdateDuration() const {
-        return GetStageDuration(k_FrameStageStartUpdate);
-    }
+/* With zero copy the overlay is drawn directly into framebuffers, which each need a renderer */
+#define MAX_OVERLAY_RENDERERS   16
+static bool overlay_zero_copy;
+static SDL_Surface *overlay_surfaces[MAX_OVERLAY_RENDERERS];
+static SDL_Renderer *overlay_renderers[MAX_OVERLAY_RENDERERS];
+static int num_overlay_renderers;
 
-    float GetDisplayDuration() const {
-        return GetStageDuration(k_FrameStageStartDisplay);
-    }
+/* Presentation options for displays that support them, -1 leaves the display's default */
+static bool direct_present;
+static int swap_interval = -1;
 
-private:
-    Uint64 m_timings[k_FrameStageCount];
-};
+/* Threading for software decoding */
+static CDecodeThreading decode_threading;
+static bool benchmark_decode;
 
-static float last_graph_x;
-static int graph_sample_index;
-static CGraphSample graph_samples[2];
-static CGraphSample stats;
+/* V4L2 M2M buffer counts, 0 leaves the decoder's default */
+static int decoder_output_buffers;
+static int decoder_capture_buffers;
 
-static Uint32 frame_time_count;
-static Uint64 frame_times[60];
-static double frame_pts[60];
-static Uint64 last_frame_time_update;
+/* Packets to keep inside the decoder before waiting for frames */
+static int decoder_depth = 1;
+static CDecoderPipeline decoder_pipeline;
 
 #undef av_err2str
 static char av_error[512];
@@ -129,8 +222,11 @@ static void MoveSprites()
     SDL_Rect *position, *velocity;
     int i;
 
-    /* Clear the overlay to transparent */
-    SDL_FillSurfaceRect(overlay, NULL, 0);
+    /* Clear the sprites from their old positions */
+    for (i = 0; i < num_sprites; ++i) {
+        SDL_FillSurfaceRect(overlay, &positions[i], 0);
+        display->AddOverlayDamage(positions[i]);
+    }
 
     for (i = 0; i < num_sprites; ++i) {
         position = &positions[i];
@@ -152,6 +248,7 @@ static void MoveSprites()
         position = &positions[i];
 
         SDL_BlitSurface(sprite, NULL, overlay, position);
+        display->AddOverlayDamage(*position);
     }
 }
 
@@ -182,6 +279,24 @@ static void DrawGraphLegend()
     }
     flCurrentY = flBaseY - nMS;
     DrawDebugText( flCurrentX - 3 * SDL_DEBUG_TEXT_FONT_CHARACTER_SIZE, flCurrentY - ( SDL_DEBUG_TEXT_FONT_CHARACTER_SIZE / 2 ),  "ms" );
+
+    // Draw the stage colors above the timing text
+    const float flLineSkip = SDL_DEBUG_TEXT_FONT_CHARACTER_SIZE + 4.0f;
+    flCurrentX = ( overlay->w - GRAPH_WIDTH ) - 20 * SDL_DEBUG_TEXT_FONT_CHARACTER_SIZE - 3 * SDL_DEBUG_TEXT_FONT_CHARACTER_SIZE - 4.0f;
+    flCurrentY = 4.0f;
+    for ( int iStage = 0; iStage < k_FrameStageCount; ++iStage )
+    {
+        const SDL_Color *pColor = &stage_colors[ iStage ];
+        if ( pColor->a == 0 )
+        {
+            continue;
+        }
+        SDL_FRect swatch = { flCurrentX, flCurrentY, (float)SDL_DEBUG_TEXT_FONT_CHARACTER_SIZE, (float)SDL_DEBUG_TEXT_FONT_CHARACTER_SIZE };
+        SDL_SetRenderDrawColor( renderer, pColor->r, pColor->g, pColor->b, pColor->a );
+        SDL_RenderFillRect( renderer, &swatch );
+        DrawDebugText( flCurrentX + 2 * SDL_DEBUG_TEXT_FONT_CHARACTER_SIZE, flCurrentY, GetFrameStageName( (EFrameStage)iStage ) );
+        flCurrentY += flLineSkip;
+    }
 }
 
 static void DrawGraph()
@@ -240,35 +355,40 @@ static void DrawGraph()
     SDL_SetRenderDrawColor( renderer, 255, 255, 255, 255 );
     SDL_RenderLine( renderer, flCursorX, 142.0f, flCursorX, (float)( overlay->h - 1 ) );
 
-    // Draw the frame decode time (yellow)
-    float flLastMS = pPrevSample->GetDecodeDuration();
-    float flCurrentMS = pCurrSample->GetDecodeDuration();
-    flLastY = SDL_max( flBaseY - flLastMS, 0.0f );
-    flCurrentY = SDL_max( flBaseY - flCurrentMS, 0.0f );
-    SDL_SetRenderDrawColor( renderer, 0xCF, 0xCF, 0x56, 255 );
-    SDL_RenderLine( renderer, flLastX, flLastY, flCurrentX, flCurrentY );
-    if ( flCurrentX >= GRAPH_WIDTH )
-        SDL_RenderLine( renderer, flLastX - GRAPH_WIDTH, flLastY, flCurrentX - GRAPH_WIDTH, flCurrentY );
-
-    // Draw the frame update time (blue)
-    flLastMS += pPrevSample->GetUpdateDuration();
-    flCurrentMS += pCurrSample->GetUpdateDuration();
-    flLastY = SDL_max( flBaseY - flLastMS, 0.0f );
-    flCurrentY = SDL_max( flBaseY - flCurrentMS, 0.0f );
-    SDL_SetRenderDrawColor( renderer, 0x4C, 0x94, 0xFF, 255 );
-    SDL_RenderLine( renderer, flLastX, flLastY, flCurrentX, flCurrentY );
-    if ( flCurrentX >= GRAPH_WIDTH )
-        SDL_RenderLine( renderer, flLastX - GRAPH_WIDTH, flLastY, flCurrentX - GRAPH_WIDTH, flCurrentY );
-
-    // Draw the frame display time (red)
-    flLastMS += pPrevSample->GetDisplayDuration();
-    flCurrentMS += pCurrSample->GetDisplayDuration();
-    flLastY = SDL_max( flBaseY - flLastMS, 0.0f );
-    flCurrentY = SDL_max( flBaseY - flCurrentMS, 0.0f );
-    SDL_SetRenderDrawColor( renderer, 0xEF, 0x4F, 0x42, 255 );
-    SDL_RenderLine( renderer, flLastX, flLastY, flCurrentX, flCurrentY );
-    if ( flCurrentX >= GRAPH_WIDTH )
-        SDL_RenderLine( renderer, flLastX - GRAPH_WIDTH, flLastY, flCurrentX - GRAPH_WIDTH, flCurrentY );
+    // Draw the time spent in each stage, stacked on top of each other.
+    // Time spent waiting in the frame queue isn't work, so it isn't drawn.
+    float flLastMS = 0.0f;
+    float flCurrentMS = 0.0f;
+    for ( int iStage = 0; iStage < k_FrameStageCount; ++iStage )
+    {
+        const SDL_Color *pColor = &stage_colors[ iStage ];
+        if ( pColor->a == 0 )
+        {
+            continue;
+        }
+
+        flLastMS += pPrevSample->GetStageDuration( (EFrameStage)iStage );
+        flCurrentMS += pCurrSample->GetStageDuration( (EFrameStage)iStage );
+        flLastY = SDL_max( flBaseY - flLastMS, 0.0f );
+        flCurrentY = SDL_max( flBaseY - flCurrentMS, 0.0f );
+        SDL_SetRenderDrawColor( renderer, pColor->r, pColor->g, pColor->b, 255 );
+        SDL_RenderLine( renderer, flLastX, flLastY, flCurrentX, flCurrentY );
+        if ( flCurrentX >= GRAPH_WIDTH )
+            SDL_RenderLine( renderer, flLastX - GRAPH_WIDTH, flLastY, flCurrentX - GRAPH_WIDTH, flCurrentY );
+    }
+
+    // Report the columns we touched, including any that wrapped around
+    SDL_Rect damage;
+    damage.x = viewport.x + (int)SDL_floorf( flLastX );
+    damage.y = 0;
+    damage.w = (int)SDL_ceilf( flCurrentX - flLastX ) + 3;
+    damage.h = overlay->h;
+    display->AddOverlayDamage( damage );
+    if ( ( damage.x + damage.w ) > ( viewport.x + GRAPH_WIDTH ) )
+    {
+        damage.x -= GRAPH_WIDTH;
+        display->AddOverlayDamage( damage );
+    }
 
     last_graph_x = flCurrentX;
     while ( last_graph_x >= (float)GRAPH_WIDTH )
@@ -294,13 +414,20 @@ static void DrawTimings()
 
     const float flLineSkip = SDL_DEBUG_TEXT_FONT_CHARACTER_SIZE + 4.0f;
     SDL_FRect rect;
-    rect.w = 20 * SDL_DEBUG_TEXT_FONT_CHARACTER_SIZE;
-    rect.h = 3 * flLineSkip;
+    rect.w = 24 * SDL_DEBUG_TEXT_FONT_CHARACTER_SIZE;
+    rect.h = 13 * flLineSkip;
     rect.x = ( overlay->w - GRAPH_WIDTH ) - rect.w - 3 * SDL_DEBUG_TEXT_FONT_CHARACTER_SIZE - 4.0f;
     rect.y = overlay->h - rect.h - 4.0f;
     SDL_SetRenderDrawColor( renderer, 0, 0, 0, 0 );
     SDL_RenderFillRect( renderer, &rect );
 
+    SDL_Rect damage;
+    damage.x = (int)SDL_floorf( rect.x );
+    damage.y = (int)SDL_floorf( rect.y );
+    damage.w = (int)SDL_ceilf( rect.x + rect.w ) - damage.x;
+    damage.h = (int)SDL_ceilf( rect.y + rect.h ) - damage.y;
+    display->AddOverlayDamage( damage );
+
     char line[128];
     float flCurrentX = rect.x;
     float flCurrentY = rect.y;
@@ -330,10 +457,106 @@ static void DrawTimings()
     SDL_snprintf( line, sizeof(line), "Frame time: %.2fms", flAverageInterval );
     DrawDebugText( flCurrentX, flCurrentY, line );
     flCurrentY += flLineSkip;
+
+    const CGraphSample *pSample = &graph_samples[ graph_sample_index ];
+    SDL_snprintf( line, sizeof(line), "Packets queued: %d", pSample->GetPacketsQueued() );
+    DrawDebugText( flCurrentX, flCurrentY, line );
+    flCurrentY += flLineSkip;
+
+    SDL_snprintf( line, sizeof(line), "Frames queued: %d", pSample->GetFramesQueued() );
+    DrawDebugText( flCurrentX, flCurrentY, line );
+    flCurrentY += flLineSkip;
+
+    // Packets inside the decoder and how long this frame took to come out of it
+    SDL_snprintf( line, sizeof(line), "In decoder: %d %.1fms", pSample->GetPacketsInDecoder(), pSample->GetStageDuration( k_FrameStageDecode ) );
+    DrawDebugText( flCurrentX, flCurrentY, line );
+    flCurrentY += flLineSkip;
+
+    if (pSample->BHasAVDrift()) {
+        SDL_snprintf( line, sizeof(line), "A/V drift: %+.1fms", pSample->GetAVDriftMS() );
+    } else {
+        SDL_snprintf( line, sizeof(line), "A/V drift: n/a" );
+    }
+    DrawDebugText( flCurrentX, flCurrentY, line );
+    flCurrentY += flLineSkip;
+
+    SDL_snprintf( line, sizeof(line), "Late frames: %d", late_frames_dropped );
+    DrawDebugText( flCurrentX, flCurrentY, line );
+    flCurrentY += flLineSkip;
+
+    // Frames dropped because the compositor is behind, rather than the decoder
+    const CVideoDisplay::SPresentationStats &presentation_stats = display->GetPresentationStats();
+    SDL_snprintf( line, sizeof(line), "Backpressure: %d", (int)presentation_stats.unBackpressure );
+    DrawDebugText( flCurrentX, flCurrentY, line );
+    flCurrentY += flLineSkip;
+
+    if (presentation_stats.nInFlightLimit > 0) {
+        SDL_snprintf( line, sizeof(line), "In flight: %d/%d %.1fms", display->GetVideoBuffersInFlight(), presentation_stats.nInFlightLimit, presentation_stats.unReleaseNS / 1000000.0f );
+    } else {
+        SDL_snprintf( line, sizeof(line), "In flight: n/a" );
+    }
+    DrawDebugText( flCurrentX, flCurrentY, line );
+    flCurrentY += flLineSkip;
+
+    // Bytes the overlay copied and hashed per frame since the last update
+    const COverlayDamage::SStats &overlay_stats = display->GetOverlayStats();
+    Uint64 overlay_frames = overlay_stats.unFrames - last_overlay_frames;
+    Uint64 overlay_bytes = ( overlay_stats.unBytesCopied + overlay_stats.unBytesHashed ) - last_overlay_bytes;
+    last_overlay_frames = overlay_stats.unFrames;
+    last_overlay_bytes = overlay_stats.unBytesCopied + overlay_stats.unBytesHashed;
+    SDL_snprintf( line, sizeof(line), "Overlay: %.1fKB/frame", overlay_frames ? ( overlay_bytes / 1024.0f ) / overlay_frames : 0.0f );
+    DrawDebugText( flCurrentX, flCurrentY, line );
+    flCurrentY += flLineSkip;
+
+    SDL_snprintf( line, sizeof(line), "Overlay in flight: %d", display->GetOverlayBuffersInFlight() );
+    DrawDebugText( flCurrentX, flCurrentY, line );
+    flCurrentY += flLineSkip;
+
+    if (scanout_latency_ms > 0.0f) {
+        SDL_snprintf( line, sizeof(line), "Scanout latency: %.1fms", scanout_latency_ms );
+    } else {
+        SDL_snprintf( line, sizeof(line), "Scanout latency: n/a" );
+    }
+    DrawDebugText( flCurrentX, flCurrentY, line );
+    flCurrentY += flLineSkip;
 }
 
-static void UpdateOverlay()
+static bool SetOverlaySurface(SDL_Surface *surface)
 {
+    int i;
+
+    if (surface == overlay && renderer) {
+        return true;
+    }
+
+    for (i = 0; i < num_overlay_renderers; ++i) {
+        if (overlay_surfaces[i] == surface) {
+            break;
+        }
+    }
+    if (i == num_overlay_renderers) {
+        if (num_overlay_renderers == MAX_OVERLAY_RENDERERS) {
+            return SDL_SetError("Too many overlay surfaces");
+        }
+        overlay_renderers[i] = SDL_CreateSoftwareRenderer(surface);
+        if (!overlay_renderers[i]) {
+            return false;
+        }
+        overlay_surfaces[i] = surface;
+        ++num_overlay_renderers;
+    }
+
+    overlay = surface;
+    renderer = overlay_renderers[i];
+    return true;
+}
+
+static void UpdateOverlay(CGraphSample *sample)
+{
+    sample->StartStage(k_FrameStageOverlayDraw);
+    if (!SetOverlaySurface(display->BeginOverlay())) {
+        SDL_Log("Couldn't create overlay renderer: %s\n", SDL_GetError());
+    }
     if (enable_timing) {
         DrawTimings();
         DrawGraph();
@@ -341,8 +564,13 @@ static void UpdateOverlay()
     } else {
         MoveSprites();
     }
+    sample->EndStage(k_FrameStageOverlayDraw);
 
+    sample->StartStage(k_FrameStageOverlayUpload);
+    display->DetectOverlayDamage(overlay);
     display->UpdateOverlay();
+    overlay_in_flight_max = SDL_max(overlay_in_flight_max, display->GetOverlayBuffersInFlight());
+    sample->EndStage(k_FrameStageOverlayUpload);
 }
 
 static void UpdateOverlayRect()
@@ -364,13 +592,22 @@ static void UpdateVideoRect()
     SDL_Rect rect = { 0, 0, 0, 0 };
 
     if (SDL_GetWindowSize(window, &window_width, &window_height) && video_width && video_height) {
-        if (video_width >= video_height) {
+        /* Scale anamorphic video to its display aspect ratio */
+        Sint64 display_width = video_width;
+        Sint64 display_height = video_height;
+        if (video_sample_aspect.num > 0 && video_sample_aspect.den > 0) {
+            display_width *= video_sample_aspect.num;
+            display_height *= video_sample_aspect.den;
+        }
+
+        /* Letterbox video that's wider than the window and pillarbox video that's narrower */
+        if (display_width * window_height >= (Sint64)window_width * display_height) {
             rect.w = window_width;
-            rect.h = (window_width * video_height) / video_width;
+            rect.h = (int)((window_width * display_height) / display_width);
             rect.y = (window_height - rect.h) / 2;
         } else {
             rect.h = window_height;
-            rect.w = (window_height * video_width) / video_height;
+            rect.w = (int)((window_height * display_width) / display_height);
             rect.x = (window_width - rect.w) / 2;
         }
     }
@@ -400,7 +637,23 @@ static AVCodecContext *OpenVideoStream(AVFormatContext *ic, int stream, const AV
     }
     context->pkt_timebase = ic->streams[stream]->time_base;
 
-    if (!display->BInitCodec(context, codec)) {
+    /* Memory to memory decoders queue packets and frames in V4L2 buffers */
+    AVDictionary *options = NULL;
+    if (codec->wrapper_name && SDL_strcmp(codec->wrapper_name, "v4l2m2m") == 0) {
+        if (decoder_output_buffers > 0) {
+            av_dict_set_int(&options, "num_output_buffers", decoder_output_buffers, 0);
+        }
+        if (decoder_capture_buffers > 0) {
+            av_dict_set_int(&options, "num_capture_buffers", decoder_capture_buffers, 0);
+        }
+    }
+
+    bool initialized = display->BInitCodec(context, codec, &options);
+    if (options) {
+        SDL_Log("Decoder %s ignored %d options\n", codec->name, av_dict_count(options));
+    }
+    av_dict_free(&options);
+    if (!initialized) {
         SDL_Log("Couldn't initialize codec: %s\n", SDL_GetError());
         avcodec_free_context(&context);
         return NULL;
@@ -409,89 +662,308 @@ static AVCodecContext *OpenVideoStream(AVFormatContext *ic, int stream, const AV
     return context;
 }
 
-static void HandleVideoFrame(AVFrame *frame, double pts)
+static AVCodecContext *OpenVideoDecoder(AVFormatContext *ic, int stream, const AVCodec *default_codec)
 {
-    int width = frame->width - (frame->crop_left + frame->crop_right);
-    int height = frame->height - (frame->crop_top + frame->crop_bottom);
-    if (width != video_width || height != video_height) {
-        video_width = width;
-        video_height = height;
-        UpdateVideoRect();
+    const AVCodec *decoders[8];
+    int num_decoders = GetVideoDecoders(default_codec->id, default_codec, decoders, SDL_arraysize(decoders));
+    AVCodecContext *context = NULL;
+    int i;
+
+    /* Try each decoder in turn until one opens */
+    for (i = 0; i < num_decoders && !context; ++i) {
+        Uint64 start = SDL_GetTicksNS();
+        context = OpenVideoStream(ic, stream, decoders[i]);
+        SetVideoDecoderOpened(decoders[i], context != NULL);
+        if (context) {
+            video_decoder_open_ms = (double)(SDL_GetTicksNS() - start) / SDL_NS_PER_MS;
+            SDL_Log("Using %s decoder %s, opened in %.1f ms\n",
+                    BVideoDecoderSupportsDRMPrime(decoders[i]) ? "hardware" : "software",
+                    decoders[i]->name, video_decoder_open_ms);
+            if (context->active_thread_type) {
+                SDL_Log("Decoding with %d %s threads\n", context->thread_count,
+                        (context->active_thread_type & FF_THREAD_FRAME) ? "frame" : "slice");
+            }
+        } else {
+            SDL_Log("Couldn't open decoder %s, trying the next one\n", decoders[i]->name);
+        }
     }
 
-    stats.MarkStage(k_FrameStageStartUpdate);
+    if (decoder_cache_file && !SaveVideoDecoderCache(decoder_cache_file)) {
+        SDL_Log("Couldn't write %s: %s\n", decoder_cache_file, SDL_GetError());
+    }
+    return context;
+}
 
-    display->UpdateVideo(frame);
+static double GetStartPTS(double pts)
+{
+    SDL_LockSpinlock(&start_pts_lock);
+    if (!start_pts_valid) {
+        start_pts = pts;
+        start_pts_valid = true;
+    }
+    pts = start_pts;
+    SDL_UnlockSpinlock(&start_pts_lock);
+    return pts;
+}
 
-    UpdateOverlay();
+static bool GetAudioClock(double *clock)
+{
+    if (!audio || !SDL_GetAtomicInt(&audio_started)) {
+        return false;
+    }
 
-    if (!enable_timing) {
-        /* Quick and dirty PTS handling */
-        if (!video_start) {
-            video_start = SDL_GetTicks();
-        }
-        double now = (double)(SDL_GetTicks() - video_start) / 1000.0;
-        if (now < pts) {
-            SDL_DelayPrecise((Uint64)((pts - now) * SDL_NS_PER_SECOND));
+    int queued = SDL_GetAudioStreamQueued(audio);
+    if (SDL_GetAtomicInt(&audio_finished) && audio_ring.GetAvailable() == 0 && queued <= 0) {
+        /* Playback is complete, the audio clock won't advance any more */
+        return false;
+    }
+
+    double bytes_per_second = (double)SDL_AUDIO_FRAMESIZE(audio_spec) * audio_spec.freq;
+    bool valid;
+    double pts;
+    SDL_LockSpinlock(&audio_clock_lock);
+    valid = audio_clock_valid;
+    pts = audio_clock_base_pts + (double)(Sint64)(audio_clock_read - audio_clock_base_bytes) / bytes_per_second;
+    SDL_UnlockSpinlock(&audio_clock_lock);
+    if (!valid) {
+        return false;
+    }
+
+    /* Subtract the audio that has been read from the ring buffer but hasn't been heard yet */
+    *clock = pts - (SDL_max(queued, 0) / bytes_per_second) - audio_device_latency;
+    return true;
+}
+
+/* Returns how long to wait before showing a frame, negative if the frame is late */
+static double GetVideoDelay(double pts, Uint64 now)
+{
+    double audio_clock;
+
+    if (GetAudioClock(&audio_clock)) {
+        master_clock.SetAudioTime(audio_clock, now);
+    } else {
+        master_clock.InvalidateAudio(now);
+    }
+    return pts - master_clock.GetTime(now, pts);
+}
+
+static bool IsLateVideoFrame(double pts, double delay)
+{
+    if (late_frames == LATE_FRAMES_NONE) {
+        return false;
+    }
+
+    double threshold = LATE_FRAME_THRESHOLD;
+    if (last_video_pts >= 0.0 && pts > last_video_pts) {
+        threshold = SDL_max(threshold, SDL_min(pts - last_video_pts, MAX_FRAME_DELAY));
+    }
+    if (delay >= -threshold) {
+        if (delay >= 0.0) {
+            SDL_SetAtomicInt(&video_skip_nonref, 0);
         }
+        return false;
     }
 
-    stats.MarkStage(k_FrameStageStartDisplay);
+    if (late_frames == LATE_FRAMES_SKIP) {
+        /* Let the decoder catch up by skipping frames that nothing else depends on */
+        SDL_SetAtomicInt(&video_skip_nonref, 1);
+    }
 
-    display->DisplayFrame();
+    /* Always show something, even if it's late, when there isn't a newer frame ready */
+    return (video_frames.GetCount() > 1);
+}
 
-    stats.MarkStage(k_FrameStageComplete);
+/* Record the timing for a frame once we know everything we're going to about it */
+static void CompleteFrame(const CGraphSample *sample, double pts)
+{
+    Uint64 now = sample->GetStageEnd(k_FrameStagePresent);
+
+    if (trace.BEnabled()) {
+        for (int stage = 0; stage < k_FrameStageCount; ++stage) {
+            EFrameStage eStage = (EFrameStage)stage;
+            if (sample->BHasStage(eStage)) {
+                trace.AddEvent(GetFrameStageName(eStage), sample->GetStageThread(eStage),
+                               sample->GetStageStart(eStage), sample->GetStageEnd(eStage), pts);
+            }
+        }
+    }
+
+    if (benchmark_file) {
+        static Uint64 last_complete;
+        benchmark.AddFrame();
+        for (int stage = 0; stage < k_FrameStageCount; ++stage) {
+            EFrameStage eStage = (EFrameStage)stage;
+            if (sample->BHasStage(eStage)) {
+                benchmark.GetStats(GetFrameStageName(eStage))->AddSample(sample->GetStageDuration(eStage));
+            }
+        }
+        if (last_complete) {
+            benchmark.GetStats("frame_interval")->AddSample(SDL_NS_TO_US(now - last_complete) / 1000.0f);
+        }
+        last_complete = now;
+    }
 
     if (enable_timing) {
         int index = (frame_time_count % SDL_arraysize(frame_times));
-        frame_times[index] = stats.GetStageTimestamp(k_FrameStageComplete);
+        frame_times[index] = now;
         frame_pts[index] = pts;
         ++frame_time_count;
 
         graph_sample_index = (graph_sample_index + 1) % SDL_arraysize(graph_samples);
-        graph_samples[graph_sample_index] = stats;
-        stats.Reset();
+        graph_samples[graph_sample_index] = *sample;
     }
 }
 
-static AVCodecContext *OpenAudioStream(AVFormatContext *ic, int stream, const AVCodec *codec)
+static void CompletePendingScanout()
 {
-    AVStream *st = ic->streams[stream];
-    AVCodecParameters *codecpar = st->codecpar;
-    AVCodecContext *context;
-    int result;
+    PendingScanout *pending = &pending_scanouts[first_pending_scanout];
+    CompleteFrame(&pending->sample, pending->pts);
+    first_pending_scanout = (first_pending_scanout + 1) % MAX_PENDING_SCANOUTS;
+    --num_pending_scanouts;
+}
 
-    SDL_Log("Audio stream: %s %d channels, %d Hz\n", avcodec_get_name(codec->id), codecpar->ch_layout.nb_channels, codecpar->sample_rate);
+/* Match scanout times from the display to frames that were presented, in order */
+static void HandleScanouts()
+{
+    Uint32 frame_id;
+    Uint64 scanout_time;
+
+    while (display->BGetScanout(&frame_id, &scanout_time)) {
+        while (num_pending_scanouts > 0) {
+            PendingScanout *pending = &pending_scanouts[first_pending_scanout];
+            if ((Sint32)(frame_id - pending->frame_id) < 0) {
+                /* This frame was completed without a scanout time */
+                break;
+            }
+            bool matched = (pending->frame_id == frame_id);
+            if (matched) {
+                CGraphSample *sample = &pending->sample;
+                sample->AddStage(k_FrameStageScanout, sample->GetStageEnd(k_FrameStagePresent), scanout_time, SDL_GetCurrentThreadID());
+                scanout_latency_ms = sample->GetStageDuration(k_FrameStageScanout);
+            }
+            CompletePendingScanout();
+            if (matched) {
+                break;
+            }
+        }
+    }
+}
 
-    context = avcodec_alloc_context3(NULL);
-    if (!context) {
-        SDL_Log("avcodec_alloc_context3 failed\n");
-        return NULL;
+static void AddPendingScanout(Uint32 frame_id, double pts, const CGraphSample *sample)
+{
+    if (num_pending_scanouts == MAX_PENDING_SCANOUTS) {
+        /* The display is behind, give up waiting on the oldest frame */
+        CompletePendingScanout();
     }
 
-    result = avcodec_parameters_to_context(context, ic->streams[stream]->codecpar);
-    if (result < 0) {
-        SDL_Log("avcodec_parameters_to_context failed: %s\n", av_err2str(result));
-        avcodec_free_context(&context);
-        return NULL;
+    PendingScanout *pending = &pending_scanouts[(first_pending_scanout + num_pending_scanouts) % MAX_PENDING_SCANOUTS];
+    pending->frame_id = frame_id;
+    pending->pts = pts;
+    pending->sample = *sample;
+    ++num_pending_scanouts;
+}
+
+static void FlushPendingScanouts()
+{
+    HandleScanouts();
+    while (num_pending_scanouts > 0) {
+        CompletePendingScanout();
     }
-    context->pkt_timebase = ic->streams[stream]->time_base;
+}
 
-    result = avcodec_open2(context, codec, NULL);
-    if (result < 0) {
-        SDL_Log("Couldn't open codec %s: %s", avcodec_get_name(context->codec_id), av_err2str(result));
-        avcodec_free_context(&context);
-        return NULL;
+/* Adjust a frame delay so the frame is submitted half a refresh before the vblank nearest
+ * its target time, rather than just after it, when the display reports vblank timing.
+ */
+static Uint64 GetVBlankDelay(Uint64 now, Uint64 delay)
+{
+    Uint64 vblank, refresh;
+    if (!display->BGetVBlankTiming(&vblank, &refresh)) {
+        return delay;
     }
 
-    SDL_AudioSpec spec = { SDL_AUDIO_F32, codecpar->ch_layout.nb_channels, codecpar->sample_rate };
-    audio = SDL_OpenAudioDeviceStream(SDL_AUDIO_DEVICE_DEFAULT_PLAYBACK, &spec, NULL, NULL);
-    if (audio) {
-        SDL_ResumeAudioStreamDevice(audio);
+    Uint64 target = now + delay;
+    if (target < vblank) {
+        return delay;
+    }
+    Uint64 cycles = (target - vblank + refresh / 2) / refresh;
+    Uint64 submit = vblank + cycles * refresh - refresh / 2;
+    if (submit <= now) {
+        return 0;
+    }
+    return submit - now;
+}
+
+static void HandleVideoFrame(SQueuedFrame *queued)
+{
+    AVFrame *frame = queued->pFrame;
+    double pts = queued->flPTS;
+    CGraphSample *sample = &queued->sample;
+
+    sample->EndStage(k_FrameStageQueued);
+
+    if (enable_pacing && IsLateVideoFrame(pts, GetVideoDelay(pts, SDL_GetTicksNS()))) {
+        ++late_frames_dropped;
+        if (trace.BEnabled()) {
+            trace.AddInstantEvent("late frame dropped", SDL_GetCurrentThreadID(), SDL_GetTicksNS(), pts);
+        }
+        if (verbose) {
+            SDL_Log("Dropping late video frame at %.3f", pts);
+        }
+        return;
+    }
+
+    int width = frame->width - (frame->crop_left + frame->crop_right);
+    int height = frame->height - (frame->crop_top + frame->crop_bottom);
+    if (width != video_width || height != video_height ||
+        av_cmp_q(frame->sample_aspect_ratio, video_sample_aspect) != 0) {
+        video_width = width;
+        video_height = height;
+        video_sample_aspect = frame->sample_aspect_ratio;
+        UpdateVideoRect();
+    }
+
+    sample->SetQueueDepth(video_packets.GetCount(), video_frames.GetCount());
+
+    sample->StartStage(k_FrameStageUpdateVideo);
+    display->UpdateVideo(frame);
+    sample->EndStage(k_FrameStageUpdateVideo);
+
+    UpdateOverlay(sample);
+
+    if (enable_pacing) {
+        /* Wait until the master clock reaches this frame */
+        Uint64 now = SDL_GetTicksNS();
+        double delay = GetVideoDelay(pts, now);
+        if (delay > 0.0) {
+            Uint64 delay_ns = GetVBlankDelay(now, (Uint64)(SDL_min(delay, MAX_FRAME_DELAY) * SDL_NS_PER_SECOND));
+            if (delay_ns > 0) {
+                sample->StartStage(k_FrameStagePacing);
+                SDL_DelayPrecise(delay_ns);
+                sample->EndStage(k_FrameStagePacing);
+            }
+        }
+    }
+
+    sample->StartStage(k_FrameStagePresent);
+    display->DisplayFrame();
+    sample->EndStage(k_FrameStagePresent);
+
+    Uint64 now = sample->GetStageEnd(k_FrameStagePresent);
+    double drift;
+    master_clock.SetVideoTime(pts, now);
+    if (master_clock.BGetAudioDrift(pts, now, &drift)) {
+        sample->SetAVDrift((float)(drift * 1000.0));
+        av_drift_total += drift;
+        ++av_drift_count;
+    }
+    last_video_pts = pts;
+
+    Uint32 frame_id = display->GetDisplayFrameID();
+    if (frame_id) {
+        AddPendingScanout(frame_id, pts, sample);
     } else {
-        SDL_Log("Couldn't open audio: %s", SDL_GetError());
+        CompleteFrame(sample, pts);
     }
-    return context;
 }
 
 static SDL_AudioFormat GetAudioFormat(int format)
@@ -530,44 +1002,380 @@ static bool IsPlanarAudioFormat(int format)
     }
 }
 
+static void SDLCALL AudioCallback(void *userdata, SDL_AudioStream *stream, int additional_amount, int total_amount)
+{
+    int framesize = SDL_AUDIO_FRAMESIZE(audio_spec);
+
+    /* Pull as much as SDL needs from the ring buffer, without ever blocking the audio device */
+    while (additional_amount > 0) {
+        int amount = SDL_min(additional_amount, audio_callback_buffer_size);
+        amount -= (amount % framesize);
+        if (amount <= 0) {
+            break;
+        }
+
+        int length = audio_ring.Read(audio_callback_buffer, amount);
+        if (length > 0) {
+            SDL_PutAudioStreamData(stream, audio_callback_buffer, length);
+
+            SDL_LockSpinlock(&audio_clock_lock);
+            audio_clock_read += length;
+            SDL_UnlockSpinlock(&audio_clock_lock);
+        }
+        if (length < amount) {
+            if (SDL_GetAtomicInt(&audio_started) && !SDL_GetAtomicInt(&audio_finished)) {
+                SDL_AddAtomicInt(&audio_underruns, 1);
+            }
+            break;
+        }
+        additional_amount -= length;
+    }
+}
+
+static AVCodecContext *OpenAudioStream(AVFormatContext *ic, int stream, const AVCodec *codec)
+{
+    AVStream *st = ic->streams[stream];
+    AVCodecParameters *codecpar = st->codecpar;
+    AVCodecContext *context;
+    int result;
+
+    SDL_Log("Audio stream: %s %d channels, %d Hz\n", avcodec_get_name(codec->id), codecpar->ch_layout.nb_channels, codecpar->sample_rate);
+
+    context = avcodec_alloc_context3(NULL);
+    if (!context) {
+        SDL_Log("avcodec_alloc_context3 failed\n");
+        return NULL;
+    }
+
+    result = avcodec_parameters_to_context(context, ic->streams[stream]->codecpar);
+    if (result < 0) {
+        SDL_Log("avcodec_parameters_to_context failed: %s\n", av_err2str(result));
+        avcodec_free_context(&context);
+        return NULL;
+    }
+    context->pkt_timebase = ic->streams[stream]->time_base;
+
+    result = avcodec_open2(context, codec, NULL);
+    if (result < 0) {
+        SDL_Log("Couldn't open codec %s: %s", avcodec_get_name(context->codec_id), av_err2str(result));
+        avcodec_free_context(&context);
+        return NULL;
+    }
+
+    audio_spec.format = GetAudioFormat(context->sample_fmt);
+    audio_spec.channels = context->ch_layout.nb_channels;
+    audio_spec.freq = context->sample_rate;
+    if (audio_spec.format == SDL_AUDIO_UNKNOWN) {
+        SDL_Log("Unsupported audio sample format %d", context->sample_fmt);
+        return context;
+    }
+
+    /* The ring buffer holds the target latency, and the device buffer adds a quarter of that again */
+    int latency_frames = (audio_spec.freq * audio_latency_ms) / 1000;
+    char hint[32];
+    SDL_snprintf(hint, sizeof(hint), "%d", SDL_max(latency_frames / 4, 32));
+    SDL_SetHint(SDL_HINT_AUDIO_DEVICE_SAMPLE_FRAMES, hint);
+
+    audio_callback_buffer_size = latency_frames * SDL_AUDIO_FRAMESIZE(audio_spec);
+    audio_callback_buffer = (Uint8 *)SDL_malloc(audio_callback_buffer_size);
+    if (!audio_callback_buffer || !audio_ring.BInit(audio_callback_buffer_size, SDL_AUDIO_FRAMESIZE(audio_spec))) {
+        SDL_Log("Couldn't allocate audio buffers");
+        return context;
+    }
+
+    audio = SDL_OpenAudioDeviceStream(SDL_AUDIO_DEVICE_DEFAULT_PLAYBACK, &audio_spec, AudioCallback, NULL);
+    if (audio) {
+        /* The device buffer is the last thing between the audio stream and the speaker */
+        SDL_AudioSpec device_spec;
+        int device_frames = 0;
+        if (SDL_GetAudioDeviceFormat(SDL_GetAudioStreamDevice(audio), &device_spec, &device_frames) && device_spec.freq > 0) {
+            audio_device_latency = (double)device_frames / device_spec.freq;
+        }
+        SDL_ResumeAudioStreamDevice(audio);
+    } else {
+        SDL_Log("Couldn't open audio: %s", SDL_GetError());
+    }
+    return context;
+}
+
+static void WriteAudio(const Uint8 *data, int length)
+{
+    while (length > 0 && !SDL_GetAtomicInt(&quitting)) {
+        int written = audio_ring.Write(data, length);
+        if (written > 0) {
+            audio_clock_written += written;
+            SDL_SetAtomicInt(&audio_started, 1);
+            data += written;
+            length -= written;
+        }
+        if (length > 0) {
+            /* Wait for the audio callback to make room */
+            SDL_Delay(SDL_max(audio_latency_ms / 4, 1));
+        }
+    }
+}
+
 static void InterleaveAudio(AVFrame *frame, const SDL_AudioSpec *spec)
 {
-    int c, n;
     int samplesize = SDL_AUDIO_BYTESIZE(spec->format);
     int framesize = SDL_AUDIO_FRAMESIZE(*spec);
-    Uint8 *data = (Uint8 *)SDL_malloc(frame->nb_samples * framesize);
-    if (!data) {
-        return;
-    }
+    int length = frame->nb_samples * framesize;
 
-    /* This could be optimized with SIMD and not allocating memory each time */
-    for (c = 0; c < spec->channels; ++c) {
-        const Uint8 *src = frame->data[c];
-        Uint8 *dst = data + c * samplesize;
-        for (n = frame->nb_samples; n--;) {
-            SDL_memcpy(dst, src, samplesize);
-            src += samplesize;
-            dst += framesize;
+    /* Reuse the interleave buffer, growing it as needed */
+    if (length > audio_interleave_buffer_size) {
+        Uint8 *data = (Uint8 *)SDL_realloc(audio_interleave_buffer, length);
+        if (!data) {
+            return;
         }
+        audio_interleave_buffer = data;
+        audio_interleave_buffer_size = length;
     }
-    SDL_PutAudioStreamData(audio, data, frame->nb_samples * framesize);
-    SDL_free(data);
+
+    InterleaveAudioSamples(frame->extended_data, spec->channels, samplesize, frame->nb_samples, audio_interleave_buffer);
+    WriteAudio(audio_interleave_buffer, length);
 }
 
-static void HandleAudioFrame(AVFrame *frame)
+static void HandleAudioFrame(AVFrame *frame, AVRational time_base)
 {
     if (audio) {
         SDL_AudioSpec spec = { GetAudioFormat(frame->format), frame->ch_layout.nb_channels, frame->sample_rate };
-        SDL_SetAudioStreamFormat(audio, &spec, NULL);
+        if (spec.format != audio_spec.format || spec.channels != audio_spec.channels || spec.freq != audio_spec.freq) {
+            /* The ring buffer holds data in the format the audio stream was opened with */
+            if (verbose) {
+                SDL_Log("Dropping audio frame with mismatched format");
+            }
+            return;
+        }
+
+        if (frame->pts != AV_NOPTS_VALUE) {
+            /* This frame starts at the current write position in the ring buffer */
+            double pts = ((double)frame->pts * time_base.num) / time_base.den;
+            pts -= GetStartPTS(pts);
+
+            SDL_LockSpinlock(&audio_clock_lock);
+            audio_clock_valid = true;
+            audio_clock_base_pts = pts;
+            audio_clock_base_bytes = audio_clock_written;
+            SDL_UnlockSpinlock(&audio_clock_lock);
+        }
 
         if (frame->ch_layout.nb_channels > 1 && IsPlanarAudioFormat(frame->format)) {
             InterleaveAudio(frame, &spec);
         } else {
-            SDL_PutAudioStreamData(audio, frame->data[0], frame->nb_samples * SDL_AUDIO_FRAMESIZE(spec));
+            WriteAudio(frame->data[0], frame->nb_samples * SDL_AUDIO_FRAMESIZE(spec));
         }
     }
 }
 
+static bool InitPacketQueue(CPacketQueue *queue, AVFormatContext *ic, int stream)
+{
+    AVRational time_base = { 1, AV_TIME_BASE };
+    if (stream >= 0) {
+        time_base = ic->streams[stream]->time_base;
+    }
+    return queue->BInit(packet_queue_count, (size_t)packet_queue_kb * 1024, SDL_MS_TO_NS(packet_queue_ms), time_base);
+}
+
+typedef struct
+{
+    AVFormatContext *ic;
+    int audio_stream;
+    int video_stream;
+} DemuxThreadData;
+
+static int SDLCALL DemuxThread(void *data)
+{
+    DemuxThreadData *demux = (DemuxThreadData *)data;
+    AVPacket *pkt = av_packet_alloc();
+    SPacketTiming timing;
+    if (!pkt) {
+        SDL_Log("av_packet_alloc failed");
+    }
+
+    timing.unThreadID = SDL_GetCurrentThreadID();
+    while (pkt) {
+        timing.unReadStartNS = SDL_GetTicksNS();
+        int result = av_read_frame(demux->ic, pkt);
+        timing.unReadEndNS = SDL_GetTicksNS();
+        if (result < 0) {
+            if (result != AVERROR_EOF) {
+                char error[AV_ERROR_MAX_STRING_SIZE];
+                SDL_Log("av_read_frame failed: %s", av_make_error_string(error, sizeof(error), result));
+            }
+            break;
+        }
+
+        if (packet_arena_kb > 0 &&
+            (pkt->stream_index == demux->audio_stream || pkt->stream_index == demux->video_stream)) {
+            packet_arena.BMovePayload(pkt);
+        }
+
+        if (pkt->stream_index == demux->audio_stream) {
+            if (!audio_packets.BPut(pkt)) {
+                break;
+            }
+        } else if (pkt->stream_index == demux->video_stream) {
+            if (!video_packets.BPut(pkt, &timing)) {
+                break;
+            }
+        } else {
+            av_packet_unref(pkt);
+        }
+    }
+    av_packet_free(&pkt);
+
+    audio_packets.SetEndOfStream();
+    video_packets.SetEndOfStream();
+    return 0;
+}
+
+static bool ReceiveVideoFrames(AVCodecContext *context, AVFrame *frame, CGraphSample *sample)
+{
+    for (;;) {
+        sample->StartStage(k_FrameStageReceiveFrame);
+        int result = avcodec_receive_frame(context, frame);
+        sample->EndStage(k_FrameStageReceiveFrame);
+        if (result < 0) {
+            break;
+        }
+
+        /* The time from sending this frame's packet until it came out of the decoder */
+        Uint64 now = SDL_GetTicksNS();
+        Uint64 sent = decoder_pipeline.OnFrameReceived((frame->pts != AV_NOPTS_VALUE) ? frame->pts : frame->pkt_dts, now);
+        sample->AddStage(k_FrameStageDecode, sent, now, SDL_GetCurrentThreadID());
+        sample->SetPacketsInDecoder(decoder_pipeline.GetPacketsInFlight());
+
+        double pts = ((double)frame->pts * context->pkt_timebase.num) / context->pkt_timebase.den;
+        pts -= GetStartPTS(pts);
+
+        sample->StartStage(k_FrameStageQueued);
+        if (!video_frames.BPut(frame, pts, *sample)) {
+            return false;
+        }
+        sample->Reset();
+    }
+    return true;
+}
+
+static int SDLCALL VideoDecodeThread(void *data)
+{
+    AVCodecContext *context = (AVCodecContext *)data;
+    AVPacket *pkt = av_packet_alloc();
+    AVFrame *frame = av_frame_alloc();
+    CGraphSample sample;
+    SPacketTiming timing;
+    char error[AV_ERROR_MAX_STRING_SIZE];
+    bool running = true;
+
+    if (!pkt || !frame) {
+        SDL_Log("Couldn't allocate video decode buffers");
+        running = false;
+    }
+
+    while (running && !SDL_GetAtomicInt(&quitting)) {
+        if (!video_packets.BGet(pkt, 100, &timing)) {
+            if (video_packets.BFinished()) {
+                /* Drain the frames the decoder is still holding */
+                avcodec_send_packet(context, NULL);
+                ReceiveVideoFrames(context, frame, &sample);
+                running = false;
+            }
+            continue;
+        }
+
+        sample.AddStage(k_FrameStageReadPacket, timing.unReadStartNS, timing.unReadEndNS, timing.unThreadID);
+
+        /* Skip decoding non-reference frames while presentation is running late */
+        enum AVDiscard skip_frame = SDL_GetAtomicInt(&video_skip_nonref) ? AVDISCARD_NONREF : AVDISCARD_DEFAULT;
+        if (context->skip_frame != skip_frame) {
+            if (verbose) {
+                SDL_Log("%s skipping non-reference frames", (skip_frame == AVDISCARD_NONREF) ? "Started" : "Stopped");
+            }
+            context->skip_frame = skip_frame;
+        }
+
+        int result;
+        for (;;) {
+            sample.StartStage(k_FrameStageSendPacket);
+            result = avcodec_send_packet(context, pkt);
+            sample.EndStage(k_FrameStageSendPacket);
+            if (result == 0) {
+                decoder_pipeline.OnPacketSent((pkt->pts != AV_NOPTS_VALUE) ? pkt->pts : pkt->dts, SDL_GetTicksNS());
+            }
+            if (result != AVERROR(EAGAIN)) {
+                break;
+            }
+
+            /* The decoder is full, make room before sending this packet */
+            if (!ReceiveVideoFrames(context, frame, &sample)) {
+                running = false;
+                break;
+            }
+        }
+        if (result < 0 && result != AVERROR(EAGAIN)) {
+            SDL_Log("avcodec_send_packet(video_context) failed: %s", av_make_error_string(error, sizeof(error), result));
+        }
+        av_packet_unref(pkt);
+
+        /* Keep sending packets while more are waiting, until the decoder holds decoder_depth */
+        if (decoder_pipeline.GetPacketsInFlight() < decoder_depth && video_packets.GetCount() > 0) {
+            continue;
+        }
+        if (running && !ReceiveVideoFrames(context, frame, &sample)) {
+            running = false;
+        }
+    }
+    av_frame_free(&frame);
+    av_packet_free(&pkt);
+
+    video_frames.SetEndOfStream();
+    return 0;
+}
+
+static void DecodeAudioPacket(AVCodecContext *context, AVPacket *pkt, AVFrame *frame)
+{
+    int result = avcodec_send_packet(context, pkt);
+    if (result < 0 && result != AVERROR_EOF) {
+        char error[AV_ERROR_MAX_STRING_SIZE];
+        SDL_Log("avcodec_send_packet(audio_context) failed: %s", av_make_error_string(error, sizeof(error), result));
+    }
+    while (avcodec_receive_frame(context, frame) >= 0) {
+        HandleAudioFrame(frame, context->pkt_timebase);
+    }
+}
+
+static int SDLCALL AudioDecodeThread(void *data)
+{
+    AVCodecContext *context = (AVCodecContext *)data;
+    AVPacket *pkt = av_packet_alloc();
+    AVFrame *frame = av_frame_alloc();
+    bool running = true;
+
+    if (!pkt || !frame) {
+        SDL_Log("Couldn't allocate audio decode buffers");
+        running = false;
+    }
+
+    while (running && !SDL_GetAtomicInt(&quitting)) {
+        if (!audio_packets.BGet(pkt, 100)) {
+            if (audio_packets.BFinished()) {
+                /* Drain the samples the decoder is still holding */
+                DecodeAudioPacket(context, NULL, frame);
+                running = false;
+            }
+            continue;
+        }
+
+        DecodeAudioPacket(context, pkt, frame);
+        av_packet_unref(pkt);
+    }
+    av_frame_free(&frame);
+    av_packet_free(&pkt);
+
+    SDL_SetAtomicInt(&audio_finished, 1);
+    return 0;
+}
+
 static void av_log_callback(void *avcl, int level, const char *fmt, va_list vl)
 {
     const char *pszCategory = NULL;
@@ -607,9 +1415,32 @@ static void av_log_callback(void *avcl, int level, const char *fmt, va_list vl)
     SDL_free(message);
 }
 
+/* Stop the demux and decode threads, after this nothing else touches the queues, the decoders or their stats */
+static void StopThreads(SDL_Thread **demux_thread, SDL_Thread **video_thread, SDL_Thread **audio_thread)
+{
+    SDL_SetAtomicInt(&quitting, 1);
+    audio_packets.Abort();
+    video_packets.Abort();
+    video_frames.Abort();
+    if (*video_thread) {
+        SDL_WaitThread(*video_thread, NULL);
+        *video_thread = NULL;
+    }
+    /* The queued frames hold buffers from the decoder and the display, so release them before either is freed */
+    video_frames.Flush();
+    if (*audio_thread) {
+        SDL_WaitThread(*audio_thread, NULL);
+        *audio_thread = NULL;
+    }
+    if (*demux_thread) {
+        SDL_WaitThread(*demux_thread, NULL);
+        *demux_thread = NULL;
+    }
+}
+
 static void print_usage(const char *argv0)
 {
-    SDL_Log("Usage: %s [--verbose] [--enable-timing] [--video wayland|x11|kmsdrm] [--fullscreen] video_file\n", argv0);
+    SDL_Log("Usage: %s [--verbose] [--enable-timing] [--benchmark results.json] [--trace trace.json] [--video wayland|x11|kmsdrm|dummy|offscreen] [--fullscreen] [--packet-queue-kb N (0 = unlimited)] [--packet-queue-ms N (0 = unlimited)] [--frame-queue-size N] [--audio-latency-ms N] [--sync audio|video|external] [--late-frames none|drop|skip] [--overlay-damage report|hash|full] [--overlay-zero-copy] [--egl-direct] [--swap-interval N] [--benchmark-interleave] [--selftest-audio-ring] [--benchmark-present] [--benchmark-compositor] [--decoder-cache file|none] [--decode-threading auto|slice|frame] [--decode-threads N] [--decode-cpus list] [--benchmark-decode] [--decoder-output-buffers N] [--decoder-capture-buffers N] [--decoder-depth N] [--packet-arena-kb N] [--frame-pool-size N] video_file\n", argv0);
 }
 
 
@@ -623,9 +1454,12 @@ int main(int argc, char *argv[])
     const AVCodec *video_codec = NULL;
     AVCodecContext *audio_context = NULL;
     AVCodecContext *video_context = NULL;
-    AVPacket *pkt = NULL;
-    AVFrame *frame = NULL;
-    double first_pts = -1.0;
+    DemuxThreadData demux;
+    SDL_Thread *demux_thread = NULL;
+    SDL_Thread *video_thread = NULL;
+    SDL_Thread *audio_thread = NULL;
+    int audio_underrun_count = 0;
+    SQueuedFrame *queued;
     int i;
     int result;
     int return_code = -1;
@@ -633,7 +1467,6 @@ int main(int argc, char *argv[])
     int window_width = 1280;
     int window_height = 720;
     bool flushing = false;
-    bool decoded = false;
     bool done = false;
 
     /* Log ffmpeg messages */
@@ -651,7 +1484,15 @@ int main(int argc, char *argv[])
             consumed = 1;
         } else if (SDL_strcmp(argv[i], "--enable-timing") == 0) {
             enable_timing = true;
+            enable_pacing = false;
             consumed = 1;
+        } else if (SDL_strcmp(argv[i], "--benchmark") == 0 && argv[i + 1]) {
+            benchmark_file = argv[i + 1];
+            enable_pacing = false;
+            consumed = 2;
+        } else if (SDL_strcmp(argv[i], "--trace") == 0 && argv[i + 1]) {
+            trace_file = argv[i + 1];
+            consumed = 2;
         } else if (SDL_strcmp(argv[i], "--video") == 0 && argv[i + 1]) {
             SDL_SetHint(SDL_HINT_VIDEO_DRIVER, argv[i + 1]);
             consumed = 2;
@@ -662,6 +1503,94 @@ int main(int argc, char *argv[])
         } else if (SDL_strcmp(argv[i], "--fullscreen") == 0) {
             window_flags |= SDL_WINDOW_FULLSCREEN;
             consumed = 1;
+        } else if (SDL_strcmp(argv[i], "--packet-queue-kb") == 0 && argv[i + 1]) {
+            packet_queue_kb = SDL_max(SDL_atoi(argv[i + 1]), 0);
+            consumed = 2;
+        } else if (SDL_strcmp(argv[i], "--packet-queue-ms") == 0 && argv[i + 1]) {
+            packet_queue_ms = SDL_max(SDL_atoi(argv[i + 1]), 0);
+            consumed = 2;
+        } else if (SDL_strcmp(argv[i], "--benchmark-interleave") == 0) {
+            return_code = BenchmarkInterleaveAudio() ? 0 : 1;
+            goto quit;
+        } else if (SDL_strcmp(argv[i], "--selftest-audio-ring") == 0) {
+            return_code = CAudioRingBuffer::BSelfTest() ? 0 : 1;
+            goto quit;
+        } else if (SDL_strcmp(argv[i], "--audio-latency-ms") == 0 && argv[i + 1]) {
+            audio_latency_ms = SDL_max(SDL_atoi(argv[i + 1]), 1);
+            consumed = 2;
+        } else if (SDL_strcmp(argv[i], "--frame-queue-size") == 0 && argv[i + 1]) {
+            frame_queue_size = SDL_max(SDL_atoi(argv[i + 1]), 1);
+            consumed = 2;
+        } else if (SDL_strcmp(argv[i], "--sync") == 0 && argv[i + 1]) {
+            CMasterClock::ESource source;
+            if (CMasterClock::BParseSource(argv[i + 1], &source)) {
+                master_clock.SetSource(source);
+                consumed = 2;
+            }
+        } else if (SDL_strcmp(argv[i], "--late-frames") == 0 && argv[i + 1]) {
+            if (SDL_strcmp(argv[i + 1], "none") == 0) {
+                late_frames = LATE_FRAMES_NONE;
+                consumed = 2;
+            } else if (SDL_strcmp(argv[i + 1], "drop") == 0) {
+                late_frames = LATE_FRAMES_DROP;
+                consumed = 2;
+            } else if (SDL_strcmp(argv[i + 1], "skip") == 0) {
+                late_frames = LATE_FRAMES_SKIP;
+                consumed = 2;
+            }
+        } else if (SDL_strcmp(argv[i], "--overlay-damage") == 0 && argv[i + 1]) {
+            if (COverlayDamage::BParseMode(argv[i + 1], &overlay_damage_mode)) {
+                consumed = 2;
+            }
+        } else if (SDL_strcmp(argv[i], "--decoder-cache") == 0 && argv[i + 1]) {
+            decoder_cache_file = argv[i + 1];
+            consumed = 2;
+        } else if (SDL_strcmp(argv[i], "--decode-threading") == 0 && argv[i + 1]) {
+            CDecodeThreading::EPolicy policy;
+            if (CDecodeThreading::BParsePolicy(argv[i + 1], &policy)) {
+                decode_threading.SetPolicy(policy);
+                consumed = 2;
+            }
+        } else if (SDL_strcmp(argv[i], "--decode-threads") == 0 && argv[i + 1]) {
+            decode_threading.SetThreadCount(SDL_max(SDL_atoi(argv[i + 1]), 0));
+            consumed = 2;
+        } else if (SDL_strcmp(argv[i], "--decode-cpus") == 0 && argv[i + 1]) {
+            if (decode_threading.BSetCPUs(argv[i + 1])) {
+                consumed = 2;
+            }
+        } else if (SDL_strcmp(argv[i], "--decoder-output-buffers") == 0 && argv[i + 1]) {
+            decoder_output_buffers = SDL_max(SDL_atoi(argv[i + 1]), 0);
+            consumed = 2;
+        } else if (SDL_strcmp(argv[i], "--decoder-capture-buffers") == 0 && argv[i + 1]) {
+            decoder_capture_buffers = SDL_max(SDL_atoi(argv[i + 1]), 0);
+            consumed = 2;
+        } else if (SDL_strcmp(argv[i], "--decoder-depth") == 0 && argv[i + 1]) {
+            decoder_depth = SDL_max(SDL_atoi(argv[i + 1]), 1);
+            consumed = 2;
+        } else if (SDL_strcmp(argv[i], "--packet-arena-kb") == 0 && argv[i + 1]) {
+            packet_arena_kb = SDL_max(SDL_atoi(argv[i + 1]), 0);
+            consumed = 2;
+        } else if (SDL_strcmp(argv[i], "--frame-pool-size") == 0 && argv[i + 1]) {
+            frame_pool_size = SDL_max(SDL_atoi(argv[i + 1]), 0);
+            consumed = 2;
+        } else if (SDL_strcmp(argv[i], "--benchmark-decode") == 0) {
+            benchmark_decode = true;
+            consumed = 1;
+        } else if (SDL_strcmp(argv[i], "--overlay-zero-copy") == 0) {
+            overlay_zero_copy = true;
+            consumed = 1;
+        } else if (SDL_strcmp(argv[i], "--egl-direct") == 0) {
+            direct_present = true;
+            consumed = 1;
+        } else if (SDL_strcmp(argv[i], "--swap-interval") == 0 && argv[i + 1]) {
+            swap_interval = SDL_max(SDL_atoi(argv[i + 1]), 0);
+            consumed = 2;
+        } else if (SDL_strcmp(argv[i], "--benchmark-present") == 0) {
+            return_code = CVideoDisplayEGL::BBenchmarkPresent() ? 0 : 1;
+            goto quit;
+        } else if (SDL_strcmp(argv[i], "--benchmark-compositor") == 0) {
+            return_code = CVideoCompositor::BBenchmark() ? 0 : 1;
+            goto quit;
         } else if (!file) {
             /* We'll try to open this as a media file */
             file = argv[i];
@@ -682,12 +1611,31 @@ int main(int argc, char *argv[])
         goto quit;
     }
 
-    if (!SDL_Init(SDL_INIT_AUDIO | SDL_INIT_VIDEO)) {
+    if (benchmark_decode) {
+        return_code = CDecodeThreading::BBenchmark(file) ? 0 : 1;
+        goto quit;
+    }
+
+    if (trace_file) {
+        if (!trace.BInit(TRACE_MAX_EVENTS)) {
+            SDL_Log("Couldn't allocate trace buffer\n");
+            return_code = 1;
+            goto quit;
+        }
+        trace.SetThreadName(SDL_GetCurrentThreadID(), "main");
+    }
+
+    if (!SDL_Init(SDL_INIT_VIDEO)) {
         SDL_Log("Couldn't initialize SDL: %s\n", SDL_GetError());
         return_code = 2;
         goto quit;
     }
 
+    /* Headless systems may not have any audio devices, so play without audio if that fails */
+    if (!SDL_InitSubSystem(SDL_INIT_AUDIO)) {
+        SDL_Log("Couldn't initialize SDL audio: %s\n", SDL_GetError());
+    }
+
     window = SDL_CreateWindow(file, window_width, window_height, window_flags);
     if (!window) {
         SDL_Log("Couldn't create window: %s\n", SDL_GetError());
@@ -708,15 +1656,38 @@ int main(int argc, char *argv[])
         return_code = 3;
         goto quit;
     }
+    display->SetOverlayDamageMode(overlay_damage_mode);
+    display->SetDecodeThreading(decode_threading);
+    if (frame_pool_size > 0) {
+        if (!frame_pool.BInit(frame_pool_size)) {
+            SDL_Log("Couldn't create frame pool: %s\n", SDL_GetError());
+            return_code = 3;
+            goto quit;
+        }
+        display->SetFramePool(&frame_pool);
+    }
+    if (overlay_zero_copy && !display->BSetOverlayZeroCopy(true)) {
+        SDL_Log("Zero copy overlay isn't supported by this display, copying instead\n");
+        overlay_zero_copy = false;
+    }
+    if (direct_present && !display->BSetDirectPresent(true)) {
+        SDL_Log("Direct presentation isn't supported by this display, using SDL_Renderer\n");
+        direct_present = false;
+    }
+    if (swap_interval >= 0 && !display->BSetSwapInterval(swap_interval)) {
+        SDL_Log("Couldn't set swap interval %d: %s\n", swap_interval, SDL_GetError());
+    }
     UpdateOverlayRect();
 
-    renderer = SDL_CreateSoftwareRenderer(overlay);
-    if (!renderer) {
+    if (!SetOverlaySurface(overlay)) {
         SDL_Log("Couldn't create overlay renderer: %s\n", SDL_GetError());
         return_code = 3;
         goto quit;
     }
-    DrawGraphLegend();
+    if (enable_timing) {
+        /* Sprites only clear their own rects, so the legend is only drawn with the timing graph */
+        DrawGraphLegend();
+    }
 
     /* Open the media file */
     result = avformat_open_input(&ic, file, NULL, NULL);
@@ -725,23 +1696,40 @@ int main(int argc, char *argv[])
         return_code = 4;
         goto quit;
     }
+    if (ic->start_time != AV_NOPTS_VALUE) {
+        start_pts = (double)ic->start_time / AV_TIME_BASE;
+        start_pts_valid = true;
+    }
     video_stream = av_find_best_stream(ic, AVMEDIA_TYPE_VIDEO, -1, -1, &video_codec, 0);
     if (video_stream >= 0) {
-        if (video_codec->id == AV_CODEC_ID_H264) {
-            const AVCodec *v4l2_codec = avcodec_find_decoder_by_name("h264_v4l2m2m");
-            if (v4l2_codec) {
-                video_context = OpenVideoStream(ic, video_stream, v4l2_codec);
+        if (!decoder_cache_file) {
+            char *pref_path = SDL_GetPrefPath("libsdl", "testffmpeg_rpi");
+            if (pref_path) {
+                SDL_asprintf(&decoder_cache_path, "%sdecoders.txt", pref_path);
+                decoder_cache_file = decoder_cache_path;
+                SDL_free(pref_path);
             }
+        } else if (SDL_strcmp(decoder_cache_file, "none") == 0) {
+            decoder_cache_file = NULL;
         }
+        if (decoder_cache_file && LoadVideoDecoderCache(decoder_cache_file) && verbose) {
+            SDL_Log("Loaded decoder probe results from %s\n", decoder_cache_file);
+        }
+
+        video_context = OpenVideoDecoder(ic, video_stream, video_codec);
         if (!video_context) {
-            video_context = OpenVideoStream(ic, video_stream, video_codec);
-            if (!video_context) {
-                return_code = 4;
-                goto quit;
-            }
+            SDL_Log("Couldn't open a decoder for %s\n", avcodec_get_name(video_codec->id));
+            return_code = 4;
+            goto quit;
+        }
+
+        AVRational frame_rate = av_guess_frame_rate(ic, ic->streams[video_stream], NULL);
+        if (frame_rate.num > 0 && frame_rate.den > 0) {
+            display->SetVideoFrameInterval((Uint64)(SDL_NS_PER_SECOND / av_q2d(frame_rate)));
         }
     }
-    if (!enable_timing) {
+    if (enable_pacing) {
+        /* Audio is only played when video is presented in real time */
         audio_stream = av_find_best_stream(ic, AVMEDIA_TYPE_AUDIO, -1, video_stream, &audio_codec, 0);
         if (audio_stream >= 0) {
             audio_context = OpenAudioStream(ic, audio_stream, audio_codec);
@@ -751,18 +1739,6 @@ int main(int argc, char *argv[])
             }
         }
     }
-    pkt = av_packet_alloc();
-    if (!pkt) {
-        SDL_Log("av_packet_alloc failed");
-        return_code = 4;
-        goto quit;
-    }
-    frame = av_frame_alloc();
-    if (!frame) {
-        SDL_Log("av_frame_alloc failed");
-        return_code = 4;
-        goto quit;
-    }
 
     /* Allocate memory for the sprite info */
     positions = (SDL_Rect *)SDL_malloc(num_sprites * sizeof(*positions));
@@ -797,6 +1773,80 @@ int main(int argc, char *argv[])
         }
     }
 
+    if (benchmark_file) {
+        char size[32];
+        benchmark.SetInfo("file", file);
+        benchmark.SetInfo("video_driver", SDL_GetCurrentVideoDriver());
+        if (video_context) {
+            SDL_snprintf(size, sizeof(size), "%dx%d", video_context->width, video_context->height);
+            benchmark.SetInfo("video_decoder", video_context->codec->name);
+            benchmark.SetInfo("video_size", size);
+            SDL_snprintf(size, sizeof(size), "%.1f", video_decoder_open_ms);
+            benchmark.SetInfo("video_decoder_open_ms", size);
+            SDL_snprintf(size, sizeof(size), "%s/%d", (video_context->active_thread_type & FF_THREAD_FRAME) ? "frame" :
+                         (video_context->active_thread_type & FF_THREAD_SLICE) ? "slice" : "none", video_context->thread_count);
+            benchmark.SetInfo("decode_threading", size);
+        }
+        benchmark.SetInfo("overlay_damage", COverlayDamage::GetModeName(overlay_damage_mode));
+        benchmark.SetInfo("overlay_zero_copy", overlay_zero_copy ? "true" : "false");
+        benchmark.SetInfo("direct_present", direct_present ? "true" : "false");
+        benchmark.Start();
+    }
+
+    /* Start reading packets on a separate thread so I/O stalls are absorbed by the packet queues */
+    if (!InitPacketQueue(&audio_packets, ic, audio_context ? audio_stream : -1) ||
+        !InitPacketQueue(&video_packets, ic, video_context ? video_stream : -1)) {
+        SDL_Log("Couldn't create packet queues: %s", SDL_GetError());
+        return_code = 4;
+        goto quit;
+    }
+    if (packet_arena_kb > 0 && !packet_arena.BInit((size_t)packet_arena_kb * 1024)) {
+        SDL_Log("Couldn't create packet arena: %s", SDL_GetError());
+        return_code = 4;
+        goto quit;
+    }
+    demux.ic = ic;
+    demux.audio_stream = audio_context ? audio_stream : -1;
+    demux.video_stream = video_context ? video_stream : -1;
+    demux_thread = SDL_CreateThread(DemuxThread, "demux", &demux);
+    if (!demux_thread) {
+        SDL_Log("Couldn't create demux thread: %s", SDL_GetError());
+        return_code = 4;
+        goto quit;
+    }
+    trace.SetThreadName(SDL_GetThreadID(demux_thread), "demux");
+
+    /* Decode video on a separate thread so decoding the next frame overlaps presenting this one */
+    if (!video_frames.BInit(frame_queue_size)) {
+        SDL_Log("Couldn't create frame queue: %s", SDL_GetError());
+        return_code = 4;
+        goto quit;
+    }
+    if (video_context) {
+        video_thread = SDL_CreateThread(VideoDecodeThread, "video_decode", video_context);
+        if (!video_thread) {
+            SDL_Log("Couldn't create video decode thread: %s", SDL_GetError());
+            return_code = 4;
+            goto quit;
+        }
+        trace.SetThreadName(SDL_GetThreadID(video_thread), "video_decode");
+    } else {
+        video_frames.SetEndOfStream();
+    }
+
+    /* Decode audio on a separate thread so it keeps the audio device fed while video presentation blocks */
+    if (audio_context) {
+        audio_thread = SDL_CreateThread(AudioDecodeThread, "audio_decode", audio_context);
+        if (!audio_thread) {
+            SDL_Log("Couldn't create audio decode thread: %s", SDL_GetError());
+            return_code = 4;
+            goto quit;
+        }
+        trace.SetThreadName(SDL_GetThreadID(audio_thread), "audio_decode");
+    } else {
+        SDL_SetAtomicInt(&audio_finished, 1);
+    }
+
     /* Main render loop */
     while (!done) {
         SDL_Event event;
@@ -819,60 +1869,46 @@ int main(int argc, char *argv[])
             }
         }
 
-        if (!flushing) {
-            result = av_read_frame(ic, pkt);
-            if (result < 0) {
-                SDL_Log("End of stream, finishing decode\n");
-                if (video_context) {
-                    avcodec_flush_buffers(video_context);
-                }
-                flushing = true;
-            } else {
-                if (pkt->stream_index == audio_stream) {
-                    result = avcodec_send_packet(audio_context, pkt);
-                    if (result < 0) {
-                        SDL_Log("avcodec_send_packet(audio_context) failed: %s", av_err2str(result));
-                    }
-                } else if (pkt->stream_index == video_stream) {
-                    if (!stats.BStarted()) {
-                        stats.MarkStage(k_FrameStageStartDecode);
-                    }
-                    result = avcodec_send_packet(video_context, pkt);
-                    if (result < 0) {
-                        SDL_Log("avcodec_send_packet(video_context) failed: %s", av_err2str(result));
-                    }
-                }
-                av_packet_unref(pkt);
-            }
+        /* Present the next decoded frame, waiting a short time so we keep handling events if decode stalls */
+        queued = video_frames.Peek(10);
+        if (queued) {
+            HandleVideoFrame(queued);
+            video_frames.Pop();
+        } else if (!video_context) {
+            SDL_Delay(10);
+        }
+        HandleScanouts();
+
+        if (SDL_GetAtomicInt(&audio_underruns) != audio_underrun_count) {
+            audio_underrun_count = SDL_GetAtomicInt(&audio_underruns);
+            SDL_Log("Audio underrun, %d total\n", audio_underrun_count);
         }
 
-        decoded = false;
-        if (audio_context) {
-            while (avcodec_receive_frame(audio_context, frame) >= 0) {
-                HandleAudioFrame(frame);
-                decoded = true;
+        if (!flushing && SDL_GetAtomicInt(&audio_finished) && video_frames.BFinished()) {
+            SDL_Log("End of stream, finishing playback\n");
+            if (av_drift_count > 0) {
+                SDL_Log("Synchronized to %s clock, average A/V drift %.1fms, %d late frames dropped\n",
+                        CMasterClock::GetSourceName(master_clock.GetSource()), (av_drift_total / av_drift_count) * 1000.0, late_frames_dropped);
+            } else if (late_frames_dropped > 0) {
+                SDL_Log("%d late frames dropped\n", late_frames_dropped);
             }
-            if (flushing) {
-                /* Let SDL know we're done sending audio */
-                SDL_FlushAudioStream(audio);
+            if (display->GetPresentationStats().unBackpressure > 0) {
+                SDL_Log("%d frames dropped waiting on the display\n", (int)display->GetPresentationStats().unBackpressure);
             }
-        }
-        if (video_context) {
-            while (avcodec_receive_frame(video_context, frame) >= 0) {
-                double pts = ((double)frame->pts * video_context->pkt_timebase.num) / video_context->pkt_timebase.den;
-                if (first_pts < 0.0) {
-                    first_pts = pts;
-                }
-                pts -= first_pts;
+            flushing = true;
 
-                HandleVideoFrame(frame, pts);
-                decoded = true;
+            if (benchmark_file) {
+                benchmark.Stop();
             }
         }
 
-        if (flushing && !decoded) {
-            if (SDL_GetAudioStreamQueued(audio) > 0) {
-                /* Wait a little bit for the audio to finish */
+        if (flushing) {
+            if (audio_ring.GetAvailable() > 0) {
+                /* Wait a little bit for the audio callback to drain the ring buffer */
+                SDL_Delay(10);
+            } else if (SDL_GetAudioStreamQueued(audio) > 0) {
+                /* Let SDL know we're done sending audio, and wait a little bit for it to finish */
+                SDL_FlushAudioStream(audio);
                 SDL_Delay(10);
             } else {
                 done = true;
@@ -881,15 +1917,82 @@ int main(int argc, char *argv[])
     }
     return_code = 0;
 
+    FlushPendingScanouts();
+
+    /* The worker threads update the stats, so make sure they've finished before reporting */
+    StopThreads(&demux_thread, &video_thread, &audio_thread);
+
+    if (benchmark_file) {
+        benchmark.Stop();
+        benchmark.SetCounter("dropped_frames", "late", late_frames_dropped);
+        benchmark.SetCounter("dropped_frames", "backpressure", display->GetPresentationStats().unBackpressure);
+
+        const COverlayDamage::SStats &overlay_stats = display->GetOverlayStats();
+        benchmark.SetCounter("overlay", "frames", overlay_stats.unFrames);
+        benchmark.SetCounter("overlay", "frames_skipped", overlay_stats.unFramesSkipped);
+        benchmark.SetCounter("overlay", "bytes_copied", overlay_stats.unBytesCopied);
+        benchmark.SetCounter("overlay", "bytes_hashed", overlay_stats.unBytesHashed);
+        benchmark.SetCounter("overlay", "sync_us", SDL_NS_TO_US(overlay_stats.unSyncNS));
+        benchmark.SetCounter("overlay", "max_in_flight", overlay_in_flight_max);
+
+        const CVideoDisplay::SPresentationStats &presentation_stats = display->GetPresentationStats();
+        benchmark.SetCounter("presentation", "presented", presentation_stats.unPresented);
+        benchmark.SetCounter("presentation", "discarded", presentation_stats.unDiscarded);
+        benchmark.SetCounter("presentation", "repeated_refreshes", presentation_stats.unRepeatedRefreshes);
+        benchmark.SetCounter("presentation", "refresh_us", SDL_NS_TO_US(presentation_stats.unRefreshNS));
+        benchmark.SetCounter("presentation", "release_us", SDL_NS_TO_US(presentation_stats.unReleaseNS));
+        benchmark.SetCounter("presentation", "in_flight_limit", presentation_stats.nInFlightLimit);
+
+        CFramePool::SStats frame_pool_stats = frame_pool.GetStats();
+        benchmark.SetCounter("pools", "frame_hits", frame_pool_stats.unHits);
+        benchmark.SetCounter("pools", "frame_misses", frame_pool_stats.unMisses);
+        benchmark.SetCounter("pools", "frame_peak_in_use", frame_pool_stats.nPeakInUse);
+        CPacketArena::SStats packet_arena_stats = packet_arena.GetStats();
+        benchmark.SetCounter("pools", "packet_hits", packet_arena_stats.unHits);
+        benchmark.SetCounter("pools", "packet_misses", packet_arena_stats.unMisses);
+        benchmark.SetCounter("pools", "packet_overflows", packet_arena_stats.unOverflows);
+        benchmark.SetCounter("pools", "packet_peak_bytes", packet_arena_stats.unPeakBytes);
+
+        const CDecoderPipeline::SStats &decoder_stats = decoder_pipeline.GetStats();
+        benchmark.SetCounter("decoder", "target_depth", decoder_depth);
+        benchmark.SetCounter("decoder", "output_buffers", decoder_output_buffers);
+        benchmark.SetCounter("decoder", "capture_buffers", decoder_capture_buffers);
+        benchmark.SetCounter("decoder", "packets_sent", decoder_stats.unPacketsSent);
+        benchmark.SetCounter("decoder", "frames_received", decoder_stats.unFramesReceived);
+        benchmark.SetCounter("decoder", "packets_dropped", decoder_stats.unPacketsDropped);
+        benchmark.SetCounter("decoder", "max_in_flight", decoder_stats.nMaxInFlight);
+        benchmark.SetCounter("decoder", "max_latency_us", SDL_NS_TO_US(decoder_stats.unMaxLatencyNS));
+        if (!benchmark.BWriteJSON(benchmark_file)) {
+            SDL_Log("Couldn't write %s: %s\n", benchmark_file, SDL_GetError());
+            return_code = 5;
+        } else {
+            SDL_Log("Wrote benchmark results to %s\n", benchmark_file);
+        }
+    }
+
 quit:
+    StopThreads(&demux_thread, &video_thread, &audio_thread);
+    if (audio) {
+        SDL_DestroyAudioStream(audio);
+    }
+    SDL_free(audio_callback_buffer);
+    SDL_free(audio_interleave_buffer);
+    if (trace.BEnabled()) {
+        if (trace.BWriteJSON(trace_file)) {
+            SDL_Log("Wrote trace to %s\n", trace_file);
+        } else {
+            SDL_Log("Couldn't write %s: %s\n", trace_file, SDL_GetError());
+        }
+    }
+    SDL_free(decoder_cache_path);
     SDL_free(positions);
     SDL_free(velocities);
-    av_frame_free(&frame);
-    av_packet_free(&pkt);
     avcodec_free_context(&audio_context);
     avcodec_free_context(&video_context);
     avformat_close_input(&ic);
-    SDL_DestroyRenderer(renderer);
+    for (i = 0; i < num_overlay_renderers; ++i) {
+        SDL_DestroyRenderer(overlay_renderers[i]);
+    }
     if (display) {
         delete display;
     }
@@ -0,0 +1,342 @@
+/*
+  Copyright (C) 2024 Sam Lantinga <slouken@libsdl.org>
+
+  This software is provided 'as-is', without any express or implied
+  warranty.  In no event will the authors be held liable for any damages
+  arising from the use of this software.
+
+  Permission is granted to anyone to use this software for any purpose,
+  including commercial applications, and to alter it and redistribute it
+  freely.
+*/
+#include "overlay_damage.h"
+
+
+static const char *s_ModeNames[] =
+{
+	"report",
+	"hash",
+	"full",
+};
+
+
+//--------------------------------------------------------------------------------------------------
+// COverlayDamage destructor
+//--------------------------------------------------------------------------------------------------
+COverlayDamage::~COverlayDamage()
+{
+	SDL_free( m_pTileHashes );
+}
+
+
+//--------------------------------------------------------------------------------------------------
+// Convert between damage modes and their names
+//--------------------------------------------------------------------------------------------------
+bool COverlayDamage::BParseMode( const char *pszName, EMode *peMode )
+{
+	for ( int i = 0; i < (int)SDL_arraysize( s_ModeNames ); ++i )
+	{
+		if ( SDL_strcmp( pszName, s_ModeNames[ i ] ) == 0 )
+		{
+			*peMode = (EMode)i;
+			return true;
+		}
+	}
+	return false;
+}
+
+const char *COverlayDamage::GetModeName( EMode eMode )
+{
+	return s_ModeNames[ eMode ];
+}
+
+
+//--------------------------------------------------------------------------------------------------
+// Start over with the whole overlay damaged
+//--------------------------------------------------------------------------------------------------
+void COverlayDamage::Init( int nWidth, int nHeight )
+{
+	m_nWidth = nWidth;
+	m_nHeight = nHeight;
+	m_unSerial = 1;
+	m_unDamagedSerial = 0;
+	SDL_zeroa( m_History );
+	m_nBuffers = 0;
+
+	SDL_free( m_pTileHashes );
+	m_nTilesX = ( nWidth + k_nTileSize - 1 ) / k_nTileSize;
+	m_nTilesY = ( nHeight + k_nTileSize - 1 ) / k_nTileSize;
+	m_pTileHashes = (Uint32 *)SDL_calloc( m_nTilesX * m_nTilesY, sizeof( *m_pTileHashes ) );
+	m_bTileHashesValid = false;
+
+	AddAll();
+}
+
+
+//--------------------------------------------------------------------------------------------------
+// Change how damage is found
+//--------------------------------------------------------------------------------------------------
+void COverlayDamage::SetMode( EMode eMode )
+{
+	if ( eMode != m_eMode )
+	{
+		m_eMode = eMode;
+		m_bTileHashesValid = false;
+		AddAll();
+	}
+}
+
+
+//--------------------------------------------------------------------------------------------------
+// Add a rect to a list, merging it with any rects it overlaps
+//
+// If the list is full, everything collapses into a single bounding rect.
+//--------------------------------------------------------------------------------------------------
+int COverlayDamage::AddRect( SDL_Rect *pRects, int nRects, int nMaxRects, const SDL_Rect &rect )
+{
+	SDL_Rect merged = rect;
+
+	for ( int i = 0; i < nRects; )
+	{
+		if ( SDL_HasRectIntersection( &pRects[ i ], &merged ) )
+		{
+			SDL_GetRectUnion( &pRects[ i ], &merged, &merged );
+
+			// Remove this rect and check the others against the larger rect
+			pRects[ i ] = pRects[ --nRects ];
+			i = 0;
+		}
+		else
+		{
+			++i;
+		}
+	}
+
+	if ( nRects == nMaxRects )
+	{
+		for ( int i = 0; i < nRects; ++i )
+		{
+			SDL_GetRectUnion( &pRects[ i ], &merged, &merged );
+		}
+		nRects = 0;
+	}
+	pRects[ nRects++ ] = merged;
+	return nRects;
+}
+
+
+//--------------------------------------------------------------------------------------------------
+// Add damage to the current frame
+//--------------------------------------------------------------------------------------------------
+void COverlayDamage::Add( const SDL_Rect &rect )
+{
+	if ( m_eMode != k_EModeReport )
+	{
+		return;
+	}
+
+	SDL_Rect bounds = { 0, 0, m_nWidth, m_nHeight };
+	SDL_Rect clipped;
+	if ( !SDL_GetRectIntersection( &rect, &bounds, &clipped ) )
+	{
+		return;
+	}
+
+	SFrame *pFrame = GetFrame( m_unSerial );
+	pFrame->nRects = AddRect( pFrame->rects, pFrame->nRects, k_nMaxRects, clipped );
+}
+
+void COverlayDamage::AddAll()
+{
+	SFrame *pFrame = GetFrame( m_unSerial );
+	pFrame->rects[ 0 ].x = 0;
+	pFrame->rects[ 0 ].y = 0;
+	pFrame->rects[ 0 ].w = m_nWidth;
+	pFrame->rects[ 0 ].h = m_nHeight;
+	pFrame->nRects = 1;
+}
+
+
+//--------------------------------------------------------------------------------------------------
+// Find the damage for the current frame when it isn't being reported
+//--------------------------------------------------------------------------------------------------
+void COverlayDamage::Detect( const SDL_Surface *pSurface )
+{
+	switch ( m_eMode )
+	{
+	case k_EModeTileHash:
+		break;
+	case k_EModeFull:
+		AddAll();
+		return;
+	default:
+		return;
+	}
+
+	if ( !m_pTileHashes )
+	{
+		AddAll();
+		return;
+	}
+
+	SFrame *pFrame = GetFrame( m_unSerial );
+	for ( int nTileY = 0; nTileY < m_nTilesY; ++nTileY )
+	{
+		for ( int nTileX = 0; nTileX < m_nTilesX; ++nTileX )
+		{
+			SDL_Rect tile;
+			tile.x = nTileX * k_nTileSize;
+			tile.y = nTileY * k_nTileSize;
+			tile.w = SDL_min( k_nTileSize, m_nWidth - tile.x );
+			tile.h = SDL_min( k_nTileSize, m_nHeight - tile.y );
+
+			const Uint8 *pRow = (const Uint8 *)pSurface->pixels + tile.y * pSurface->pitch + tile.x * 4;
+			Uint32 unHash = 0;
+			for ( int y = tile.h; y--; )
+			{
+				unHash = SDL_murmur3_32( pRow, tile.w * 4, unHash );
+				pRow += pSurface->pitch;
+			}
+			m_Stats.unBytesHashed += tile.w * tile.h * 4;
+
+			Uint32 &unTileHash = m_pTileHashes[ nTileY * m_nTilesX + nTileX ];
+			if ( unHash != unTileHash || !m_bTileHashesValid )
+			{
+				unTileHash = unHash;
+				pFrame->nRects = AddRect( pFrame->rects, pFrame->nRects, k_nMaxRects, tile );
+			}
+		}
+	}
+	m_bTileHashesValid = true;
+}
+
+
+//--------------------------------------------------------------------------------------------------
+// Return the damage added to the current frame
+//--------------------------------------------------------------------------------------------------
+int COverlayDamage::GetRects( const SDL_Rect **ppRects ) const
+{
+	const SFrame *pFrame = GetFrame( m_unSerial );
+	*ppRects = pFrame->rects;
+	return pFrame->nRects;
+}
+
+
+//--------------------------------------------------------------------------------------------------
+// Return the rects that need to be copied to bring a buffer up to date
+//--------------------------------------------------------------------------------------------------
+int COverlayDamage::GetBufferDamage( const void *pBuffer, SDL_Rect *pRects, int nMaxRects ) const
+{
+	Uint32 unBufferSerial = 0;
+	for ( int i = 0; i < m_nBuffers; ++i )
+	{
+		if ( m_Buffers[ i ].pBuffer == pBuffer )
+		{
+			unBufferSerial = m_Buffers[ i ].unSerial;
+			break;
+		}
+	}
+
+	if ( !unBufferSerial || ( m_unSerial - unBufferSerial ) >= k_nMaxHistory )
+	{
+		// We don't know what's in this buffer, copy everything
+		pRects[ 0 ].x = 0;
+		pRects[ 0 ].y = 0;
+		pRects[ 0 ].w = m_nWidth;
+		pRects[ 0 ].h = m_nHeight;
+		return 1;
+	}
+
+	// Add up the damage from every frame since the buffer was last written
+	int nRects = 0;
+	for ( Uint32 unSerial = unBufferSerial + 1; unSerial <= m_unSerial; ++unSerial )
+	{
+		const SFrame *pFrame = GetFrame( unSerial );
+		for ( int i = 0; i < pFrame->nRects; ++i )
+		{
+			nRects = AddRect( pRects, nRects, nMaxRects, pFrame->rects[ i ] );
+		}
+	}
+	return nRects;
+}
+
+
+//--------------------------------------------------------------------------------------------------
+// Record that a buffer now holds the current frame
+//--------------------------------------------------------------------------------------------------
+void COverlayDamage::SetBufferCurrent( const void *pBuffer )
+{
+	int iOldest = 0;
+	for ( int i = 0; i < m_nBuffers; ++i )
+	{
+		if ( m_Buffers[ i ].pBuffer == pBuffer )
+		{
+			m_Buffers[ i ].unSerial = m_unSerial;
+			return;
+		}
+		if ( m_Buffers[ i ].unSerial < m_Buffers[ iOldest ].unSerial )
+		{
+			iOldest = i;
+		}
+	}
+
+	// Replace the least recently written buffer if we're tracking too many
+	int iBuffer = ( m_nBuffers < k_nMaxBuffers ) ? m_nBuffers++ : iOldest;
+	m_Buffers[ iBuffer ].pBuffer = pBuffer;
+	m_Buffers[ iBuffer ].unSerial = m_unSerial;
+}
+
+
+//--------------------------------------------------------------------------------------------------
+// Finish the current frame
+//--------------------------------------------------------------------------------------------------
+void COverlayDamage::EndFrame()
+{
+	++m_Stats.unFrames;
+	if ( BEmpty() )
+	{
+		++m_Stats.unFramesSkipped;
+	}
+	else
+	{
+		m_unDamagedSerial = m_unSerial;
+	}
+
+	++m_unSerial;
+	GetFrame( m_unSerial )->nRects = 0;
+}
+
+
+//--------------------------------------------------------------------------------------------------
+// Copy rects between two 32-bit surfaces
+//--------------------------------------------------------------------------------------------------
+size_t COverlayDamage::CopyRects( const Uint8 *pSrc, int nSrcPitch, Uint8 *pDst, int nDstPitch, const SDL_Rect *pRects, int nRects )
+{
+	size_t unCopied = 0;
+
+	for ( int i = 0; i < nRects; ++i )
+	{
+		const SDL_Rect &rect = pRects[ i ];
+		const Uint8 *pSrcRow = pSrc + rect.y * nSrcPitch + rect.x * 4;
+		Uint8 *pDstRow = pDst + rect.y * nDstPitch + rect.x * 4;
+		size_t unLength = rect.w * 4;
+
+		if ( nSrcPitch == nDstPitch && unLength == (size_t)nSrcPitch )
+		{
+			// Full width rows are contiguous
+			SDL_memcpy( pDstRow, pSrcRow, rect.h * unLength );
+		}
+		else
+		{
+			for ( int y = rect.h; y--; )
+			{
+				SDL_memcpy( pDstRow, pSrcRow, unLength );
+				pSrcRow += nSrcPitch;
+				pDstRow += nDstPitch;
+			}
+		}
+		unCopied += rect.h * unLength;
+	}
+	m_Stats.unBytesCopied += unCopied;
+	return unCopied;
+}
@@ -0,0 +1,136 @@
+/*
+  Copyright (C) 2024 Sam Lantinga <slouken@libsdl.org>
+
+  This software is provided 'as-is', without any express or implied
+  warranty.  In no event will the authors be held liable for any damages
+  arising from the use of this software.
+
+  Permission is granted to anyone to use this software for any purpose,
+  including commercial applications, and to alter it and redistribute it
+  freely.
+*/
+#ifndef OVERLAY_DAMAGE_H
+#define OVERLAY_DAMAGE_H
+
+#include <SDL3/SDL.h>
+
+
+//--------------------------------------------------------------------------------------------------
+// Tracks which parts of the overlay have changed
+//
+// Damage is collected for the current frame and kept for a few frames afterwards. Backends that
+// rotate through several buffers use the history to copy only what changed since that buffer was
+// last written, and fall back to copying everything when a buffer is new or too old.
+//
+// Callers that can't report what they draw can switch to tile hashing, which compares a hash of
+// each tile with the previous frame to find the damage.
+//--------------------------------------------------------------------------------------------------
+class COverlayDamage
+{
+public:
+	enum
+	{
+		k_nMaxRects = 16,
+		k_nMaxHistory = 8,
+		k_nMaxBuffers = 8,
+		k_nTileSize = 64
+	};
+
+	enum EMode
+	{
+		k_EModeReport,		// Damage is reported with Add()
+		k_EModeTileHash,	// Damage is found by hashing the surface
+		k_EModeFull			// The whole overlay is damaged every frame
+	};
+
+	struct SStats
+	{
+		Uint64 unFrames;
+		Uint64 unFramesSkipped;
+		Uint64 unBytesCopied;
+		Uint64 unBytesHashed;
+		Uint64 unSyncNS;
+	};
+
+public:
+	COverlayDamage() { }
+	~COverlayDamage();
+
+	static bool BParseMode( const char *pszName, EMode *peMode );
+	static const char *GetModeName( EMode eMode );
+
+	// Start over with the whole overlay damaged and no buffers known
+	void Init( int nWidth, int nHeight );
+
+	void SetMode( EMode eMode );
+	EMode GetMode() const { return m_eMode; }
+
+	// Add damage to the current frame, ignored unless damage is being reported
+	void Add( const SDL_Rect &rect );
+	void AddAll();
+
+	// Find the damage for the current frame when it isn't being reported
+	void Detect( const SDL_Surface *pSurface );
+
+	bool BEmpty() const { return GetFrame( m_unSerial )->nRects == 0; }
+
+	// Returns a value that changes whenever the overlay contents change
+	Uint32 GetGeneration() const { return BEmpty() ? m_unDamagedSerial : m_unSerial; }
+
+	// Return the damage added to the current frame
+	int GetRects( const SDL_Rect **ppRects ) const;
+
+	// Return the rects that need to be copied to bring a buffer up to date with the current frame
+	int GetBufferDamage( const void *pBuffer, SDL_Rect *pRects, int nMaxRects ) const;
+
+	// Record that a buffer now holds the current frame
+	void SetBufferCurrent( const void *pBuffer );
+
+	// Finish the current frame and start collecting damage for the next one
+	void EndFrame();
+
+	// Copy the given rects between two 32-bit surfaces, returning the number of bytes copied
+	size_t CopyRects( const Uint8 *pSrc, int nSrcPitch, Uint8 *pDst, int nDstPitch, const SDL_Rect *pRects, int nRects );
+
+	// Record bytes copied by a backend that doesn't use CopyRects()
+	void AddBytesCopied( size_t unBytes ) { m_Stats.unBytesCopied += unBytes; }
+
+	// Record time spent synchronizing CPU access to framebuffer memory
+	void AddSyncTime( Uint64 unElapsedNS ) { m_Stats.unSyncNS += unElapsedNS; }
+
+	const SStats &GetStats() const { return m_Stats; }
+
+private:
+	struct SFrame
+	{
+		SDL_Rect rects[ k_nMaxRects ];
+		int nRects;
+	};
+
+	struct SBuffer
+	{
+		const void *pBuffer;
+		Uint32 unSerial;
+	};
+
+	SFrame *GetFrame( Uint32 unSerial ) { return &m_History[ unSerial % k_nMaxHistory ]; }
+	const SFrame *GetFrame( Uint32 unSerial ) const { return &m_History[ unSerial % k_nMaxHistory ]; }
+
+	static int AddRect( SDL_Rect *pRects, int nRects, int nMaxRects, const SDL_Rect &rect );
+
+	EMode m_eMode = k_EModeReport;
+	int m_nWidth = 0;
+	int m_nHeight = 0;
+	Uint32 m_unSerial = 0;
+	Uint32 m_unDamagedSerial = 0;
+	SFrame m_History[ k_nMaxHistory ];
+	SBuffer m_Buffers[ k_nMaxBuffers ];
+	int m_nBuffers = 0;
+	Uint32 *m_pTileHashes = nullptr;
+	int m_nTilesX = 0;
+	int m_nTilesY = 0;
+	bool m_bTileHashesValid = false;
+	SStats m_Stats = { };
+};
+
+#endif // OVERLAY_DAMAGE_H
@@ -0,0 +1,251 @@
+/*
+  Copyright (C) 2024 Sam Lantinga <slouken@libsdl.org>
+
+  This software is provided 'as-is', without any express or implied
+  warranty.  In no event will the authors be held liable for any damages
+  arising from the use of this software.
+
+  Permission is granted to anyone to use this software for any purpose,
+  including commercial applications, and to alter it and redistribute it
+  freely.
+*/
+#include "packet_queue.h"
+
+
+//--------------------------------------------------------------------------------------------------
+// Return the duration of a packet in nanoseconds
+//--------------------------------------------------------------------------------------------------
+static Uint64 GetPacketDurationNS( const AVPacket *pPacket, AVRational timeBase )
+{
+	if ( pPacket->duration <= 0 || timeBase.den == 0 )
+	{
+		return 0;
+	}
+	return (Uint64)( ( (double)pPacket->duration * timeBase.num * SDL_NS_PER_SECOND ) / timeBase.den );
+}
+
+
+//--------------------------------------------------------------------------------------------------
+// CPacketQueue destructor
+//--------------------------------------------------------------------------------------------------
+CPacketQueue::~CPacketQueue()
+{
+	if ( m_ppPackets )
+	{
+		for ( int i = 0; i < m_nMaxPackets; ++i )
+		{
+			av_packet_free( &m_ppPackets[ i ] );
+		}
+		SDL_free( m_ppPackets );
+	}
+	SDL_free( m_pTimings );
+	if ( m_pCondition )
+	{
+		SDL_DestroyCondition( m_pCondition );
+	}
+	if ( m_pMutex )
+	{
+		SDL_DestroyMutex( m_pMutex );
+	}
+}
+
+
+//--------------------------------------------------------------------------------------------------
+// Initialize the packet queue
+//--------------------------------------------------------------------------------------------------
+bool CPacketQueue::BInit( int nMaxPackets, size_t unMaxBytes, Uint64 unMaxDurationNS, AVRational timeBase )
+{
+	m_pMutex = SDL_CreateMutex();
+	if ( !m_pMutex )
+	{
+		return false;
+	}
+
+	m_pCondition = SDL_CreateCondition();
+	if ( !m_pCondition )
+	{
+		return false;
+	}
+
+	// The packet slots are allocated up front and reused, so queueing doesn't allocate
+	m_ppPackets = (AVPacket **)SDL_calloc( nMaxPackets, sizeof( *m_ppPackets ) );
+	m_pTimings = (SPacketTiming *)SDL_calloc( nMaxPackets, sizeof( *m_pTimings ) );
+	if ( !m_ppPackets || !m_pTimings )
+	{
+		return false;
+	}
+	for ( int i = 0; i < nMaxPackets; ++i )
+	{
+		m_ppPackets[ i ] = av_packet_alloc();
+		if ( !m_ppPackets[ i ] )
+		{
+			SDL_SetError( "av_packet_alloc() failed" );
+			return false;
+		}
+	}
+	m_nMaxPackets = nMaxPackets;
+	m_unMaxBytes = unMaxBytes;
+	m_unMaxDurationNS = unMaxDurationNS;
+	m_TimeBase = timeBase;
+
+	return true;
+}
+
+
+//--------------------------------------------------------------------------------------------------
+// Return true if the queue can't accept any more packets
+//--------------------------------------------------------------------------------------------------
+bool CPacketQueue::BFull() const
+{
+	if ( m_nCount == 0 )
+	{
+		return false;
+	}
+	if ( m_nCount == m_nMaxPackets )
+	{
+		return true;
+	}
+	if ( m_unMaxBytes && m_unBytes >= m_unMaxBytes )
+	{
+		return true;
+	}
+	if ( m_unMaxDurationNS && m_unDurationNS >= m_unMaxDurationNS )
+	{
+		return true;
+	}
+	return false;
+}
+
+
+//--------------------------------------------------------------------------------------------------
+// Add a packet to the queue
+//--------------------------------------------------------------------------------------------------
+bool CPacketQueue::BPut( AVPacket *pPacket, const SPacketTiming *pTiming )
+{
+	SDL_LockMutex( m_pMutex );
+	while ( BFull() && !m_bAborted )
+	{
+		SDL_WaitCondition( m_pCondition, m_pMutex );
+	}
+	if ( m_bAborted )
+	{
+		SDL_UnlockMutex( m_pMutex );
+		av_packet_unref( pPacket );
+		return false;
+	}
+
+	int nTail = ( m_nHead + m_nCount ) % m_nMaxPackets;
+	av_packet_move_ref( m_ppPackets[ nTail ], pPacket );
+	if ( pTiming )
+	{
+		m_pTimings[ nTail ] = *pTiming;
+	}
+	else
+	{
+		SDL_zero( m_pTimings[ nTail ] );
+	}
+	m_unBytes += m_ppPackets[ nTail ]->size;
+	m_unDurationNS += GetPacketDurationNS( m_ppPackets[ nTail ], m_TimeBase );
+	++m_nCount;
+
+	SDL_BroadcastCondition( m_pCondition );
+	SDL_UnlockMutex( m_pMutex );
+	return true;
+}
+
+
+//--------------------------------------------------------------------------------------------------
+// Remove a packet from the queue
+//--------------------------------------------------------------------------------------------------
+bool CPacketQueue::BGet( AVPacket *pPacket, Sint32 nTimeoutMS, SPacketTiming *pTiming )
+{
+	SDL_LockMutex( m_pMutex );
+	if ( m_nCount == 0 && !m_bEndOfStream && !m_bAborted && nTimeoutMS != 0 )
+	{
+		SDL_WaitConditionTimeout( m_pCondition, m_pMutex, nTimeoutMS );
+	}
+	if ( m_nCount == 0 || m_bAborted )
+	{
+		SDL_UnlockMutex( m_pMutex );
+		return false;
+	}
+
+	AVPacket *pHead = m_ppPackets[ m_nHead ];
+	m_unBytes -= pHead->size;
+	m_unDurationNS -= SDL_min( GetPacketDurationNS( pHead, m_TimeBase ), m_unDurationNS );
+	av_packet_move_ref( pPacket, pHead );
+	if ( pTiming )
+	{
+		*pTiming = m_pTimings[ m_nHead ];
+	}
+	m_nHead = ( m_nHead + 1 ) % m_nMaxPackets;
+	--m_nCount;
+
+	SDL_BroadcastCondition( m_pCondition );
+	SDL_UnlockMutex( m_pMutex );
+	return true;
+}
+
+
+//--------------------------------------------------------------------------------------------------
+// Mark that no more packets will be added
+//--------------------------------------------------------------------------------------------------
+void CPacketQueue::SetEndOfStream()
+{
+	SDL_LockMutex( m_pMutex );
+	m_bEndOfStream = true;
+	SDL_BroadcastCondition( m_pCondition );
+	SDL_UnlockMutex( m_pMutex );
+}
+
+
+//--------------------------------------------------------------------------------------------------
+// Returns true if the end of stream has been reached and the queue is empty
+//--------------------------------------------------------------------------------------------------
+bool CPacketQueue::BFinished()
+{
+	SDL_LockMutex( m_pMutex );
+	bool bFinished = ( m_bEndOfStream && m_nCount == 0 );
+	SDL_UnlockMutex( m_pMutex );
+	return bFinished;
+}
+
+
+//--------------------------------------------------------------------------------------------------
+// Wake up any waiting callers and fail further requests
+//--------------------------------------------------------------------------------------------------
+void CPacketQueue::Abort()
+{
+	SDL_LockMutex( m_pMutex );
+	m_bAborted = true;
+	SDL_BroadcastCondition( m_pCondition );
+	SDL_UnlockMutex( m_pMutex );
+}
+
+
+//--------------------------------------------------------------------------------------------------
+// Queue statistics
+//--------------------------------------------------------------------------------------------------
+int CPacketQueue::GetCount()
+{
+	SDL_LockMutex( m_pMutex );
+	int nCount = m_nCount;
+	SDL_UnlockMutex( m_pMutex );
+	return nCount;
+}
+
+size_t CPacketQueue::GetBytes()
+{
+	SDL_LockMutex( m_pMutex );
+	size_t unBytes = m_unBytes;
+	SDL_UnlockMutex( m_pMutex );
+	return unBytes;
+}
+
+Uint64 CPacketQueue::GetDurationNS()
+{
+	SDL_LockMutex( m_pMutex );
+	Uint64 unDurationNS = m_unDurationNS;
+	SDL_UnlockMutex( m_pMutex );
+	return unDurationNS;
+}
@@ -0,0 +1,85 @@
+/*
+  Copyright (C) 2024 Sam Lantinga <slouken@libsdl.org>
+
+  This software is provided 'as-is', without any express or implied
+  warranty.  In no event will the authors be held liable for any damages
+  arising from the use of this software.
+
+  Permission is granted to anyone to use this software for any purpose,
+  including commercial applications, and to alter it and redistribute it
+  freely.
+*/
+#ifndef PACKET_QUEUE_H
+#define PACKET_QUEUE_H
+
+#include <SDL3/SDL.h>
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+}
+
+
+//--------------------------------------------------------------------------------------------------
+// When and where a packet was read, so the time can be attributed to the frame it decodes into
+//--------------------------------------------------------------------------------------------------
+struct SPacketTiming
+{
+	Uint64 unReadStartNS;
+	Uint64 unReadEndNS;
+	SDL_ThreadID unThreadID;
+};
+
+
+//--------------------------------------------------------------------------------------------------
+// A bounded, thread-safe queue of demuxed packets for a single stream
+//
+// The queue is full when it holds more than the byte or duration limit, or when every slot is in
+// use. An empty queue always accepts a packet so a single oversized packet can't stall the demuxer.
+//--------------------------------------------------------------------------------------------------
+class CPacketQueue
+{
+public:
+	CPacketQueue() { }
+	~CPacketQueue();
+
+	bool BInit( int nMaxPackets, size_t unMaxBytes, Uint64 unMaxDurationNS, AVRational timeBase );
+
+	// Add a packet to the queue, waiting while the queue is full. The packet reference is moved into the queue.
+	bool BPut( AVPacket *pPacket, const SPacketTiming *pTiming = nullptr );
+
+	// Remove a packet from the queue, waiting up to nTimeoutMS for one to arrive (-1 waits forever)
+	bool BGet( AVPacket *pPacket, Sint32 nTimeoutMS, SPacketTiming *pTiming = nullptr );
+
+	// Mark that no more packets will be added
+	void SetEndOfStream();
+
+	// Returns true if the end of stream has been reached and all packets have been removed
+	bool BFinished();
+
+	// Wake up and fail any waiting callers, used at shutdown
+	void Abort();
+
+	int GetCount();
+	size_t GetBytes();
+	Uint64 GetDurationNS();
+
+private:
+	bool BFull() const;
+
+	SDL_Mutex *m_pMutex = nullptr;
+	SDL_Condition *m_pCondition = nullptr;
+	AVPacket **m_ppPackets = nullptr;
+	SPacketTiming *m_pTimings = nullptr;
+	int m_nMaxPackets = 0;
+	int m_nHead = 0;
+	int m_nCount = 0;
+	size_t m_unBytes = 0;
+	size_t m_unMaxBytes = 0;
+	Uint64 m_unDurationNS = 0;
+	Uint64 m_unMaxDurationNS = 0;
+	AVRational m_TimeBase = { 0, 1 };
+	bool m_bEndOfStream = false;
+	bool m_bAborted = false;
+};
+
+#endif // PACKET_QUEUE_H
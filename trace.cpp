@@ -0,0 +1,149 @@
+/*
+  Copyright (C) 2024 Sam Lantinga <slouken@libsdl.org>
+
+  This software is provided 'as-is', without any express or implied
+  warranty.  In no event will the authors be held liable for any damages
+  arising from the use of this software.
+
+  Permission is granted to anyone to use this software for any purpose,
+  including commercial applications, and to alter it and redistribute it
+  freely.
+*/
+#include "trace.h"
+
+
+//--------------------------------------------------------------------------------------------------
+// CTraceRecorder destructor
+//--------------------------------------------------------------------------------------------------
+CTraceRecorder::~CTraceRecorder()
+{
+	SDL_free( m_pEvents );
+}
+
+
+//--------------------------------------------------------------------------------------------------
+// Allocate the event buffer
+//--------------------------------------------------------------------------------------------------
+bool CTraceRecorder::BInit( int nMaxEvents )
+{
+	m_pEvents = (SEvent *)SDL_calloc( nMaxEvents, sizeof( *m_pEvents ) );
+	if ( !m_pEvents )
+	{
+		return false;
+	}
+	m_nMaxEvents = nMaxEvents;
+	return true;
+}
+
+
+//--------------------------------------------------------------------------------------------------
+// Record events
+//--------------------------------------------------------------------------------------------------
+CTraceRecorder::SEvent *CTraceRecorder::AllocEvent()
+{
+	if ( !m_pEvents )
+	{
+		return nullptr;
+	}
+
+	// The count keeps growing once the buffer is full, so we can report how many were dropped
+	int nIndex = SDL_AddAtomicInt( &m_nEvents, 1 );
+	if ( nIndex >= m_nMaxEvents )
+	{
+		return nullptr;
+	}
+	return &m_pEvents[ nIndex ];
+}
+
+void CTraceRecorder::AddEvent( const char *pszName, SDL_ThreadID unThreadID, Uint64 unStartNS, Uint64 unEndNS, double flPTS )
+{
+	SEvent *pEvent = AllocEvent();
+	if ( pEvent )
+	{
+		pEvent->pszName = pszName;
+		pEvent->unThreadID = unThreadID;
+		pEvent->unStartNS = unStartNS;
+		pEvent->unDurationNS = ( unEndNS > unStartNS ) ? ( unEndNS - unStartNS ) : 0;
+		pEvent->flPTS = flPTS;
+		pEvent->bInstant = false;
+	}
+}
+
+void CTraceRecorder::AddInstantEvent( const char *pszName, SDL_ThreadID unThreadID, Uint64 unTimeNS, double flPTS )
+{
+	SEvent *pEvent = AllocEvent();
+	if ( pEvent )
+	{
+		pEvent->pszName = pszName;
+		pEvent->unThreadID = unThreadID;
+		pEvent->unStartNS = unTimeNS;
+		pEvent->unDurationNS = 0;
+		pEvent->flPTS = flPTS;
+		pEvent->bInstant = true;
+	}
+}
+
+
+//--------------------------------------------------------------------------------------------------
+// Name a thread in the trace
+//
+// This should be called before other threads start recording events.
+//--------------------------------------------------------------------------------------------------
+void CTraceRecorder::SetThreadName( SDL_ThreadID unThreadID, const char *pszName )
+{
+	if ( m_nThreadNames < (int)SDL_arraysize( m_ThreadNames ) )
+	{
+		m_ThreadNames[ m_nThreadNames ].unThreadID = unThreadID;
+		m_ThreadNames[ m_nThreadNames ].pszName = pszName;
+		++m_nThreadNames;
+	}
+}
+
+
+//--------------------------------------------------------------------------------------------------
+// Write the events as JSON, which can be loaded into Perfetto or chrome://tracing
+//
+// This should be called after other threads have stopped recording events.
+//--------------------------------------------------------------------------------------------------
+bool CTraceRecorder::BWriteJSON( const char *pszFile )
+{
+	SDL_IOStream *pIO = SDL_IOFromFile( pszFile, "w" );
+	if ( !pIO )
+	{
+		return false;
+	}
+
+	int nEvents = SDL_GetAtomicInt( &m_nEvents );
+	if ( nEvents > m_nMaxEvents )
+	{
+		SDL_Log( "Trace buffer full, %d events dropped", nEvents - m_nMaxEvents );
+		nEvents = m_nMaxEvents;
+	}
+
+	SDL_IOprintf( pIO, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n" );
+	SDL_IOprintf( pIO, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"testffmpeg_rpi\"}}" );
+	for ( int i = 0; i < m_nThreadNames; ++i )
+	{
+		SDL_IOprintf( pIO, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%" SDL_PRIu64 ",\"args\":{\"name\":\"%s\"}}",
+			(Uint64)m_ThreadNames[ i ].unThreadID, m_ThreadNames[ i ].pszName );
+	}
+
+	// Timestamps are in microseconds
+	for ( int i = 0; i < nEvents; ++i )
+	{
+		const SEvent *pEvent = &m_pEvents[ i ];
+		if ( pEvent->bInstant )
+		{
+			SDL_IOprintf( pIO, ",\n{\"name\":\"%s\",\"ph\":\"i\",\"s\":\"t\",\"pid\":1,\"tid\":%" SDL_PRIu64 ",\"ts\":%.3f,\"args\":{\"pts\":%.6f}}",
+				pEvent->pszName, (Uint64)pEvent->unThreadID, pEvent->unStartNS / 1000.0, pEvent->flPTS );
+		}
+		else
+		{
+			SDL_IOprintf( pIO, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%" SDL_PRIu64 ",\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"pts\":%.6f}}",
+				pEvent->pszName, (Uint64)pEvent->unThreadID, pEvent->unStartNS / 1000.0, pEvent->unDurationNS / 1000.0, pEvent->flPTS );
+		}
+	}
+	SDL_IOprintf( pIO, "\n]}\n" );
+
+	return SDL_CloseIO( pIO );
+}
@@ -0,0 +1,72 @@
+/*
+  Copyright (C) 2024 Sam Lantinga <slouken@libsdl.org>
+
+  This software is provided 'as-is', without any express or implied
+  warranty.  In no event will the authors be held liable for any damages
+  arising from the use of this software.
+
+  Permission is granted to anyone to use this software for any purpose,
+  including commercial applications, and to alter it and redistribute it
+  freely.
+*/
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <SDL3/SDL.h>
+
+
+//--------------------------------------------------------------------------------------------------
+// Records timed events and writes them in the Chrome trace event format
+//
+// Events are stored in a buffer allocated up front, so recording never allocates and can be done
+// from any thread. Events past the end of the buffer are counted and dropped. Names are expected
+// to be string literals, they aren't copied.
+//--------------------------------------------------------------------------------------------------
+class CTraceRecorder
+{
+public:
+	CTraceRecorder() { }
+	~CTraceRecorder();
+
+	bool BInit( int nMaxEvents );
+
+	bool BEnabled() const { return m_pEvents != nullptr; }
+
+	// Record an event that lasted from unStartNS to unEndNS, for the frame with the given timestamp
+	void AddEvent( const char *pszName, SDL_ThreadID unThreadID, Uint64 unStartNS, Uint64 unEndNS, double flPTS );
+
+	// Record an event that happened at a single point in time
+	void AddInstantEvent( const char *pszName, SDL_ThreadID unThreadID, Uint64 unTimeNS, double flPTS );
+
+	void SetThreadName( SDL_ThreadID unThreadID, const char *pszName );
+
+	bool BWriteJSON( const char *pszFile );
+
+private:
+	struct SEvent
+	{
+		const char *pszName;
+		SDL_ThreadID unThreadID;
+		Uint64 unStartNS;
+		Uint64 unDurationNS;
+		double flPTS;
+		bool bInstant;
+	};
+
+	struct SThreadName
+	{
+		SDL_ThreadID unThreadID;
+		const char *pszName;
+	};
+
+	SEvent *AllocEvent();
+
+	SEvent *m_pEvents = nullptr;
+	int m_nMaxEvents = 0;
+	SDL_AtomicInt m_nEvents = { 0 };
+
+	SThreadName m_ThreadNames[ 16 ];
+	int m_nThreadNames = 0;
+};
+
+#endif // TRACE_H
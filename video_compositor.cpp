@@ -0,0 +1,788 @@
+/*
+  Copyright (C) 2024 Sam Lantinga <slouken@libsdl.org>
+
+  This software is provided 'as-is', without any express or implied
+  warranty.  In no event will the authors be held liable for any damages
+  arising from the use of this software.
+
+  Permission is granted to anyone to use this software for any purpose,
+  including commercial applications, and to alter it and redistribute it
+  freely.
+*/
+#include "video_compositor.h"
+
+extern "C" {
+#include <libavutil/frame.h>
+#include <libavutil/pixfmt.h>
+}
+
+
+//--------------------------------------------------------------------------------------------------
+// YUV to RGB conversion coefficients in 8.8 fixed point
+//--------------------------------------------------------------------------------------------------
+struct SYUVCoefficients
+{
+	int nYOffset;
+	int nY;
+	int nRV;
+	int nGU;
+	int nGV;
+	int nBU;
+};
+
+// Indexed by [ BT.709 ][ full range ]
+static const SYUVCoefficients s_Coefficients[ 2 ][ 2 ] =
+{
+	{
+		{ 16, 298, 409, -100, -208, 516 },
+		{ 0, 256, 359, -88, -183, 454 },
+	},
+	{
+		{ 16, 298, 459, -55, -136, 541 },
+		{ 0, 256, 403, -48, -120, 475 },
+	},
+};
+
+static inline Uint32 ClampChannel( int n )
+{
+	return (Uint32)( n < 0 ? 0 : ( n > 255 ? 255 : n ) );
+}
+
+
+//--------------------------------------------------------------------------------------------------
+// Scalar kernels
+//
+// These define the results, the vector kernels produce exactly the same output.
+//--------------------------------------------------------------------------------------------------
+static void ConvertRowScalar( const Uint8 *pY, const Uint8 *pU, const Uint8 *pV, int nChromaStep, int nStart, int nWidth, Uint32 *pDst, const SYUVCoefficients &c )
+{
+	for ( int x = nStart; x < nWidth; ++x )
+	{
+		int nY = ( pY[ x ] - c.nYOffset ) * c.nY + 128;
+		int nU = pU[ ( x >> 1 ) * nChromaStep ] - 128;
+		int nV = pV[ ( x >> 1 ) * nChromaStep ] - 128;
+		Uint32 unR = ClampChannel( ( nY + c.nRV * nV ) >> 8 );
+		Uint32 unG = ClampChannel( ( nY + c.nGU * nU + c.nGV * nV ) >> 8 );
+		Uint32 unB = ClampChannel( ( nY + c.nBU * nU ) >> 8 );
+		pDst[ x ] = 0xFF000000 | ( unR << 16 ) | ( unG << 8 ) | unB;
+	}
+}
+
+static inline Uint32 BlendChannel( Uint32 unSrc, Uint32 unDst, Uint32 unAlpha )
+{
+	// Exact division by 255 with rounding
+	Uint32 t = unSrc * unAlpha + unDst * ( 255 - unAlpha ) + 128;
+	return ( t + ( t >> 8 ) ) >> 8;
+}
+
+static void BlendRowScalar( const Uint32 *pSrc, int nStart, int nWidth, Uint32 *pDst )
+{
+	for ( int x = nStart; x < nWidth; ++x )
+	{
+		Uint32 unSrc = pSrc[ x ];
+		Uint32 unAlpha = unSrc >> 24;
+		if ( unAlpha == 0 )
+		{
+			continue;
+		}
+
+		Uint32 unDst = pDst[ x ];
+		Uint32 unR = BlendChannel( ( unSrc >> 16 ) & 0xFF, ( unDst >> 16 ) & 0xFF, unAlpha );
+		Uint32 unG = BlendChannel( ( unSrc >> 8 ) & 0xFF, ( unDst >> 8 ) & 0xFF, unAlpha );
+		Uint32 unB = BlendChannel( unSrc & 0xFF, unDst & 0xFF, unAlpha );
+		pDst[ x ] = 0xFF000000 | ( unR << 16 ) | ( unG << 8 ) | unB;
+	}
+}
+
+static void ConvertRowScalar( const Uint8 *pY, const Uint8 *pU, const Uint8 *pV, int nChromaStep, int nWidth, Uint32 *pDst, const SYUVCoefficients &c )
+{
+	ConvertRowScalar( pY, pU, pV, nChromaStep, 0, nWidth, pDst, c );
+}
+
+static void BlendRowScalar( const Uint32 *pSrc, int nWidth, Uint32 *pDst )
+{
+	BlendRowScalar( pSrc, 0, nWidth, pDst );
+}
+
+
+//--------------------------------------------------------------------------------------------------
+// Vector kernels, converting 8 pixels and blending 4 (SSE2) or 8 (NEON) pixels at a time
+//--------------------------------------------------------------------------------------------------
+#if defined( SDL_SSE2_INTRINSICS )
+#define HAVE_VECTOR_COMPOSITE
+
+// A pair of 16-bit coefficients for _mm_madd_epi16 on interleaved U and V
+static inline __m128i CoefficientPair( int nU, int nV )
+{
+	return _mm_set1_epi32( (int)( (Uint32)(Uint16)nU | ( (Uint32)(Uint16)nV << 16 ) ) );
+}
+
+static void ConvertRowVector( const Uint8 *pY, const Uint8 *pU, const Uint8 *pV, int nChromaStep, int nWidth, Uint32 *pDst, const SYUVCoefficients &c )
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i yOffset = _mm_set1_epi16( (short)c.nYOffset );
+	const __m128i uvOffset = _mm_set1_epi16( 128 );
+	const __m128i round = _mm_set1_epi32( 128 );
+	const __m128i coefY = _mm_set1_epi32( c.nY );
+	const __m128i coefR = CoefficientPair( 0, c.nRV );
+	const __m128i coefG = CoefficientPair( c.nGU, c.nGV );
+	const __m128i coefB = CoefficientPair( c.nBU, 0 );
+	const __m128i alpha = _mm_set1_epi8( (char)0xFF );
+
+	int x = 0;
+	for ( ; x + 8 <= nWidth; x += 8 )
+	{
+		__m128i y = _mm_sub_epi16( _mm_unpacklo_epi8( _mm_loadl_epi64( (const __m128i *)( pY + x ) ), zero ), yOffset );
+
+		// Four chroma samples as interleaved U, V pairs
+		__m128i uv;
+		if ( nChromaStep == 2 )
+		{
+			uv = _mm_unpacklo_epi8( _mm_loadl_epi64( (const __m128i *)( pU + x ) ), zero );
+		}
+		else
+		{
+			int nU, nV;
+			SDL_memcpy( &nU, pU + x / 2, sizeof( nU ) );
+			SDL_memcpy( &nV, pV + x / 2, sizeof( nV ) );
+			__m128i u = _mm_unpacklo_epi8( _mm_cvtsi32_si128( nU ), zero );
+			__m128i v = _mm_unpacklo_epi8( _mm_cvtsi32_si128( nV ), zero );
+			uv = _mm_unpacklo_epi16( u, v );
+		}
+		uv = _mm_sub_epi16( uv, uvOffset );
+
+		__m128i yLo = _mm_add_epi32( _mm_madd_epi16( _mm_unpacklo_epi16( y, zero ), coefY ), round );
+		__m128i yHi = _mm_add_epi32( _mm_madd_epi16( _mm_unpackhi_epi16( y, zero ), coefY ), round );
+		__m128i r = _mm_madd_epi16( uv, coefR );
+		__m128i g = _mm_madd_epi16( uv, coefG );
+		__m128i b = _mm_madd_epi16( uv, coefB );
+
+		// Each chroma sample covers two pixels
+		__m128i r16 = _mm_packs_epi32( _mm_srai_epi32( _mm_add_epi32( yLo, _mm_unpacklo_epi32( r, r ) ), 8 ),
+		                               _mm_srai_epi32( _mm_add_epi32( yHi, _mm_unpackhi_epi32( r, r ) ), 8 ) );
+		__m128i g16 = _mm_packs_epi32( _mm_srai_epi32( _mm_add_epi32( yLo, _mm_unpacklo_epi32( g, g ) ), 8 ),
+		                               _mm_srai_epi32( _mm_add_epi32( yHi, _mm_unpackhi_epi32( g, g ) ), 8 ) );
+		__m128i b16 = _mm_packs_epi32( _mm_srai_epi32( _mm_add_epi32( yLo, _mm_unpacklo_epi32( b, b ) ), 8 ),
+		                               _mm_srai_epi32( _mm_add_epi32( yHi, _mm_unpackhi_epi32( b, b ) ), 8 ) );
+
+		// Pixels are B, G, R, X in memory
+		__m128i bg = _mm_unpacklo_epi8( _mm_packus_epi16( b16, b16 ), _mm_packus_epi16( g16, g16 ) );
+		__m128i ra = _mm_unpacklo_epi8( _mm_packus_epi16( r16, r16 ), alpha );
+		_mm_storeu_si128( (__m128i *)( pDst + x ), _mm_unpacklo_epi16( bg, ra ) );
+		_mm_storeu_si128( (__m128i *)( pDst + x + 4 ), _mm_unpackhi_epi16( bg, ra ) );
+	}
+	ConvertRowScalar( pY, pU, pV, nChromaStep, x, nWidth, pDst, c );
+}
+
+static inline __m128i BlendHalf( __m128i src, __m128i dst )
+{
+	const __m128i max = _mm_set1_epi16( 255 );
+	const __m128i round = _mm_set1_epi16( 128 );
+
+	__m128i alpha = _mm_shufflehi_epi16( _mm_shufflelo_epi16( src, _MM_SHUFFLE( 3, 3, 3, 3 ) ), _MM_SHUFFLE( 3, 3, 3, 3 ) );
+	__m128i t = _mm_add_epi16( _mm_add_epi16( _mm_mullo_epi16( src, alpha ), _mm_mullo_epi16( dst, _mm_sub_epi16( max, alpha ) ) ), round );
+	return _mm_srli_epi16( _mm_add_epi16( t, _mm_srli_epi16( t, 8 ) ), 8 );
+}
+
+static void BlendRowVector( const Uint32 *pSrc, int nWidth, Uint32 *pDst )
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i alphaMask = _mm_set1_epi32( (int)0xFF000000 );
+
+	int x = 0;
+	for ( ; x + 4 <= nWidth; x += 4 )
+	{
+		__m128i src = _mm_loadu_si128( (const __m128i *)( pSrc + x ) );
+
+		// Most of the overlay is usually transparent
+		if ( _mm_movemask_epi8( _mm_cmpeq_epi32( _mm_and_si128( src, alphaMask ), zero ) ) == 0xFFFF )
+		{
+			continue;
+		}
+
+		__m128i dst = _mm_loadu_si128( (const __m128i *)( pDst + x ) );
+		__m128i lo = BlendHalf( _mm_unpacklo_epi8( src, zero ), _mm_unpacklo_epi8( dst, zero ) );
+		__m128i hi = BlendHalf( _mm_unpackhi_epi8( src, zero ), _mm_unpackhi_epi8( dst, zero ) );
+		_mm_storeu_si128( (__m128i *)( pDst + x ), _mm_or_si128( _mm_packus_epi16( lo, hi ), alphaMask ) );
+	}
+	BlendRowScalar( pSrc, x, nWidth, pDst );
+}
+
+#elif defined( SDL_NEON_INTRINSICS )
+#define HAVE_VECTOR_COMPOSITE
+
+static inline uint8x8_t ConvertChannel( int32x4_t yLo, int32x4_t yHi, int16x8_t u, int16x8_t v, int nU, int nV )
+{
+	int32x4_t lo = vmlal_n_s16( vmlal_n_s16( yLo, vget_low_s16( u ), (int16_t)nU ), vget_low_s16( v ), (int16_t)nV );
+	int32x4_t hi = vmlal_n_s16( vmlal_n_s16( yHi, vget_high_s16( u ), (int16_t)nU ), vget_high_s16( v ), (int16_t)nV );
+	return vqmovun_s16( vcombine_s16( vqmovn_s32( vshrq_n_s32( lo, 8 ) ), vqmovn_s32( vshrq_n_s32( hi, 8 ) ) ) );
+}
+
+static void ConvertRowVector( const Uint8 *pY, const Uint8 *pU, const Uint8 *pV, int nChromaStep, int nWidth, Uint32 *pDst, const SYUVCoefficients &c )
+{
+	const int16x8_t yOffset = vdupq_n_s16( (int16_t)c.nYOffset );
+	const int16x4_t uvOffset = vdup_n_s16( 128 );
+	const int32x4_t round = vdupq_n_s32( 128 );
+
+	int x = 0;
+	for ( ; x + 8 <= nWidth; x += 8 )
+	{
+		int16x8_t y = vsubq_s16( vreinterpretq_s16_u16( vmovl_u8( vld1_u8( pY + x ) ) ), yOffset );
+
+		// Four chroma samples, each covering two pixels
+		uint8x8_t u8, v8;
+		if ( nChromaStep == 2 )
+		{
+			uint8x8x2_t uv = vuzp_u8( vld1_u8( pU + x ), vld1_u8( pU + x ) );
+			u8 = uv.val[ 0 ];
+			v8 = uv.val[ 1 ];
+		}
+		else
+		{
+			uint32_t unU, unV;
+			SDL_memcpy( &unU, pU + x / 2, sizeof( unU ) );
+			SDL_memcpy( &unV, pV + x / 2, sizeof( unV ) );
+			u8 = vreinterpret_u8_u32( vdup_n_u32( unU ) );
+			v8 = vreinterpret_u8_u32( vdup_n_u32( unV ) );
+		}
+		int16x4_t u4 = vsub_s16( vget_low_s16( vreinterpretq_s16_u16( vmovl_u8( u8 ) ) ), uvOffset );
+		int16x4_t v4 = vsub_s16( vget_low_s16( vreinterpretq_s16_u16( vmovl_u8( v8 ) ) ), uvOffset );
+		int16x4x2_t uDup = vzip_s16( u4, u4 );
+		int16x4x2_t vDup = vzip_s16( v4, v4 );
+		int16x8_t u = vcombine_s16( uDup.val[ 0 ], uDup.val[ 1 ] );
+		int16x8_t v = vcombine_s16( vDup.val[ 0 ], vDup.val[ 1 ] );
+
+		int32x4_t yLo = vmlaq_n_s32( round, vmovl_s16( vget_low_s16( y ) ), c.nY );
+		int32x4_t yHi = vmlaq_n_s32( round, vmovl_s16( vget_high_s16( y ) ), c.nY );
+
+		// Pixels are B, G, R, X in memory
+		uint8x8x4_t out;
+		out.val[ 0 ] = ConvertChannel( yLo, yHi, u, v, c.nBU, 0 );
+		out.val[ 1 ] = ConvertChannel( yLo, yHi, u, v, c.nGU, c.nGV );
+		out.val[ 2 ] = ConvertChannel( yLo, yHi, u, v, 0, c.nRV );
+		out.val[ 3 ] = vdup_n_u8( 0xFF );
+		vst4_u8( (Uint8 *)( pDst + x ), out );
+	}
+	ConvertRowScalar( pY, pU, pV, nChromaStep, x, nWidth, pDst, c );
+}
+
+static inline uint8x8_t BlendChannel( uint8x8_t src, uint8x8_t dst, uint8x8_t alpha, uint8x8_t inverse )
+{
+	uint16x8_t t = vaddq_u16( vmlal_u8( vmull_u8( src, alpha ), dst, inverse ), vdupq_n_u16( 128 ) );
+	return vshrn_n_u16( vaddq_u16( t, vshrq_n_u16( t, 8 ) ), 8 );
+}
+
+static void BlendRowVector( const Uint32 *pSrc, int nWidth, Uint32 *pDst )
+{
+	int x = 0;
+	for ( ; x + 8 <= nWidth; x += 8 )
+	{
+		uint8x8x4_t src = vld4_u8( (const Uint8 *)( pSrc + x ) );
+
+		// Most of the overlay is usually transparent
+		if ( vget_lane_u64( vreinterpret_u64_u8( src.val[ 3 ] ), 0 ) == 0 )
+		{
+			continue;
+		}
+
+		uint8x8x4_t dst = vld4_u8( (const Uint8 *)( pDst + x ) );
+		uint8x8_t inverse = vmvn_u8( src.val[ 3 ] );
+		dst.val[ 0 ] = BlendChannel( src.val[ 0 ], dst.val[ 0 ], src.val[ 3 ], inverse );
+		dst.val[ 1 ] = BlendChannel( src.val[ 1 ], dst.val[ 1 ], src.val[ 3 ], inverse );
+		dst.val[ 2 ] = BlendChannel( src.val[ 2 ], dst.val[ 2 ], src.val[ 3 ], inverse );
+		dst.val[ 3 ] = vdup_n_u8( 0xFF );
+		vst4_u8( (Uint8 *)( pDst + x ), dst );
+	}
+	BlendRowScalar( pSrc, x, nWidth, pDst );
+}
+
+#endif // SDL_NEON_INTRINSICS
+
+
+//--------------------------------------------------------------------------------------------------
+// Nearest neighbor horizontal scaling
+//--------------------------------------------------------------------------------------------------
+static void ScaleRow( const Uint32 *pSrc, int nSrcWidth, int nDstWidth, int nStart, int nEnd, Uint32 *pDst )
+{
+	Uint64 unStep = ( (Uint64)nSrcWidth << 16 ) / nDstWidth;
+	Uint64 unPos = unStep / 2 + unStep * nStart;
+	for ( int x = nStart; x < nEnd; ++x )
+	{
+		*pDst++ = pSrc[ unPos >> 16 ];
+		unPos += unStep;
+	}
+}
+
+static inline int ScaleCoordinate( int nDst, int nDstSize, int nSrcSize )
+{
+	return SDL_min( (int)( ( ( 2 * (Sint64)nDst + 1 ) * nSrcSize ) / ( 2 * (Sint64)nDstSize ) ), nSrcSize - 1 );
+}
+
+static void FillRow( Uint32 *pDst, int nWidth, Uint32 unColor )
+{
+	for ( int x = 0; x < nWidth; ++x )
+	{
+		pDst[ x ] = unColor;
+	}
+}
+
+
+//--------------------------------------------------------------------------------------------------
+// CVideoCompositor destructor
+//--------------------------------------------------------------------------------------------------
+CVideoCompositor::~CVideoCompositor()
+{
+	SDL_SetAtomicInt( &m_nQuit, 1 );
+	for ( int i = 0; i < m_nThreads; ++i )
+	{
+		SWorker *pWorker = &m_Workers[ i ];
+		if ( pWorker->pThread )
+		{
+			SDL_SignalSemaphore( pWorker->pStart );
+			SDL_WaitThread( pWorker->pThread, nullptr );
+		}
+		if ( pWorker->pStart )
+		{
+			SDL_DestroySemaphore( pWorker->pStart );
+		}
+		SDL_aligned_free( pWorker->pScratch );
+	}
+	if ( m_pDone )
+	{
+		SDL_DestroySemaphore( m_pDone );
+	}
+}
+
+
+//--------------------------------------------------------------------------------------------------
+// Start the worker threads
+//
+// The calling thread composites the first stripe, so one thread needs no workers at all.
+//--------------------------------------------------------------------------------------------------
+bool CVideoCompositor::BInit( int nThreads )
+{
+	if ( nThreads <= 0 )
+	{
+		nThreads = SDL_GetNumLogicalCPUCores();
+	}
+	nThreads = SDL_clamp( nThreads, 1, (int)k_nMaxThreads );
+
+	m_pDone = SDL_CreateSemaphore( 0 );
+	if ( !m_pDone )
+	{
+		return false;
+	}
+
+	for ( int i = 0; i < nThreads; ++i )
+	{
+		SWorker *pWorker = &m_Workers[ i ];
+		pWorker->pCompositor = this;
+		pWorker->iStripe = i;
+		++m_nThreads;
+
+		if ( i == 0 )
+		{
+			continue;
+		}
+
+		pWorker->pStart = SDL_CreateSemaphore( 0 );
+		if ( !pWorker->pStart )
+		{
+			return false;
+		}
+		pWorker->pThread = SDL_CreateThread( WorkerThread, "compositor", pWorker );
+		if ( !pWorker->pThread )
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+
+//--------------------------------------------------------------------------------------------------
+// Composite stripes as they are handed out
+//--------------------------------------------------------------------------------------------------
+int SDLCALL CVideoCompositor::WorkerThread( void *pData )
+{
+	SWorker *pWorker = (SWorker *)pData;
+	CVideoCompositor *pCompositor = pWorker->pCompositor;
+
+	for ( ;; )
+	{
+		SDL_WaitSemaphore( pWorker->pStart );
+		if ( SDL_GetAtomicInt( &pCompositor->m_nQuit ) )
+		{
+			break;
+		}
+		pCompositor->CompositeStripe( pWorker );
+		SDL_SignalSemaphore( pCompositor->m_pDone );
+	}
+	return 0;
+}
+
+
+//--------------------------------------------------------------------------------------------------
+// Composite a frame
+//--------------------------------------------------------------------------------------------------
+void CVideoCompositor::Composite( const SVideoImage *pVideo, const SDL_Rect &videoRect, const SDL_Surface *pOverlay, const SDL_Rect &overlayRect, SDL_Surface *pDest )
+{
+	m_pVideo = ( pVideo && videoRect.w > 0 && videoRect.h > 0 ) ? pVideo : nullptr;
+	m_VideoRect = videoRect;
+	m_pOverlay = ( pOverlay && overlayRect.w > 0 && overlayRect.h > 0 ) ? pOverlay : nullptr;
+	m_OverlayRect = overlayRect;
+	m_pDest = pDest;
+
+	for ( int i = 1; i < m_nThreads; ++i )
+	{
+		SDL_SignalSemaphore( m_Workers[ i ].pStart );
+	}
+	CompositeStripe( &m_Workers[ 0 ] );
+	for ( int i = 1; i < m_nThreads; ++i )
+	{
+		SDL_WaitSemaphore( m_pDone );
+	}
+}
+
+
+//--------------------------------------------------------------------------------------------------
+// Make sure a worker has room to convert and scale rows
+//--------------------------------------------------------------------------------------------------
+bool CVideoCompositor::BReserveScratch( SWorker *pWorker, int nPixels )
+{
+	if ( nPixels <= pWorker->nScratch )
+	{
+		return true;
+	}
+
+	SDL_aligned_free( pWorker->pScratch );
+	pWorker->pScratch = (Uint32 *)SDL_aligned_alloc( SDL_GetCPUCacheLineSize(), nPixels * sizeof( Uint32 ) );
+	pWorker->nScratch = pWorker->pScratch ? nPixels : 0;
+	return pWorker->pScratch != nullptr;
+}
+
+
+//--------------------------------------------------------------------------------------------------
+// Composite one stripe of rows
+//
+// Rows of video that are scaled horizontally are converted at their native width into scratch
+// memory first, which is reused when consecutive output rows come from the same source row.
+//--------------------------------------------------------------------------------------------------
+void CVideoCompositor::CompositeStripe( SWorker *pWorker )
+{
+	SDL_Surface *pDest = m_pDest;
+	const SVideoImage *pVideo = m_pVideo;
+	const SDL_Surface *pOverlay = m_pOverlay;
+	const SDL_Rect &videoRect = m_VideoRect;
+	const SDL_Rect &overlayRect = m_OverlayRect;
+	int nDestWidth = pDest->w;
+
+	// Stripes start on even rows so each one is made of whole chroma rows
+	int nRowStart = ( ( pDest->h * pWorker->iStripe ) / m_nThreads ) & ~1;
+	int nRowEnd = ( pWorker->iStripe == m_nThreads - 1 ) ? pDest->h : ( ( pDest->h * ( pWorker->iStripe + 1 ) ) / m_nThreads ) & ~1;
+
+	int nVideoWidth = pVideo ? pVideo->nWidth : 0;
+	if ( !BReserveScratch( pWorker, nVideoWidth + nDestWidth ) )
+	{
+		return;
+	}
+	Uint32 *pVideoRow = pWorker->pScratch;
+	Uint32 *pOverlayRow = pWorker->pScratch + nVideoWidth;
+	int nConvertedRow = -1;
+
+	void ( *pfnConvertRow )( const Uint8 *, const Uint8 *, const Uint8 *, int, int, Uint32 *, const SYUVCoefficients & ) = ConvertRowScalar;
+	void ( *pfnBlendRow )( const Uint32 *, int, Uint32 * ) = BlendRowScalar;
+#ifdef HAVE_VECTOR_COMPOSITE
+	if ( !m_bScalar )
+	{
+		pfnConvertRow = ConvertRowVector;
+		pfnBlendRow = BlendRowVector;
+	}
+#endif
+
+	// The part of each row covered by the video and overlay
+	int nVideoStart = 0, nVideoEnd = 0;
+	const SYUVCoefficients *pCoefficients = nullptr;
+	if ( pVideo )
+	{
+		nVideoStart = SDL_clamp( videoRect.x, 0, nDestWidth );
+		nVideoEnd = SDL_clamp( videoRect.x + videoRect.w, 0, nDestWidth );
+		pCoefficients = &s_Coefficients[ pVideo->bBT709 ][ pVideo->bFullRange ];
+	}
+	bool bVideoScaled = pVideo && ( videoRect.w != pVideo->nWidth || nVideoStart != videoRect.x );
+	int nOverlayStart = 0, nOverlayEnd = 0;
+	if ( pOverlay )
+	{
+		nOverlayStart = SDL_clamp( overlayRect.x, 0, nDestWidth );
+		nOverlayEnd = SDL_clamp( overlayRect.x + overlayRect.w, 0, nDestWidth );
+	}
+	bool bOverlayScaled = pOverlay && ( overlayRect.w != pOverlay->w || nOverlayStart != overlayRect.x );
+
+	for ( int y = nRowStart; y < nRowEnd; ++y )
+	{
+		Uint32 *pRow = (Uint32 *)( (Uint8 *)pDest->pixels + y * pDest->pitch );
+
+		if ( !pVideo || y < videoRect.y || y >= videoRect.y + videoRect.h || nVideoStart >= nVideoEnd )
+		{
+			FillRow( pRow, nDestWidth, 0xFF000000 );
+		}
+		else
+		{
+			FillRow( pRow, nVideoStart, 0xFF000000 );
+			FillRow( pRow + nVideoEnd, nDestWidth - nVideoEnd, 0xFF000000 );
+
+			int nSrcRow = ScaleCoordinate( y - videoRect.y, videoRect.h, pVideo->nHeight );
+			const Uint8 *pY = pVideo->pPlanes[ 0 ] + nSrcRow * pVideo->nPitches[ 0 ];
+			const Uint8 *pU, *pV;
+			int nChromaStep;
+			if ( pVideo->eFormat == SVideoImage::k_EFormatNV12 )
+			{
+				pU = pVideo->pPlanes[ 1 ] + ( nSrcRow / 2 ) * pVideo->nPitches[ 1 ];
+				pV = pU + 1;
+				nChromaStep = 2;
+			}
+			else
+			{
+				pU = pVideo->pPlanes[ 1 ] + ( nSrcRow / 2 ) * pVideo->nPitches[ 1 ];
+				pV = pVideo->pPlanes[ 2 ] + ( nSrcRow / 2 ) * pVideo->nPitches[ 2 ];
+				nChromaStep = 1;
+			}
+
+			if ( bVideoScaled )
+			{
+				if ( nSrcRow != nConvertedRow )
+				{
+					pfnConvertRow( pY, pU, pV, nChromaStep, pVideo->nWidth, pVideoRow, *pCoefficients );
+					nConvertedRow = nSrcRow;
+				}
+				ScaleRow( pVideoRow, pVideo->nWidth, videoRect.w, nVideoStart - videoRect.x, nVideoEnd - videoRect.x, pRow + nVideoStart );
+			}
+			else
+			{
+				pfnConvertRow( pY, pU, pV, nChromaStep, nVideoEnd - nVideoStart, pRow + nVideoStart, *pCoefficients );
+			}
+		}
+
+		if ( pOverlay && y >= overlayRect.y && y < overlayRect.y + overlayRect.h && nOverlayStart < nOverlayEnd )
+		{
+			int nSrcRow = ScaleCoordinate( y - overlayRect.y, overlayRect.h, pOverlay->h );
+			const Uint32 *pSrc = (const Uint32 *)( (const Uint8 *)pOverlay->pixels + nSrcRow * pOverlay->pitch );
+			if ( bOverlayScaled )
+			{
+				ScaleRow( pSrc, pOverlay->w, overlayRect.w, nOverlayStart - overlayRect.x, nOverlayEnd - overlayRect.x, pOverlayRow );
+				pSrc = pOverlayRow;
+			}
+			pfnBlendRow( pSrc, nOverlayEnd - nOverlayStart, pRow + nOverlayStart );
+		}
+	}
+}
+
+
+//--------------------------------------------------------------------------------------------------
+// Describe a software frame
+//--------------------------------------------------------------------------------------------------
+bool CVideoCompositor::BGetVideoImage( const AVFrame *pFrame, SVideoImage *pImage )
+{
+	switch ( pFrame->format )
+	{
+	case AV_PIX_FMT_NV12:
+		pImage->eFormat = SVideoImage::k_EFormatNV12;
+		break;
+	case AV_PIX_FMT_YUV420P:
+	case AV_PIX_FMT_YUVJ420P:
+		pImage->eFormat = SVideoImage::k_EFormatI420;
+		break;
+	default:
+		return false;
+	}
+
+	for ( int i = 0; i < 3; ++i )
+	{
+		pImage->pPlanes[ i ] = pFrame->data[ i ];
+		pImage->nPitches[ i ] = pFrame->linesize[ i ];
+	}
+	SetVideoImageFrame( pFrame, pImage );
+	return true;
+}
+
+
+//--------------------------------------------------------------------------------------------------
+// Apply a frame's size, cropping and colorspace
+//--------------------------------------------------------------------------------------------------
+void CVideoCompositor::SetVideoImageFrame( const AVFrame *pFrame, SVideoImage *pImage )
+{
+	// Chroma is shared by pairs of pixels, so crop to even offsets
+	int nCropLeft = (int)pFrame->crop_left & ~1;
+	int nCropTop = (int)pFrame->crop_top & ~1;
+	pImage->nWidth = pFrame->width - (int)( pFrame->crop_left + pFrame->crop_right );
+	pImage->nHeight = pFrame->height - (int)( pFrame->crop_top + pFrame->crop_bottom );
+	pImage->pPlanes[ 0 ] += nCropTop * pImage->nPitches[ 0 ] + nCropLeft;
+	if ( pImage->eFormat == SVideoImage::k_EFormatNV12 )
+	{
+		pImage->pPlanes[ 1 ] += ( nCropTop / 2 ) * pImage->nPitches[ 1 ] + nCropLeft;
+		pImage->pPlanes[ 2 ] = nullptr;
+		pImage->nPitches[ 2 ] = 0;
+	}
+	else
+	{
+		for ( int i = 1; i < 3; ++i )
+		{
+			pImage->pPlanes[ i ] += ( nCropTop / 2 ) * pImage->nPitches[ i ] + nCropLeft / 2;
+		}
+	}
+
+	// Assume HD content is BT.709 if it isn't tagged
+	pImage->bBT709 = ( pFrame->colorspace == AVCOL_SPC_BT709 ) ||
+	                 ( pFrame->colorspace == AVCOL_SPC_UNSPECIFIED && pImage->nHeight > 576 );
+	pImage->bFullRange = ( pFrame->color_range == AVCOL_RANGE_JPEG ) || ( pFrame->format == AV_PIX_FMT_YUVJ420P );
+}
+
+
+//--------------------------------------------------------------------------------------------------
+// Measure compositing throughput
+//
+// The video fills the frame and the overlay is a 1280x256 strip along the bottom, scaled to the
+// frame width like main.cpp does. Each configuration is checked against the scalar kernels.
+//--------------------------------------------------------------------------------------------------
+bool CVideoCompositor::BBenchmark()
+{
+	static const struct
+	{
+		const char *pszName;
+		int nWidth;
+		int nHeight;
+		int nIterations;
+	}
+	s_Sizes[] =
+	{
+		{ "1080p", 1920, 1080, 60 },
+		{ "4K", 3840, 2160, 20 },
+	};
+	bool bResult = true;
+
+	CVideoCompositor reference;
+	CVideoCompositor single;
+	CVideoCompositor threaded;
+	if ( !reference.BInit( 1 ) || !single.BInit( 1 ) || !threaded.BInit( 0 ) )
+	{
+		SDL_Log( "Couldn't start compositor threads: %s\n", SDL_GetError() );
+		return false;
+	}
+	reference.SetScalar( true );
+
+	SDL_Surface *pOverlay = SDL_CreateSurface( 1280, 256, SDL_PIXELFORMAT_ARGB8888 );
+	if ( !pOverlay )
+	{
+		return false;
+	}
+	for ( int y = 0; y < pOverlay->h; ++y )
+	{
+		Uint32 *pRow = (Uint32 *)( (Uint8 *)pOverlay->pixels + y * pOverlay->pitch );
+		for ( int x = 0; x < pOverlay->w; ++x )
+		{
+			// Mostly transparent, with translucent and opaque text-like blocks
+			Uint32 unAlpha = ( ( x / 32 + y / 16 ) % 4 == 0 ) ? ( ( x / 8 ) % 2 ? 0xFF : 0x80 ) : 0;
+			pRow[ x ] = ( unAlpha << 24 ) | ( (Uint32)SDL_rand( 0x1000000 ) );
+		}
+	}
+
+#if defined( SDL_SSE2_INTRINSICS )
+	SDL_Log( "Compositor benchmark, SSE2 kernels, %d threads\n", threaded.GetThreadCount() );
+#elif defined( SDL_NEON_INTRINSICS )
+	SDL_Log( "Compositor benchmark, NEON kernels, %d threads\n", threaded.GetThreadCount() );
+#else
+	SDL_Log( "Compositor benchmark, scalar kernels, %d threads\n", threaded.GetThreadCount() );
+#endif
+	SDL_Log( "%-6s %-8s %12s %12s %12s %8s", "size", "video", "scalar ms", "kernel ms", "threaded ms", "fps" );
+
+	for ( int iSize = 0; iSize < (int)SDL_arraysize( s_Sizes ) && bResult; ++iSize )
+	{
+		int nWidth = s_Sizes[ iSize ].nWidth;
+		int nHeight = s_Sizes[ iSize ].nHeight;
+		int nIterations = s_Sizes[ iSize ].nIterations;
+
+		Uint8 *pPixels = (Uint8 *)SDL_malloc( (size_t)nWidth * nHeight * 3 / 2 );
+		SDL_Surface *pExpected = SDL_CreateSurface( nWidth, nHeight, SDL_PIXELFORMAT_XRGB8888 );
+		SDL_Surface *pActual = SDL_CreateSurface( nWidth, nHeight, SDL_PIXELFORMAT_XRGB8888 );
+		if ( !pPixels || !pExpected || !pActual )
+		{
+			SDL_free( pPixels );
+			SDL_DestroySurface( pExpected );
+			SDL_DestroySurface( pActual );
+			bResult = false;
+			break;
+		}
+		for ( int i = 0; i < nWidth * nHeight * 3 / 2; ++i )
+		{
+			pPixels[ i ] = (Uint8)SDL_rand( 256 );
+		}
+
+		SVideoImage video;
+		video.eFormat = SVideoImage::k_EFormatNV12;
+		video.nWidth = nWidth;
+		video.nHeight = nHeight;
+		video.pPlanes[ 0 ] = pPixels;
+		video.nPitches[ 0 ] = nWidth;
+		video.pPlanes[ 1 ] = pPixels + nWidth * nHeight;
+		video.nPitches[ 1 ] = nWidth;
+		video.pPlanes[ 2 ] = nullptr;
+		video.nPitches[ 2 ] = 0;
+		video.bBT709 = true;
+		video.bFullRange = false;
+
+		SDL_Rect overlayRect;
+		overlayRect.w = nWidth;
+		overlayRect.h = ( nWidth * pOverlay->h ) / pOverlay->w;
+		overlayRect.x = 0;
+		overlayRect.y = nHeight - overlayRect.h;
+
+		// Video at its native size, and 4:3 video scaled and pillarboxed
+		static const char *s_VideoNames[] = { "native", "scaled" };
+		for ( int iVideo = 0; iVideo < (int)SDL_arraysize( s_VideoNames ); ++iVideo )
+		{
+			SDL_Rect videoRect = { 0, 0, nWidth, nHeight };
+			if ( iVideo == 1 )
+			{
+				videoRect.w = ( nHeight * 4 ) / 3;
+				videoRect.x = ( nWidth - videoRect.w ) / 2;
+			}
+
+			reference.Composite( &video, videoRect, pOverlay, overlayRect, pExpected );
+			single.Composite( &video, videoRect, pOverlay, overlayRect, pActual );
+			bool bMatch = ( SDL_memcmp( pExpected->pixels, pActual->pixels, (size_t)pExpected->pitch * nHeight ) == 0 );
+			SDL_memset( pActual->pixels, 0, (size_t)pActual->pitch * nHeight );
+			threaded.Composite( &video, videoRect, pOverlay, overlayRect, pActual );
+			bMatch = bMatch && ( SDL_memcmp( pExpected->pixels, pActual->pixels, (size_t)pExpected->pitch * nHeight ) == 0 );
+			if ( !bMatch )
+			{
+				SDL_Log( "Compositor mismatch: %s, %s video\n", s_Sizes[ iSize ].pszName, s_VideoNames[ iVideo ] );
+				bResult = false;
+				continue;
+			}
+
+			CVideoCompositor *pCompositors[] = { &reference, &single, &threaded };
+			Uint64 unTimes[ SDL_arraysize( pCompositors ) ];
+			for ( int i = 0; i < (int)SDL_arraysize( pCompositors ); ++i )
+			{
+				Uint64 unStart = SDL_GetTicksNS();
+				for ( int n = 0; n < nIterations; ++n )
+				{
+					pCompositors[ i ]->Composite( &video, videoRect, pOverlay, overlayRect, pActual );
+				}
+				unTimes[ i ] = SDL_max( ( SDL_GetTicksNS() - unStart ) / nIterations, 1 );
+			}
+
+			SDL_Log( "%-6s %-8s %12.2f %12.2f %12.2f %8.1f",
+			         s_Sizes[ iSize ].pszName, s_VideoNames[ iVideo ],
+			         unTimes[ 0 ] / 1000000.0, unTimes[ 1 ] / 1000000.0, unTimes[ 2 ] / 1000000.0,
+			         (double)SDL_NS_PER_SECOND / unTimes[ 2 ] );
+		}
+
+		SDL_free( pPixels );
+		SDL_DestroySurface( pExpected );
+		SDL_DestroySurface( pActual );
+	}
+
+	SDL_DestroySurface( pOverlay );
+	return bResult;
+}
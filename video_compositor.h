@@ -0,0 +1,113 @@
+/*
+  Copyright (C) 2024 Sam Lantinga <slouken@libsdl.org>
+
+  This software is provided 'as-is', without any express or implied
+  warranty.  In no event will the authors be held liable for any damages
+  arising from the use of this software.
+
+  Permission is granted to anyone to use this software for any purpose,
+  including commercial applications, and to alter it and redistribute it
+  freely.
+*/
+#ifndef VIDEO_COMPOSITOR_H
+#define VIDEO_COMPOSITOR_H
+
+#include <SDL3/SDL.h>
+
+
+//--------------------------------------------------------------------------------------------------
+// Forward declarations
+//--------------------------------------------------------------------------------------------------
+struct AVFrame;
+
+
+//--------------------------------------------------------------------------------------------------
+// A decoded 4:2:0 video frame in CPU memory
+//--------------------------------------------------------------------------------------------------
+struct SVideoImage
+{
+	enum EFormat
+	{
+		k_EFormatNV12,		// Y plane followed by interleaved UV
+		k_EFormatI420		// Y, U and V planes
+	};
+
+	EFormat eFormat;
+	int nWidth;
+	int nHeight;
+	const Uint8 *pPlanes[ 3 ];
+	int nPitches[ 3 ];
+	bool bBT709;
+	bool bFullRange;
+};
+
+
+//--------------------------------------------------------------------------------------------------
+// Software compositor for displays without a usable overlay plane or GPU
+//
+// Converts the video to XRGB8888, scaled to its rect, and blends the ARGB8888 overlay on top. The
+// output is split into stripes of rows that are composited in parallel, with SSE2 or NEON kernels
+// for the conversion and blending.
+//--------------------------------------------------------------------------------------------------
+class CVideoCompositor
+{
+public:
+	CVideoCompositor() { }
+	~CVideoCompositor();
+
+	// Start the worker threads, 0 uses one thread per core
+	bool BInit( int nThreads );
+
+	int GetThreadCount() const { return m_nThreads; }
+
+	// Use the scalar kernels, for comparison
+	void SetScalar( bool bScalar ) { m_bScalar = bScalar; }
+
+	// Composite a frame into pDest, which must be XRGB8888. pVideo and pOverlay may be null.
+	void Composite( const SVideoImage *pVideo, const SDL_Rect &videoRect, const SDL_Surface *pOverlay, const SDL_Rect &overlayRect, SDL_Surface *pDest );
+
+	// Describe a software frame, returns false if its format isn't supported
+	static bool BGetVideoImage( const AVFrame *pFrame, SVideoImage *pImage );
+
+	// Apply a frame's size, cropping and colorspace to an image whose format and uncropped planes
+	// have been set
+	static void SetVideoImageFrame( const AVFrame *pFrame, SVideoImage *pImage );
+
+	// Measure compositing throughput at 1080p and 4K and log the results
+	static bool BBenchmark();
+
+private:
+	enum
+	{
+		k_nMaxThreads = 8
+	};
+
+	struct SWorker
+	{
+		CVideoCompositor *pCompositor;
+		SDL_Thread *pThread;
+		SDL_Semaphore *pStart;
+		int iStripe;
+		Uint32 *pScratch;
+		int nScratch;
+	};
+
+	static int SDLCALL WorkerThread( void *pData );
+	void CompositeStripe( SWorker *pWorker );
+	bool BReserveScratch( SWorker *pWorker, int nPixels );
+
+	int m_nThreads = 0;
+	SWorker m_Workers[ k_nMaxThreads ] = { };
+	SDL_Semaphore *m_pDone = nullptr;
+	SDL_AtomicInt m_nQuit = { 0 };
+	bool m_bScalar = false;
+
+	// The frame being composited
+	const SVideoImage *m_pVideo = nullptr;
+	SDL_Rect m_VideoRect = { 0, 0, 0, 0 };
+	const SDL_Surface *m_pOverlay = nullptr;
+	SDL_Rect m_OverlayRect = { 0, 0, 0, 0 };
+	SDL_Surface *m_pDest = nullptr;
+};
+
+#endif // VIDEO_COMPOSITOR_H
@@ -0,0 +1,297 @@
+/*
+  Copyright (C) 2024 Sam Lantinga <slouken@libsdl.org>
+
+  This software is provided 'as-is', without any express or implied
+  warranty.  In no event will the authors be held liable for any damages
+  arising from the use of this software.
+
+  Permission is granted to anyone to use this software for any purpose,
+  including commercial applications, and to alter it and redistribute it
+  freely.
+*/
+#include "video_decoder.h"
+
+
+//--------------------------------------------------------------------------------------------------
+// Decoders to try for each codec, in order of preference
+//
+// The default decoder for the codec is added after these. On the Raspberry Pi the default HEVC
+// decoder uses the V4L2 request API and outputs DRM_PRIME frames, so it ranks as hardware.
+//--------------------------------------------------------------------------------------------------
+static const struct
+{
+	AVCodecID eCodecID;
+	const char *pszName;
+} s_Decoders[] =
+{
+	{ AV_CODEC_ID_HEVC,	"hevc_v4l2m2m" },
+	{ AV_CODEC_ID_HEVC,	"hevc" },
+	{ AV_CODEC_ID_VP9,	"vp9_v4l2m2m" },
+	{ AV_CODEC_ID_AV1,	"av1_v4l2m2m" },
+	{ AV_CODEC_ID_AV1,	"libdav1d" },
+	{ AV_CODEC_ID_H264,	"h264_v4l2m2m" },
+};
+
+enum EOpenResult
+{
+	k_EOpenResultUnknown,
+	k_EOpenResultOpened,
+	k_EOpenResultFailed
+};
+
+static const char *s_OpenResultNames[] =
+{
+	"unknown",
+	"opened",
+	"failed",
+};
+
+struct SDecoderProbe
+{
+	char szName[ 64 ];
+	bool bDRMPrime;
+	EOpenResult eOpenResult;
+};
+
+static SDecoderProbe s_Probes[ 32 ];
+static int s_nProbes;
+static bool s_bProbesChanged;
+
+
+//--------------------------------------------------------------------------------------------------
+// Return what we know about a decoder, adding it if needed
+//--------------------------------------------------------------------------------------------------
+static SDecoderProbe *FindProbe( const char *pszName, bool bCreate )
+{
+	for ( int i = 0; i < s_nProbes; ++i )
+	{
+		if ( SDL_strcmp( s_Probes[ i ].szName, pszName ) == 0 )
+		{
+			return &s_Probes[ i ];
+		}
+	}
+
+	if ( !bCreate || s_nProbes == (int)SDL_arraysize( s_Probes ) )
+	{
+		return nullptr;
+	}
+
+	SDecoderProbe *pProbe = &s_Probes[ s_nProbes++ ];
+	SDL_strlcpy( pProbe->szName, pszName, sizeof( pProbe->szName ) );
+	pProbe->bDRMPrime = false;
+	pProbe->eOpenResult = k_EOpenResultUnknown;
+	return pProbe;
+}
+
+
+//--------------------------------------------------------------------------------------------------
+// Return what we know about a decoder, probing it the first time
+//--------------------------------------------------------------------------------------------------
+static SDecoderProbe *GetProbe( const AVCodec *pDecoder )
+{
+	SDecoderProbe *pProbe = FindProbe( pDecoder->name, false );
+	if ( pProbe )
+	{
+		return pProbe;
+	}
+
+	pProbe = FindProbe( pDecoder->name, true );
+	if ( !pProbe )
+	{
+		return nullptr;
+	}
+
+	int iHWConfig = 0;
+	const AVCodecHWConfig *pHWConfig;
+	while ( ( pHWConfig = avcodec_get_hw_config( pDecoder, iHWConfig++ ) ) != nullptr )
+	{
+		if ( pHWConfig->pix_fmt == AV_PIX_FMT_DRM_PRIME )
+		{
+			pProbe->bDRMPrime = true;
+			break;
+		}
+	}
+	s_bProbesChanged = true;
+
+	return pProbe;
+}
+
+
+//--------------------------------------------------------------------------------------------------
+// Load and save the probe results
+//
+// The first line holds the libavcodec version, the cache is ignored if ffmpeg has changed since
+// it was written. Each following line is a decoder name, whether it supports DRM_PRIME and
+// whether it could be opened last time. The open result is only reported, it doesn't change the
+// order decoders are tried in.
+//--------------------------------------------------------------------------------------------------
+bool LoadVideoDecoderCache( const char *pszFile )
+{
+	char *pszData = (char *)SDL_LoadFile( pszFile, nullptr );
+	if ( !pszData )
+	{
+		return false;
+	}
+
+	bool bValid = false;
+	char *pszState = nullptr;
+	for ( char *pszLine = SDL_strtok_r( pszData, "\n", &pszState ); pszLine; pszLine = SDL_strtok_r( nullptr, "\n", &pszState ) )
+	{
+		if ( !bValid )
+		{
+			unsigned int unVersion;
+			if ( SDL_sscanf( pszLine, "avcodec %u", &unVersion ) != 1 || unVersion != avcodec_version() )
+			{
+				break;
+			}
+			bValid = true;
+			continue;
+		}
+
+		char szName[ 64 ];
+		int nDRMPrime;
+		char szOpenResult[ 16 ];
+		if ( SDL_sscanf( pszLine, "%63s %d %15s", szName, &nDRMPrime, szOpenResult ) != 3 )
+		{
+			continue;
+		}
+
+		SDecoderProbe *pProbe = FindProbe( szName, true );
+		if ( !pProbe )
+		{
+			break;
+		}
+		pProbe->bDRMPrime = ( nDRMPrime != 0 );
+		for ( int i = 0; i < (int)SDL_arraysize( s_OpenResultNames ); ++i )
+		{
+			if ( SDL_strcmp( szOpenResult, s_OpenResultNames[ i ] ) == 0 )
+			{
+				pProbe->eOpenResult = (EOpenResult)i;
+			}
+		}
+	}
+	SDL_free( pszData );
+
+	s_bProbesChanged = false;
+	return bValid;
+}
+
+bool SaveVideoDecoderCache( const char *pszFile )
+{
+	if ( !s_bProbesChanged )
+	{
+		return true;
+	}
+
+	SDL_IOStream *pIO = SDL_IOFromFile( pszFile, "w" );
+	if ( !pIO )
+	{
+		return false;
+	}
+
+	SDL_IOprintf( pIO, "avcodec %u\n", avcodec_version() );
+	for ( int i = 0; i < s_nProbes; ++i )
+	{
+		const SDecoderProbe *pProbe = &s_Probes[ i ];
+		SDL_IOprintf( pIO, "%s %d %s\n", pProbe->szName, pProbe->bDRMPrime ? 1 : 0, s_OpenResultNames[ pProbe->eOpenResult ] );
+	}
+
+	if ( !SDL_CloseIO( pIO ) )
+	{
+		return false;
+	}
+	s_bProbesChanged = false;
+	return true;
+}
+
+
+//--------------------------------------------------------------------------------------------------
+// Return the decoders to try for a codec, best first
+//--------------------------------------------------------------------------------------------------
+int GetVideoDecoders( AVCodecID eCodecID, const AVCodec *pDefaultDecoder, const AVCodec **ppDecoders, int nMaxDecoders )
+{
+	const AVCodec *pCandidates[ SDL_arraysize( s_Decoders ) + 2 ];
+	int nCandidates = 0;
+
+	for ( int i = 0; i < (int)SDL_arraysize( s_Decoders ); ++i )
+	{
+		if ( s_Decoders[ i ].eCodecID == eCodecID )
+		{
+			pCandidates[ nCandidates++ ] = avcodec_find_decoder_by_name( s_Decoders[ i ].pszName );
+		}
+	}
+	pCandidates[ nCandidates++ ] = pDefaultDecoder;
+	pCandidates[ nCandidates++ ] = avcodec_find_decoder( eCodecID );
+
+	// Hardware decoders first, then software. A decoder that failed to open before keeps its place,
+	// the failure may have been caused by the stream or by the device being busy, and demoting it
+	// would quietly leave us decoding in software from then on.
+	int nDecoders = 0;
+	for ( int iRank = 0; iRank < 2; ++iRank )
+	{
+		for ( int i = 0; i < nCandidates && nDecoders < nMaxDecoders; ++i )
+		{
+			const AVCodec *pDecoder = pCandidates[ i ];
+			if ( !pDecoder || pDecoder->id != eCodecID )
+			{
+				continue;
+			}
+
+			bool bDuplicate = false;
+			for ( int j = 0; j < i; ++j )
+			{
+				if ( pCandidates[ j ] == pDecoder )
+				{
+					bDuplicate = true;
+					break;
+				}
+			}
+			if ( bDuplicate )
+			{
+				continue;
+			}
+
+			const SDecoderProbe *pProbe = GetProbe( pDecoder );
+			int iDecoderRank = ( pProbe && pProbe->bDRMPrime ) ? 0 : 1;
+			if ( iDecoderRank == iRank )
+			{
+				if ( pProbe && pProbe->eOpenResult == k_EOpenResultFailed )
+				{
+					SDL_Log( "Decoder %s failed to open last time, trying it again\n", pDecoder->name );
+				}
+				ppDecoders[ nDecoders++ ] = pDecoder;
+			}
+		}
+	}
+	return nDecoders;
+}
+
+
+//--------------------------------------------------------------------------------------------------
+// Return whether a decoder can output DRM_PRIME frames
+//--------------------------------------------------------------------------------------------------
+bool BVideoDecoderSupportsDRMPrime( const AVCodec *pDecoder )
+{
+	const SDecoderProbe *pProbe = GetProbe( pDecoder );
+	return pProbe && pProbe->bDRMPrime;
+}
+
+
+//--------------------------------------------------------------------------------------------------
+// Remember whether a decoder could be opened
+//--------------------------------------------------------------------------------------------------
+void SetVideoDecoderOpened( const AVCodec *pDecoder, bool bOpened )
+{
+	SDecoderProbe *pProbe = GetProbe( pDecoder );
+	if ( !pProbe )
+	{
+		return;
+	}
+
+	EOpenResult eOpenResult = bOpened ? k_EOpenResultOpened : k_EOpenResultFailed;
+	if ( pProbe->eOpenResult != eOpenResult )
+	{
+		pProbe->eOpenResult = eOpenResult;
+		s_bProbesChanged = true;
+	}
+}
@@ -0,0 +1,43 @@
+/*
+  Copyright (C) 2024 Sam Lantinga <slouken@libsdl.org>
+
+  This software is provided 'as-is', without any express or implied
+  warranty.  In no event will the authors be held liable for any damages
+  arising from the use of this software.
+
+  Permission is granted to anyone to use this software for any purpose,
+  including commercial applications, and to alter it and redistribute it
+  freely.
+*/
+#ifndef VIDEO_DECODER_H
+#define VIDEO_DECODER_H
+
+#include <SDL3/SDL.h>
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+}
+
+//--------------------------------------------------------------------------------------------------
+// Ranked video decoder selection
+//
+// Each codec has a table of decoders to try, hardware decoders that output DRM_PRIME frames come
+// first and the default ffmpeg decoder is always the last resort. What we learn about a decoder,
+// whether it can output DRM_PRIME frames and whether it could be opened, is remembered and can be
+// saved to a cache file so later runs don't repeat the probing. Decoders that failed to open keep
+// their place in the list and are retried, a failure is only logged. These should only be called
+// from the main thread.
+//--------------------------------------------------------------------------------------------------
+extern bool LoadVideoDecoderCache( const char *pszFile );
+extern bool SaveVideoDecoderCache( const char *pszFile );
+
+// Fill in the decoders to try for a codec, best first, and return how many there are
+extern int GetVideoDecoders( AVCodecID eCodecID, const AVCodec *pDefaultDecoder, const AVCodec **ppDecoders, int nMaxDecoders );
+
+// Return whether a decoder can output DRM_PRIME frames, probing it the first time
+extern bool BVideoDecoderSupportsDRMPrime( const AVCodec *pDecoder );
+
+// Record whether avcodec_open2() succeeded for a decoder, this is reported but not used for ranking
+extern void SetVideoDecoderOpened( const AVCodec *pDecoder, bool bOpened );
+
+#endif // VIDEO_DECODER_H
@@ -12,18 +12,124 @@
 #include "video_display.h"
 #include "video_display_drm.h"
 #include "video_display_egl.h"
+#include "video_display_null.h"
 #include "video_display_wayland.h"
 
 
+//--------------------------------------------------------------------------------------------------
+// Return the ID for a frame being displayed
+//--------------------------------------------------------------------------------------------------
+Uint32 CVideoDisplay::NextDisplayFrameID()
+{
+	if ( ++m_unLastFrameID == 0 )
+	{
+		++m_unLastFrameID;
+	}
+	return m_unLastFrameID;
+}
+
+
+//--------------------------------------------------------------------------------------------------
+// Reference and release video frames
+//--------------------------------------------------------------------------------------------------
+AVFrame *CVideoDisplay::CloneFrame( const AVFrame *pFrame )
+{
+	if ( m_pFramePool )
+	{
+		return m_pFramePool->Clone( pFrame );
+	}
+	return av_frame_clone( pFrame );
+}
+
+void CVideoDisplay::FreeFrame( AVFrame **ppFrame )
+{
+	if ( m_pFramePool )
+	{
+		m_pFramePool->Free( ppFrame );
+	}
+	else
+	{
+		av_frame_free( ppFrame );
+	}
+}
+
+
+//--------------------------------------------------------------------------------------------------
+// Record that a frame was scanned out
+//
+// If nobody is reading the scanout times, the oldest ones are dropped.
+//--------------------------------------------------------------------------------------------------
+void CVideoDisplay::AddScanout( Uint32 unFrameID, Uint64 unScanoutNS )
+{
+	SDL_LockSpinlock( &m_ScanoutLock );
+	if ( m_nScanouts == k_nMaxScanouts )
+	{
+		m_iFirstScanout = ( m_iFirstScanout + 1 ) % k_nMaxScanouts;
+		--m_nScanouts;
+	}
+	SScanout *pScanout = &m_Scanouts[ ( m_iFirstScanout + m_nScanouts ) % k_nMaxScanouts ];
+	pScanout->unFrameID = unFrameID;
+	pScanout->unScanoutNS = unScanoutNS;
+	++m_nScanouts;
+	SDL_UnlockSpinlock( &m_ScanoutLock );
+}
+
+
+//--------------------------------------------------------------------------------------------------
+// Return the next frame that has been scanned out
+//--------------------------------------------------------------------------------------------------
+bool CVideoDisplay::BGetScanout( Uint32 *punFrameID, Uint64 *punScanoutNS )
+{
+	bool bResult = false;
+
+	SDL_LockSpinlock( &m_ScanoutLock );
+	if ( m_nScanouts > 0 )
+	{
+		const SScanout *pScanout = &m_Scanouts[ m_iFirstScanout ];
+		*punFrameID = pScanout->unFrameID;
+		*punScanoutNS = pScanout->unScanoutNS;
+		m_iFirstScanout = ( m_iFirstScanout + 1 ) % k_nMaxScanouts;
+		--m_nScanouts;
+		bResult = true;
+	}
+	SDL_UnlockSpinlock( &m_ScanoutLock );
+
+	return bResult;
+}
+
+
+//--------------------------------------------------------------------------------------------------
+// Return the time of a recent vblank and the refresh interval
+//--------------------------------------------------------------------------------------------------
+bool CVideoDisplay::BGetVBlankTiming( Uint64 *punVBlankNS, Uint64 *punRefreshNS ) const
+{
+	if ( !m_unLastVBlankNS || !m_PresentationStats.unRefreshNS )
+	{
+		return false;
+	}
+	*punVBlankNS = m_unLastVBlankNS;
+	*punRefreshNS = m_PresentationStats.unRefreshNS;
+	return true;
+}
+
+
+//--------------------------------------------------------------------------------------------------
+// Create a video display instance for an SDL window
+//--------------------------------------------------------------------------------------------------
 CVideoDisplay *CreateVideoDisplay( SDL_Window *pWindow )
 {
 	CVideoDisplay *pDisplay;
+	const char *pszDriver = SDL_GetCurrentVideoDriver();
 
-	if ( SDL_strcmp( SDL_GetCurrentVideoDriver(), "kmsdrm" ) == 0 )
+	if ( SDL_strcmp( pszDriver, "dummy" ) == 0 || SDL_strcmp( pszDriver, "offscreen" ) == 0 )
+	{
+		pDisplay = new CVideoDisplayNull;
+	}
+	else if ( SDL_strcmp( pszDriver, "kmsdrm" ) == 0 )
 	{
 		pDisplay = new CVideoDisplayDRM;
 	}
-	else if ( SDL_strcmp( SDL_GetCurrentVideoDriver(), "wayland" ) == 0 )
+	else if ( SDL_strcmp( pszDriver, "wayland" ) == 0 )
 	{
 		pDisplay = new CVideoDisplayWayland;
 	}
@@ -18,6 +18,10 @@ extern "C" {
 #include <libavcodec/avcodec.h>
 }
 
+#include "av_pool.h"
+#include "decode_threading.h"
+#include "overlay_damage.h"
+
 //--------------------------------------------------------------------------------------------------
 // A video display class
 //--------------------------------------------------------------------------------------------------
@@ -28,7 +32,19 @@ public:
 	{
 		k_EDisplayTypeDRM,
 		k_EDisplayTypeEGL,
-		k_EDisplayTypeWayland
+		k_EDisplayTypeWayland,
+		k_EDisplayTypeNull
+	};
+
+	struct SPresentationStats
+	{
+		Uint64 unPresented;			// Frames that reached the screen
+		Uint64 unDiscarded;			// Frames replaced before they were shown
+		Uint64 unRepeatedRefreshes;	// Refresh cycles that showed the previous frame again
+		Uint64 unRefreshNS;			// The most recent refresh interval
+		Uint64 unBackpressure;		// Frames dropped because too many were waiting on the display
+		Uint64 unReleaseNS;			// Average time from submitting a video buffer to its release
+		int nInFlightLimit;			// Video buffers allowed in flight, 0 if the display has no limit
 	};
 
 public:
@@ -41,13 +57,106 @@ public:
 
 	virtual SDL_Surface *InitOverlay( int nWidth, int nHeight ) = 0;
 	virtual void SetOverlayRect( const SDL_Rect &rect ) = 0;
+
+	// Draw the overlay directly into framebuffer memory instead of copying it, returns false if
+	// the display doesn't support it
+	virtual bool BSetOverlayZeroCopy( bool bEnabled ) { return !bEnabled; }
+
+	// Returns the surface to draw into before the next UpdateOverlay(). This is the surface from
+	// InitOverlay() unless zero copy is enabled, in which case it can change from frame to frame.
+	virtual SDL_Surface *BeginOverlay() = 0;
+
+	// Mark part of the overlay surface as changed, UpdateOverlay() only copies what has changed
+	virtual void AddOverlayDamage( const SDL_Rect &rect ) { m_OverlayDamage.Add( rect ); }
+	void InvalidateOverlay() { m_OverlayDamage.AddAll(); }
+
+	// Callers that don't report damage can have it detected before calling UpdateOverlay()
+	void SetOverlayDamageMode( COverlayDamage::EMode eMode ) { m_OverlayDamage.SetMode( eMode ); }
+	void DetectOverlayDamage( const SDL_Surface *pSurface ) { m_OverlayDamage.Detect( pSurface ); }
+
 	virtual void UpdateOverlay() = 0;
 
-	virtual bool BInitCodec( AVCodecContext *pContext, const AVCodec *pCodec ) = 0;
+	// Returns a value that changes whenever the overlay contents change
+	Uint32 GetOverlayGeneration() const { return m_OverlayDamage.GetGeneration(); }
+	const COverlayDamage::SStats &GetOverlayStats() const { return m_OverlayDamage.GetStats(); }
+
+	// Returns the number of overlay buffers owned by the display
+	virtual int GetOverlayBuffersInFlight() { return 0; }
+
+	// Set how software decoders are threaded, this is used by the next BInitCodec()
+	void SetDecodeThreading( const CDecodeThreading &threading ) { m_DecodeThreading = threading; }
+
+	// ppOptions are passed to avcodec_open2(), entries the decoder doesn't use are left in it
+	virtual bool BInitCodec( AVCodecContext *pContext, const AVCodec *pCodec, AVDictionary **ppOptions ) = 0;
 	virtual void SetVideoRect( const SDL_Rect &rect ) = 0;
 	virtual void UpdateVideo( AVFrame *pFrame ) = 0;
 
+	// Recycle the frames displays hold on to between UpdateVideo() and DisplayFrame()
+	void SetFramePool( CFramePool *pPool ) { m_pFramePool = pPool; }
+
+	// Set the frame interval of the video content, displays use it to size their buffering
+	void SetVideoFrameInterval( Uint64 unFrameNS ) { m_unVideoFrameNS = unFrameNS; }
+
+	// Returns the number of video buffers owned by the display
+	virtual int GetVideoBuffersInFlight() { return 0; }
+
 	virtual void DisplayFrame() = 0;
+
+	// Draw directly with the graphics API instead of through SDL_Renderer, returns false if the
+	// display doesn't support it
+	virtual bool BSetDirectPresent( bool bEnabled ) { return !bEnabled; }
+
+	// Set the number of vblanks to wait for when presenting, returns false if it can't be changed
+	virtual bool BSetSwapInterval( int nInterval ) { return false; }
+
+	// Displays that know when frames reach the screen give each DisplayFrame() an ID and report
+	// its scanout time later. This returns 0 if the last DisplayFrame() won't be reported.
+	Uint32 GetDisplayFrameID() const { return m_unDisplayFrameID; }
+
+	// Return the next frame that has been scanned out, if any
+	bool BGetScanout( Uint32 *punFrameID, Uint64 *punScanoutNS );
+
+	// Returns the time of a recent vblank and the refresh interval, if the display knows them
+	bool BGetVBlankTiming( Uint64 *punVBlankNS, Uint64 *punRefreshNS ) const;
+
+	const SPresentationStats &GetPresentationStats() const { return m_PresentationStats; }
+
+protected:
+	// Return the ID for a frame being displayed, never 0
+	Uint32 NextDisplayFrameID();
+
+	// Reference a video frame, from the frame pool if there is one
+	AVFrame *CloneFrame( const AVFrame *pFrame );
+	void FreeFrame( AVFrame **ppFrame );
+
+	// Record that a frame was scanned out, this can be called from any thread
+	void AddScanout( Uint32 unFrameID, Uint64 unScanoutNS );
+
+	COverlayDamage m_OverlayDamage;
+	CDecodeThreading m_DecodeThreading;
+	CFramePool *m_pFramePool = nullptr;
+	Uint32 m_unDisplayFrameID = 0;
+	Uint64 m_unLastVBlankNS = 0;
+	Uint64 m_unVideoFrameNS = 0;
+	SPresentationStats m_PresentationStats = { };
+
+private:
+	enum
+	{
+		k_nMaxScanouts = 16
+	};
+
+	struct SScanout
+	{
+		Uint32 unFrameID;
+		Uint64 unScanoutNS;
+	};
+
+	Uint32 m_unLastFrameID = 0;
+	SDL_SpinLock m_ScanoutLock = 0;
+	SScanout m_Scanouts[ k_nMaxScanouts ];
+	int m_iFirstScanout = 0;
+	int m_nScanouts = 0;
 };
 
 
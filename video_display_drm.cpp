@@ -11,12 +11,23 @@
 */
 #include "video_display_drm.h"
 #include "video_display_rpi.h"
+#include "video_compositor.h"
 
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <linux/dma-buf.h>
 #include <drm_fourcc.h>
+#include <xf86drm.h>
+#include <xf86drmMode.h>
+
+extern "C" {
+#include <libavutil/hwcontext_drm.h>
+}
 
 #include "external/drmu/drmu/drmu.h"
 #include "external/drmu/drmu/drmu_output.h"
 #include "external/drmu/drmu/drmu_dmabuf.h"
+#include "external/drmu/drmu/drmu_av.h"
 extern "C" {
 #include "external/drmu/test/drmprime_out.h"
 }
@@ -33,11 +44,45 @@ static int get_drm_buffer2( struct AVCodecContext *s, struct AVFrame *frame, int
 }
 
 
+//--------------------------------------------------------------------------------------------------
+// Return the ID of a plane property, or 0 if the plane doesn't have it
+//--------------------------------------------------------------------------------------------------
+static uint32_t GetPlanePropertyID( int nFD, uint32_t unPlaneID, const char *pszName )
+{
+	uint32_t unPropertyID = 0;
+
+	drmModeObjectProperties *pProperties = drmModeObjectGetProperties( nFD, unPlaneID, DRM_MODE_OBJECT_PLANE );
+	if ( !pProperties )
+	{
+		return 0;
+	}
+
+	for ( uint32_t i = 0; i < pProperties->count_props && !unPropertyID; ++i )
+	{
+		drmModePropertyRes *pProperty = drmModeGetProperty( nFD, pProperties->props[ i ] );
+		if ( pProperty )
+		{
+			if ( SDL_strcmp( pProperty->name, pszName ) == 0 )
+			{
+				unPropertyID = pProperty->prop_id;
+			}
+			drmModeFreeProperty( pProperty );
+		}
+	}
+	drmModeFreeObjectProperties( pProperties );
+
+	return unPropertyID;
+}
+
+
 //--------------------------------------------------------------------------------------------------
 // CVideoDisplayDRM destructor
 //--------------------------------------------------------------------------------------------------
 CVideoDisplayDRM::~CVideoDisplayDRM()
 {
+	delete m_pCompositor;
+	FreeFrame( &m_pCompositeFrame );
+
 	if ( m_pOverlaySurface )
 	{
 		SDL_DestroySurface( m_pOverlaySurface );
@@ -48,18 +93,43 @@ CVideoDisplayDRM::~CVideoDisplayDRM()
 	}
 	if ( m_pDisplayOut )
 	{
+		drmu_output_t *pOutput = drmprime_out_drmu_output( m_pDisplayOut );
+		drmu_env_t *pOutputEnv = drmu_output_env( pOutput );
+		drmu_atomic_t *pAtomic = drmu_atomic_new( pOutputEnv );
+		if ( m_pVideoPlane )
+		{
+			drmu_atomic_plane_clear_add( pAtomic, m_pVideoPlane );
+		}
 		if ( m_pOverlayPlane )
 		{
-			drmu_output_t *pOutput = drmprime_out_drmu_output( m_pDisplayOut );
-			drmu_env_t *pOutputEnv = drmu_output_env( pOutput );
-			drmu_atomic_t *pAtomic = drmu_atomic_new( pOutputEnv );
 			drmu_atomic_plane_clear_add( pAtomic, m_pOverlayPlane );
-			drmu_atomic_queue( &pAtomic);
+		}
+		drmu_atomic_queue( &pAtomic );
 
-			drmu_fb_unref( &m_pOverlayFB );
+		drmu_fb_unref( &m_pVideoFB );
+		drmu_fb_unref( &m_pLastVideoFB );
+		drmu_plane_unref( &m_pVideoPlane );
+		if ( m_pOverlayPlane )
+		{
+			// When compositing this is the primary plane
+			for ( int i = 0; i < k_nOverlayBuffers; ++i )
+			{
+				if ( m_OverlayBuffers[ i ].pSurface )
+				{
+					SDL_DestroySurface( m_OverlayBuffers[ i ].pSurface );
+				}
+				drmu_fb_unref( &m_OverlayBuffers[ i ].pFB );
+			}
 			drmu_dmabuf_env_unref( &m_pOverlayDMABufEnv );
 			drmu_plane_unref( &m_pOverlayPlane );
 		}
+		for ( int i = 0; i < (int)SDL_arraysize( m_unDamageBlobs ); ++i )
+		{
+			if ( m_unDamageBlobs[ i ] )
+			{
+				drmModeDestroyPropertyBlob( m_nFD, m_unDamageBlobs[ i ] );
+			}
+		}
 		drmprime_out_delete( m_pDisplayOut );
 	}
 }
@@ -76,6 +146,8 @@ bool CVideoDisplayDRM::BInit( SDL_Window *pWindow )
 		SDL_SetError( "Couldn't get DRM file descriptor" );
 		return false;
 	}
+	m_nFD = nFD;
+	m_pWindow = pWindow;
 
 	m_pDisplayOut = drmprime_out_new_fd( nFD );
 	if ( !m_pDisplayOut )
@@ -96,32 +168,110 @@ bool CVideoDisplayDRM::BInit( SDL_Window *pWindow )
 
 
 //--------------------------------------------------------------------------------------------------
-// Initialize the video overlay
+// Create a framebuffer for the overlay
 //--------------------------------------------------------------------------------------------------
-SDL_Surface *CVideoDisplayDRM::InitOverlay( int nWidth, int nHeight )
+drmu_fb_t *CVideoDisplayDRM::CreateOverlayFB( int nWidth, int nHeight, uint32_t unFormat )
+{
+	if ( m_pOverlayDMABufEnv )
+	{
+		return drmu_fb_new_dmabuf_mod( m_pOverlayDMABufEnv, nWidth, nHeight, unFormat, DRM_FORMAT_MOD_LINEAR );
+	}
+
+	drmu_output_t *pOutput = drmprime_out_drmu_output( m_pDisplayOut );
+	drmu_env_t *pOutputEnv = drmu_output_env( pOutput );
+	return drmu_fb_new_dumb_mod( pOutputEnv, nWidth, nHeight, unFormat, DRM_FORMAT_MOD_LINEAR );
+}
+
+
+//--------------------------------------------------------------------------------------------------
+// Create the framebuffers that are flipped on m_pOverlayPlane
+//--------------------------------------------------------------------------------------------------
+bool CVideoDisplayDRM::BInitOverlayBuffers( int nWidth, int nHeight, uint32_t unFormat )
 {
 	drmu_output_t *pOutput = drmprime_out_drmu_output( m_pDisplayOut );
 	drmu_env_t *pOutputEnv = drmu_output_env( pOutput );
+	SDL_PixelFormat eFormat = ( unFormat == DRM_FORMAT_XRGB8888 ) ? SDL_PIXELFORMAT_XRGB8888 : SDL_PIXELFORMAT_ARGB8888;
 
-	m_pOverlayPlane = drmu_output_plane_ref_format( pOutput, DRMU_PLANE_TYPE_OVERLAY, DRM_FORMAT_ARGB8888, DRM_FORMAT_MOD_LINEAR );
+	// We draw into one framebuffer while another is being scanned out and a third may be waiting to flip
+	m_pOverlayDMABufEnv = drmu_dmabuf_env_new_video( pOutputEnv );
+	for ( int i = 0; i < k_nOverlayBuffers; ++i )
+	{
+		SOverlayBuffer *pBuffer = &m_OverlayBuffers[ i ];
+		pBuffer->pDisplay = this;
+		pBuffer->pFB = CreateOverlayFB( nWidth, nHeight, unFormat );
+		if ( !pBuffer->pFB )
+		{
+			SDL_SetError( "Couldn't create overlay framebuffer" );
+			return false;
+		}
+
+		// This wraps the mapped framebuffer so the overlay can be drawn into it directly
+		pBuffer->pSurface = SDL_CreateSurfaceFrom( nWidth, nHeight, eFormat, drmu_fb_data( pBuffer->pFB, 0 ), drmu_fb_pitch( pBuffer->pFB, 0 ) );
+		if ( !pBuffer->pSurface )
+		{
+			return false;
+		}
+		SDL_SetAtomicInt( &pBuffer->nState, k_EOverlayBufferFree );
+	}
+	return true;
+}
+
+
+//--------------------------------------------------------------------------------------------------
+// Composite the video and overlay on the CPU into framebuffers for the primary plane
+//
+// This is used when the display has no ARGB overlay plane, the overlay buffers become full screen
+// XRGB framebuffers and m_pOverlayPlane is the primary plane.
+//--------------------------------------------------------------------------------------------------
+bool CVideoDisplayDRM::BInitCompositing()
+{
+	drmu_output_t *pOutput = drmprime_out_drmu_output( m_pDisplayOut );
+
+	m_pOverlayPlane = drmu_output_plane_ref_format( pOutput, DRMU_PLANE_TYPE_PRIMARY, DRM_FORMAT_XRGB8888, DRM_FORMAT_MOD_LINEAR );
 	if ( !m_pOverlayPlane )
 	{
-		SDL_SetError( "Couldn't find overlay plane" );
-		return nullptr;
+		SDL_SetError( "Couldn't find overlay or primary plane" );
+		return false;
 	}
 
-	m_pOverlayDMABufEnv = drmu_dmabuf_env_new_video( pOutputEnv );
-	if ( m_pOverlayDMABufEnv )
+	if ( !SDL_GetWindowSizeInPixels( m_pWindow, &m_nCompositeWidth, &m_nCompositeHeight ) )
 	{
-		m_pOverlayFB = drmu_fb_new_dmabuf_mod( m_pOverlayDMABufEnv, nWidth, nHeight, DRM_FORMAT_ARGB8888, DRM_FORMAT_MOD_LINEAR );
+		return false;
 	}
-	else
+
+	m_pCompositor = new CVideoCompositor;
+	if ( !m_pCompositor->BInit( 0 ) )
 	{
-		m_pOverlayFB = drmu_fb_new_dumb_mod( pOutputEnv, nWidth, nHeight, DRM_FORMAT_ARGB8888, DRM_FORMAT_MOD_LINEAR );
+		return false;
+	}
+
+	if ( !BInitOverlayBuffers( m_nCompositeWidth, m_nCompositeHeight, DRM_FORMAT_XRGB8888 ) )
+	{
+		return false;
+	}
+
+	SDL_Log( "No overlay plane, compositing on the CPU with %d threads", m_pCompositor->GetThreadCount() );
+	return true;
+}
+
+
+//--------------------------------------------------------------------------------------------------
+// Initialize the video overlay
+//--------------------------------------------------------------------------------------------------
+SDL_Surface *CVideoDisplayDRM::InitOverlay( int nWidth, int nHeight )
+{
+	drmu_output_t *pOutput = drmprime_out_drmu_output( m_pDisplayOut );
+
+	m_pOverlayPlane = drmu_output_plane_ref_format( pOutput, DRMU_PLANE_TYPE_OVERLAY, DRM_FORMAT_ARGB8888, DRM_FORMAT_MOD_LINEAR );
+	if ( m_pOverlayPlane )
+	{
+		if ( !BInitOverlayBuffers( nWidth, nHeight, DRM_FORMAT_ARGB8888 ) )
+		{
+			return nullptr;
+		}
 	}
-	if ( !m_pOverlayFB )
+	else if ( !BInitCompositing() )
 	{
-		SDL_SetError( "Couldn't create overlay framebuffer" );
 		return nullptr;
 	}
 
@@ -130,6 +280,17 @@ SDL_Surface *CVideoDisplayDRM::InitOverlay( int nWidth, int nHeight )
 	{
 		return nullptr;
 	}
+	m_OverlayDamage.Init( nWidth, nHeight );
+
+	if ( m_pCompositor )
+	{
+		// The overlay is blended from m_pOverlaySurface each time we composite
+		return m_pOverlaySurface;
+	}
+
+	// Drivers that support it can use damage clips to limit how much of the plane they refresh
+	m_unDamageClipsProperty = GetPlanePropertyID( m_nFD, drmu_plane_id( m_pOverlayPlane ), "FB_DAMAGE_CLIPS" );
+
 	return m_pOverlaySurface;
 }
 
@@ -151,12 +312,103 @@ void CVideoDisplayDRM::SetOverlayRect( const SDL_Rect &rect )
 	m_OverlayRect.w = (uint32_t)rect.w;
 	m_OverlayRect.h = (uint32_t)rect.h;
 
-	drmu_output_t *pOutput = drmprime_out_drmu_output( m_pDisplayOut );
-	drmu_env_t *pOutputEnv = drmu_output_env( pOutput );
-	drmu_atomic_t *pAtomic = drmu_atomic_new( pOutputEnv );
-	drmu_atomic_plane_clear_add( pAtomic, m_pOverlayPlane );
-	drmu_atomic_plane_add_fb( pAtomic, m_pOverlayPlane, m_pOverlayFB, m_OverlayRect );
-	drmu_atomic_queue( &pAtomic);
+	// The overlay is moved in the next DisplayFrame()
+	m_bOverlayRectChanged = true;
+}
+
+
+//--------------------------------------------------------------------------------------------------
+// Return an overlay buffer that isn't being used by the display, if there is one
+//--------------------------------------------------------------------------------------------------
+CVideoDisplayDRM::SOverlayBuffer *CVideoDisplayDRM::GetFreeOverlayBuffer()
+{
+	for ( int i = 0; i < k_nOverlayBuffers; ++i )
+	{
+		SOverlayBuffer *pBuffer = &m_OverlayBuffers[ i ];
+		if ( SDL_GetAtomicInt( &pBuffer->nState ) == k_EOverlayBufferFree )
+		{
+			return pBuffer;
+		}
+	}
+	return nullptr;
+}
+
+
+//--------------------------------------------------------------------------------------------------
+// Synchronize CPU access to an overlay buffer
+//--------------------------------------------------------------------------------------------------
+void CVideoDisplayDRM::BeginOverlayWrite( SOverlayBuffer *pBuffer )
+{
+	Uint64 unStartNS = SDL_GetTicksNS();
+	drmu_fb_write_start( pBuffer->pFB );
+	m_OverlayDamage.AddSyncTime( SDL_GetTicksNS() - unStartNS );
+}
+
+void CVideoDisplayDRM::EndOverlayWrite( SOverlayBuffer *pBuffer )
+{
+	Uint64 unStartNS = SDL_GetTicksNS();
+	drmu_fb_write_end( pBuffer->pFB );
+	m_OverlayDamage.AddSyncTime( SDL_GetTicksNS() - unStartNS );
+}
+
+
+//--------------------------------------------------------------------------------------------------
+// Enable drawing directly into the overlay framebuffers
+//--------------------------------------------------------------------------------------------------
+bool CVideoDisplayDRM::BSetOverlayZeroCopy( bool bEnabled )
+{
+	if ( m_pCompositor )
+	{
+		// The overlay buffers hold the composited frame, not the overlay
+		return !bEnabled;
+	}
+
+	m_bOverlayZeroCopy = bEnabled;
+	return true;
+}
+
+
+//--------------------------------------------------------------------------------------------------
+// Return the surface to draw the next overlay frame into
+//--------------------------------------------------------------------------------------------------
+SDL_Surface *CVideoDisplayDRM::BeginOverlay()
+{
+	if ( !m_bOverlayZeroCopy )
+	{
+		return m_pOverlaySurface;
+	}
+
+	if ( m_pDrawOverlayBuffer )
+	{
+		return m_pDrawOverlayBuffer->pSurface;
+	}
+
+	SOverlayBuffer *pBuffer = GetFreeOverlayBuffer();
+	if ( !pBuffer && m_pCurrentOverlayBuffer )
+	{
+		// Every buffer is owned by the display, draw into the latest one and accept some tearing
+		m_bOverlayDrawInPlace = true;
+		pBuffer = m_pCurrentOverlayBuffer;
+		BeginOverlayWrite( pBuffer );
+	}
+	else if ( pBuffer )
+	{
+		// Bring the buffer up to date with the previous frame so we can draw on top of it,
+		// the first frame starts from whatever was drawn into the InitOverlay() surface.
+		SDL_Surface *pPrevious = m_pCurrentOverlayBuffer ? m_pCurrentOverlayBuffer->pSurface : m_pOverlaySurface;
+		SDL_Rect rects[ COverlayDamage::k_nMaxRects ];
+		int nRects = m_OverlayDamage.GetBufferDamage( pBuffer->pFB, rects, SDL_arraysize( rects ) );
+
+		BeginOverlayWrite( pBuffer );
+		m_OverlayDamage.CopyRects( (const Uint8 *)pPrevious->pixels, pPrevious->pitch, (Uint8 *)pBuffer->pSurface->pixels, pBuffer->pSurface->pitch, rects, nRects );
+	}
+	else
+	{
+		return m_pOverlaySurface;
+	}
+
+	m_pDrawOverlayBuffer = pBuffer;
+	return pBuffer->pSurface;
 }
 
 
@@ -165,35 +417,174 @@ void CVideoDisplayDRM::SetOverlayRect( const SDL_Rect &rect )
 //--------------------------------------------------------------------------------------------------
 void CVideoDisplayDRM::UpdateOverlay()
 {
-	drmu_fb_write_start( m_pOverlayFB );
-	const uint8_t *pSrc = (uint8_t *)m_pOverlaySurface->pixels;
-	int nSrcPitch = m_pOverlaySurface->pitch;
-	uint8_t *pDst = (uint8_t *)drmu_fb_data( m_pOverlayFB, 0 );
-	int nDstPitch = drmu_fb_pitch( m_pOverlayFB, 0 );
-	if ( nSrcPitch == nDstPitch )
+	SOverlayBuffer *pBuffer;
+
+	if ( m_pCompositor )
 	{
-		memcpy( pDst, pSrc, m_pOverlaySurface->h * nSrcPitch );
+		if ( !m_OverlayDamage.BEmpty() )
+		{
+			m_bCompositeChanged = true;
+		}
+		m_OverlayDamage.EndFrame();
+		return;
+	}
+
+	if ( m_bOverlayZeroCopy )
+	{
+		pBuffer = m_pDrawOverlayBuffer;
+		if ( !pBuffer )
+		{
+			m_OverlayDamage.EndFrame();
+			return;
+		}
+
+		if ( m_OverlayDamage.BEmpty() && m_pCurrentOverlayBuffer && !m_bOverlayDrawInPlace )
+		{
+			// Nothing was drawn, keep the buffer for the next frame
+			m_OverlayDamage.EndFrame();
+			return;
+		}
+
+		EndOverlayWrite( pBuffer );
+		m_pDrawOverlayBuffer = nullptr;
+		m_OverlayDamage.SetBufferCurrent( pBuffer->pFB );
+
+		if ( m_bOverlayDrawInPlace )
+		{
+			// The plane is already showing this buffer
+			m_bOverlayDrawInPlace = false;
+			m_OverlayDamage.EndFrame();
+			return;
+		}
 	}
 	else
 	{
-		size_t unLength = m_pOverlaySurface->w * 4;
-		for ( int i = m_pOverlaySurface->h; i--; )
+		if ( m_OverlayDamage.BEmpty() && m_pCurrentOverlayBuffer )
 		{
-			memcpy( pDst, pSrc, unLength );
-			pSrc += nSrcPitch;
-			pDst += nDstPitch;
+			m_OverlayDamage.EndFrame();
+			return;
 		}
+
+		// If every buffer is still owned by the display, keep the damage and try again next frame
+		pBuffer = GetFreeOverlayBuffer();
+		if ( !pBuffer )
+		{
+			return;
+		}
+
+		// Bring the buffer up to date with everything that changed since it was last drawn
+		SDL_Rect rects[ COverlayDamage::k_nMaxRects ];
+		int nRects = m_OverlayDamage.GetBufferDamage( pBuffer->pFB, rects, SDL_arraysize( rects ) );
+
+		BeginOverlayWrite( pBuffer );
+		m_OverlayDamage.CopyRects( (const Uint8 *)m_pOverlaySurface->pixels, m_pOverlaySurface->pitch, (Uint8 *)pBuffer->pSurface->pixels, pBuffer->pSurface->pitch, rects, nRects );
+		EndOverlayWrite( pBuffer );
+
+		m_OverlayDamage.SetBufferCurrent( pBuffer->pFB );
 	}
-	drmu_fb_write_end( m_pOverlayFB );
+
+	// The damage clips describe what changed since the previous frame on screen
+	const SDL_Rect *pFrameRects;
+	int nFrameRects = m_OverlayDamage.GetRects( &pFrameRects );
+	QueueOverlay( pBuffer, pFrameRects, nFrameRects );
+
+	m_OverlayDamage.EndFrame();
+}
+
+
+//--------------------------------------------------------------------------------------------------
+// Set the overlay buffer to flip to in the next DisplayFrame()
+//--------------------------------------------------------------------------------------------------
+void CVideoDisplayDRM::QueueOverlay( SOverlayBuffer *pBuffer, const SDL_Rect *pRects, int nRects )
+{
+	m_pCurrentOverlayBuffer = pBuffer;
+	m_pPendingOverlayBuffer = pBuffer;
+
+	// Drivers that support it can use damage clips to limit how much of the plane they refresh
+	m_unPendingDamageBlob = 0;
+	if ( m_unDamageClipsProperty && nRects > 0 )
+	{
+		struct drm_mode_rect clips[ COverlayDamage::k_nMaxRects ];
+		for ( int i = 0; i < nRects; ++i )
+		{
+			clips[ i ].x1 = pRects[ i ].x;
+			clips[ i ].y1 = pRects[ i ].y;
+			clips[ i ].x2 = pRects[ i ].x + pRects[ i ].w;
+			clips[ i ].y2 = pRects[ i ].y + pRects[ i ].h;
+		}
+
+		// The blob has to stay alive until the commit is applied, so we keep the last couple around
+		uint32_t &unBlob = m_unDamageBlobs[ m_iDamageBlob ];
+		m_iDamageBlob = ( m_iDamageBlob + 1 ) % SDL_arraysize( m_unDamageBlobs );
+		if ( unBlob )
+		{
+			drmModeDestroyPropertyBlob( m_nFD, unBlob );
+			unBlob = 0;
+		}
+		if ( drmModeCreatePropertyBlob( m_nFD, clips, nRects * sizeof( clips[ 0 ] ), &unBlob ) == 0 )
+		{
+			m_unPendingDamageBlob = unBlob;
+		}
+		else
+		{
+			unBlob = 0;
+		}
+	}
+}
+
+
+//--------------------------------------------------------------------------------------------------
+// Called on the DRM event thread when the page flip for a commit has completed
+//--------------------------------------------------------------------------------------------------
+void CVideoDisplayDRM::CommitCallback( void *pUserData )
+{
+	Uint64 unScanoutNS = SDL_GetTicksNS();
+	SCommit *pCommit = (SCommit *)pUserData;
+
+	if ( pCommit->pOverlayBuffer )
+	{
+		pCommit->pDisplay->OnOverlayFlipped( pCommit->pOverlayBuffer );
+	}
+	pCommit->pDisplay->AddScanout( pCommit->unFrameID, unScanoutNS );
+	SDL_AddAtomicInt( &pCommit->pDisplay->m_nCommitsPending, -1 );
+	delete pCommit;
+}
+
+void CVideoDisplayDRM::OnOverlayFlipped( SOverlayBuffer *pBuffer )
+{
+	// The buffer that was on screen is released once the new one is being scanned out
+	if ( m_pScanoutOverlayBuffer && m_pScanoutOverlayBuffer != pBuffer )
+	{
+		SDL_SetAtomicInt( &m_pScanoutOverlayBuffer->nState, k_EOverlayBufferFree );
+	}
+	SDL_SetAtomicInt( &pBuffer->nState, k_EOverlayBufferScanout );
+	m_pScanoutOverlayBuffer = pBuffer;
+}
+
+
+//--------------------------------------------------------------------------------------------------
+// Return the number of overlay buffers queued or being scanned out
+//--------------------------------------------------------------------------------------------------
+int CVideoDisplayDRM::GetOverlayBuffersInFlight()
+{
+	int nInFlight = 0;
+	for ( int i = 0; i < k_nOverlayBuffers; ++i )
+	{
+		if ( SDL_GetAtomicInt( &m_OverlayBuffers[ i ].nState ) != k_EOverlayBufferFree )
+		{
+			++nInFlight;
+		}
+	}
+	return nInFlight;
 }
 
 
 //--------------------------------------------------------------------------------------------------
 // Initialize the video codec
 //--------------------------------------------------------------------------------------------------
-bool CVideoDisplayDRM::BInitCodec( AVCodecContext *pContext, const AVCodec *pCodec )
+bool CVideoDisplayDRM::BInitCodec( AVCodecContext *pContext, const AVCodec *pCodec, AVDictionary **ppOptions )
 {
-	return ::BInitCodec( pContext, pCodec, get_drm_buffer2, m_pVideoOut );
+	return ::BInitCodec( pContext, pCodec, get_drm_buffer2, m_pVideoOut, m_DecodeThreading, ppOptions );
 }
 
 
@@ -202,6 +593,15 @@ bool CVideoDisplayDRM::BInitCodec( AVCodecContext *pContext, const AVCodec *pCod
 //--------------------------------------------------------------------------------------------------
 void CVideoDisplayDRM::SetVideoRect( const SDL_Rect &rect )
 {
+	if (rect.x == m_VideoRect.x &&
+	    rect.y == m_VideoRect.y &&
+	    rect.w == (int)m_VideoRect.w &&
+	    rect.h == (int)m_VideoRect.h) {
+		return;
+	}
+
+	// The video plane scales the frame to this rect, it is applied in the next DisplayFrame()
+	m_bVideoRectChanged = true;
 	m_VideoRect.x = rect.x;
 	m_VideoRect.y = rect.y;
 	m_VideoRect.w = (uint32_t)rect.w;
@@ -209,19 +609,305 @@ void CVideoDisplayDRM::SetVideoRect( const SDL_Rect &rect )
 }
 
 
+//--------------------------------------------------------------------------------------------------
+// Find a plane that can scan out the decoded frames
+//--------------------------------------------------------------------------------------------------
+bool CVideoDisplayDRM::BInitVideoPlane( const AVFrame *pFrame )
+{
+	const AVDRMFrameDescriptor *pDesc = (const AVDRMFrameDescriptor *)pFrame->data[ 0 ];
+	uint32_t unFormat = pDesc->layers[ 0 ].format;
+	uint64_t unModifier = pDesc->objects[ 0 ].format_modifier;
+
+	// Prefer the primary plane so the video stays underneath the overlay
+	drmu_output_t *pOutput = drmprime_out_drmu_output( m_pDisplayOut );
+	m_pVideoPlane = drmu_output_plane_ref_format( pOutput, DRMU_PLANE_TYPE_PRIMARY, unFormat, unModifier );
+	if ( !m_pVideoPlane )
+	{
+		m_pVideoPlane = drmu_output_plane_ref_format( pOutput, DRMU_PLANE_TYPE_OVERLAY, unFormat, unModifier );
+	}
+	return m_pVideoPlane != nullptr;
+}
+
+
 //--------------------------------------------------------------------------------------------------
 // Update the video frame being displayed
 //--------------------------------------------------------------------------------------------------
 void CVideoDisplayDRM::UpdateVideo( AVFrame *pFrame )
 {
-	drmprime_video_display( m_pVideoOut, pFrame );
+	if ( m_pCompositor )
+	{
+		// Keep a reference until the frame has been composited
+		FreeFrame( &m_pCompositeFrame );
+		m_pCompositeFrame = CloneFrame( pFrame );
+		m_bCompositeChanged = true;
+		return;
+	}
+
+	// Frames we can't scan out directly go through drmprime_out on their own commit
+	if ( pFrame->format != AV_PIX_FMT_DRM_PRIME || ( !m_pVideoPlane && !BInitVideoPlane( pFrame ) ) )
+	{
+		drmprime_video_display( m_pVideoOut, pFrame );
+		return;
+	}
+
+	drmu_output_t *pOutput = drmprime_out_drmu_output( m_pDisplayOut );
+	drmu_env_t *pOutputEnv = drmu_output_env( pOutput );
+
+	// The framebuffer holds a reference to the frame until it is no longer on screen
+	drmu_fb_unref( &m_pVideoFB );
+	m_pVideoFB = drmu_fb_av_new( pOutputEnv, pFrame );
 }
 
 
 //--------------------------------------------------------------------------------------------------
 // Display the video frame and overlay
+//
+// Both planes are updated in a single atomic commit so they change on the same vblank.
 //--------------------------------------------------------------------------------------------------
 void CVideoDisplayDRM::DisplayFrame()
 {
+	m_unDisplayFrameID = 0;
+
+	if ( m_pCompositor )
+	{
+		DisplayFrameComposited();
+		return;
+	}
+
+	SOverlayBuffer *pOverlayBuffer = m_pPendingOverlayBuffer;
+	if ( !pOverlayBuffer && m_bOverlayRectChanged )
+	{
+		pOverlayBuffer = m_pCurrentOverlayBuffer;
+	}
+	if ( m_OverlayRect.w == 0 || m_OverlayRect.h == 0 )
+	{
+		// Not visible yet, it will be shown once the overlay has a rect
+		pOverlayBuffer = nullptr;
+	}
+
+	// Show the last frame again if it needs to move
+	drmu_fb_t *pVideoFB = m_pVideoFB;
+	if ( !pVideoFB && m_bVideoRectChanged )
+	{
+		pVideoFB = m_pLastVideoFB;
+	}
+	if ( m_VideoRect.w == 0 || m_VideoRect.h == 0 )
+	{
+		pVideoFB = nullptr;
+	}
+
+	if ( !pVideoFB && !pOverlayBuffer )
+	{
+		return;
+	}
+
+	drmu_output_t *pOutput = drmprime_out_drmu_output( m_pDisplayOut );
+	drmu_env_t *pOutputEnv = drmu_output_env( pOutput );
+	drmu_atomic_t *pAtomic = drmu_atomic_new( pOutputEnv );
+	drmu_atomic_output_add_props( pAtomic, pOutput );
+
+	if ( pVideoFB )
+	{
+		// The plane scales and positions the frame, cropping is taken from the framebuffer
+		drmu_atomic_plane_add_fb( pAtomic, m_pVideoPlane, pVideoFB, m_VideoRect );
+		m_bVideoRectChanged = false;
+
+		if ( pVideoFB == m_pVideoFB )
+		{
+			drmu_fb_unref( &m_pLastVideoFB );
+			m_pLastVideoFB = m_pVideoFB;
+			m_pVideoFB = nullptr;
+		}
+	}
+
+	if ( pOverlayBuffer )
+	{
+		if ( m_bOverlayRectChanged )
+		{
+			drmu_atomic_plane_clear_add( pAtomic, m_pOverlayPlane );
+			m_bOverlayRectChanged = false;
+		}
+		drmu_atomic_plane_add_fb( pAtomic, m_pOverlayPlane, pOverlayBuffer->pFB, m_OverlayRect );
+		// The clips only cover the changes since the last frame, if this commit is merged with one
+		// that hasn't been applied yet the kernel would miss the earlier changes, so leave them off
+		// and let the whole plane be refreshed
+		if ( m_unPendingDamageBlob && pOverlayBuffer == m_pPendingOverlayBuffer && SDL_GetAtomicInt( &m_nCommitsPending ) == 0 )
+		{
+			drmu_atomic_add_prop_value( pAtomic, drmu_plane_id( m_pOverlayPlane ), m_unDamageClipsProperty, m_unPendingDamageBlob );
+		}
+
+		SDL_SetAtomicInt( &pOverlayBuffer->nState, k_EOverlayBufferQueued );
+	}
+	m_pPendingOverlayBuffer = nullptr;
+	m_unPendingDamageBlob = 0;
+
+	CommitFrame( pAtomic, pOverlayBuffer );
+}
+
+
+//--------------------------------------------------------------------------------------------------
+// Queue a commit for the next vblank
+//--------------------------------------------------------------------------------------------------
+void CVideoDisplayDRM::CommitFrame( drmu_atomic_t *pAtomic, SOverlayBuffer *pOverlayBuffer )
+{
+	// The callback tells us when the flip happened and which overlay buffer is now on screen. Any
+	// number of commits can be merged before a flip, so each one gets its own context.
+	m_unDisplayFrameID = NextDisplayFrameID();
+	SCommit *pCommit = new SCommit;
+	pCommit->pDisplay = this;
+	pCommit->unFrameID = m_unDisplayFrameID;
+	pCommit->pOverlayBuffer = pOverlayBuffer;
+	drmu_atomic_add_commit_callback( pAtomic, CommitCallback, pCommit );
+	SDL_AddAtomicInt( &m_nCommitsPending, 1 );
+
+	// This doesn't block, if a commit is already pending the two are merged
+	drmu_atomic_queue( &pAtomic );
+}
+
+
+
+//--------------------------------------------------------------------------------------------------
+// Map a decoded frame for reading on the CPU
+//--------------------------------------------------------------------------------------------------
+bool CVideoDisplayDRM::BMapVideoFrame( const AVFrame *pFrame, SVideoImage *pImage )
+{
+	if ( pFrame->format != AV_PIX_FMT_DRM_PRIME )
+	{
+		return CVideoCompositor::BGetVideoImage( pFrame, pImage );
+	}
+
+	const AVDRMFrameDescriptor *pDesc = (const AVDRMFrameDescriptor *)pFrame->data[ 0 ];
+	if ( pDesc->nb_objects > k_nMaxVideoMappings )
+	{
+		return false;
+	}
+
+	// Tiled and compressed layouts can't be read directly
+	for ( int i = 0; i < pDesc->nb_objects; ++i )
+	{
+		uint64_t unModifier = pDesc->objects[ i ].format_modifier;
+		if ( unModifier != DRM_FORMAT_MOD_LINEAR && unModifier != DRM_FORMAT_MOD_INVALID )
+		{
+			return false;
+		}
+	}
+
+	// The planes may be described by one multi-planar layer or a layer per plane
+	const AVDRMPlaneDescriptor *pPlanes[ 3 ];
+	int nPlanes = 0;
+	for ( int i = 0; i < pDesc->nb_layers; ++i )
+	{
+		for ( int j = 0; j < pDesc->layers[ i ].nb_planes && nPlanes < (int)SDL_arraysize( pPlanes ); ++j )
+		{
+			pPlanes[ nPlanes++ ] = &pDesc->layers[ i ].planes[ j ];
+		}
+	}
+
+	switch ( pDesc->layers[ 0 ].format )
+	{
+	case DRM_FORMAT_NV12:
+		pImage->eFormat = SVideoImage::k_EFormatNV12;
+		break;
+	case DRM_FORMAT_YUV420:
+		pImage->eFormat = SVideoImage::k_EFormatI420;
+		break;
+	case DRM_FORMAT_R8:
+		// A layer per plane, an R8 luma layer followed by GR88 or two R8 chroma layers
+		pImage->eFormat = ( nPlanes == 3 ) ? SVideoImage::k_EFormatI420 : SVideoImage::k_EFormatNV12;
+		break;
+	default:
+		return false;
+	}
+	if ( nPlanes != ( pImage->eFormat == SVideoImage::k_EFormatNV12 ? 2 : 3 ) )
+	{
+		return false;
+	}
+
+	for ( int i = 0; i < pDesc->nb_objects; ++i )
+	{
+		SVideoMapping *pMapping = &m_VideoMappings[ i ];
+		pMapping->nFD = pDesc->objects[ i ].fd;
+		pMapping->unSize = pDesc->objects[ i ].size;
+		pMapping->pData = mmap( nullptr, pMapping->unSize, PROT_READ, MAP_SHARED, pMapping->nFD, 0 );
+		if ( pMapping->pData == MAP_FAILED )
+		{
+			UnmapVideoFrame();
+			return false;
+		}
+		++m_nVideoMappings;
+
+		struct dma_buf_sync sync = { DMA_BUF_SYNC_START | DMA_BUF_SYNC_READ };
+		ioctl( pMapping->nFD, DMA_BUF_IOCTL_SYNC, &sync );
+	}
+
+	for ( int i = 0; i < nPlanes; ++i )
+	{
+		const SVideoMapping *pMapping = &m_VideoMappings[ pPlanes[ i ]->object_index ];
+		pImage->pPlanes[ i ] = (const Uint8 *)pMapping->pData + pPlanes[ i ]->offset;
+		pImage->nPitches[ i ] = (int)pPlanes[ i ]->pitch;
+	}
+	CVideoCompositor::SetVideoImageFrame( pFrame, pImage );
+	return true;
 }
 
+void CVideoDisplayDRM::UnmapVideoFrame()
+{
+	for ( int i = 0; i < m_nVideoMappings; ++i )
+	{
+		SVideoMapping *pMapping = &m_VideoMappings[ i ];
+
+		struct dma_buf_sync sync = { DMA_BUF_SYNC_END | DMA_BUF_SYNC_READ };
+		ioctl( pMapping->nFD, DMA_BUF_IOCTL_SYNC, &sync );
+		munmap( pMapping->pData, pMapping->unSize );
+	}
+	m_nVideoMappings = 0;
+}
+
+
+//--------------------------------------------------------------------------------------------------
+// Composite the video and overlay and flip to the result on the primary plane
+//--------------------------------------------------------------------------------------------------
+void CVideoDisplayDRM::DisplayFrameComposited()
+{
+	if ( !m_bCompositeChanged && !m_bVideoRectChanged && !m_bOverlayRectChanged )
+	{
+		return;
+	}
+
+	// If every buffer is still owned by the display, composite the latest state next frame
+	SOverlayBuffer *pBuffer = GetFreeOverlayBuffer();
+	if ( !pBuffer )
+	{
+		return;
+	}
+	m_bCompositeChanged = false;
+	m_bVideoRectChanged = false;
+	m_bOverlayRectChanged = false;
+
+	SVideoImage video;
+	const SVideoImage *pVideo = nullptr;
+	if ( m_pCompositeFrame && BMapVideoFrame( m_pCompositeFrame, &video ) )
+	{
+		pVideo = &video;
+	}
+
+	SDL_Rect videoRect = { m_VideoRect.x, m_VideoRect.y, (int)m_VideoRect.w, (int)m_VideoRect.h };
+	SDL_Rect overlayRect = { m_OverlayRect.x, m_OverlayRect.y, (int)m_OverlayRect.w, (int)m_OverlayRect.h };
+
+	BeginOverlayWrite( pBuffer );
+	m_pCompositor->Composite( pVideo, videoRect, m_pOverlaySurface, overlayRect, pBuffer->pSurface );
+	EndOverlayWrite( pBuffer );
+	UnmapVideoFrame();
+
+	drmu_output_t *pOutput = drmprime_out_drmu_output( m_pDisplayOut );
+	drmu_env_t *pOutputEnv = drmu_output_env( pOutput );
+	drmu_atomic_t *pAtomic = drmu_atomic_new( pOutputEnv );
+	drmu_atomic_output_add_props( pAtomic, pOutput );
+
+	drmu_rect_t screenRect = { 0, 0, (uint32_t)m_nCompositeWidth, (uint32_t)m_nCompositeHeight };
+	drmu_atomic_plane_add_fb( pAtomic, m_pOverlayPlane, pBuffer->pFB, screenRect );
+	SDL_SetAtomicInt( &pBuffer->nState, k_EOverlayBufferQueued );
+	m_pCurrentOverlayBuffer = pBuffer;
+
+	CommitFrame( pAtomic, pBuffer );
+}
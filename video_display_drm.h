@@ -27,6 +27,9 @@ typedef struct drmprime_video_env_s drmprime_video_env_t;
 typedef struct drmu_plane_s drmu_plane_t;
 typedef struct drmu_dmabuf_env_s drmu_dmabuf_env_t;
 typedef struct drmu_fb_s drmu_fb_t;
+typedef struct drmu_atomic_s drmu_atomic_t;
+class CVideoCompositor;
+struct SVideoImage;
 
 
 //--------------------------------------------------------------------------------------------------
@@ -44,22 +47,107 @@ public:
 
 	virtual SDL_Surface *InitOverlay( int nWidth, int nHeight ) override;
 	virtual void SetOverlayRect( const SDL_Rect &rect ) override;
+	virtual bool BSetOverlayZeroCopy( bool bEnabled ) override;
+	virtual SDL_Surface *BeginOverlay() override;
 	virtual void UpdateOverlay() override;
 
-	virtual bool BInitCodec( AVCodecContext *pContext, const AVCodec *pCodec ) override;
+	virtual bool BInitCodec( AVCodecContext *pContext, const AVCodec *pCodec, AVDictionary **ppOptions ) override;
 	virtual void SetVideoRect( const SDL_Rect &rect ) override;
 	virtual void UpdateVideo( AVFrame *pFrame ) override;
 
 	virtual void DisplayFrame() override;
 
+	virtual int GetOverlayBuffersInFlight() override;
+
 private:
+	enum
+	{
+		k_nOverlayBuffers = 3
+	};
+
+	enum EOverlayBufferState
+	{
+		k_EOverlayBufferFree,		// Available for drawing
+		k_EOverlayBufferQueued,		// Committed and waiting for the flip
+		k_EOverlayBufferScanout		// Being scanned out
+	};
+
+	struct SOverlayBuffer
+	{
+		CVideoDisplayDRM *pDisplay;
+		drmu_fb_t *pFB;
+		SDL_Surface *pSurface;
+		SDL_AtomicInt nState;
+	};
+
+	drmu_fb_t *CreateOverlayFB( int nWidth, int nHeight, uint32_t unFormat );
+	bool BInitOverlayBuffers( int nWidth, int nHeight, uint32_t unFormat );
+	SOverlayBuffer *GetFreeOverlayBuffer();
+	void BeginOverlayWrite( SOverlayBuffer *pBuffer );
+	void EndOverlayWrite( SOverlayBuffer *pBuffer );
+	void QueueOverlay( SOverlayBuffer *pBuffer, const SDL_Rect *pRects, int nRects );
+	bool BInitVideoPlane( const AVFrame *pFrame );
+	void CommitFrame( drmu_atomic_t *pAtomic, SOverlayBuffer *pOverlayBuffer );
+	static void CommitCallback( void *pUserData );
+	void OnOverlayFlipped( SOverlayBuffer *pBuffer );
+
+	// Software compositing onto the primary plane, when there is no overlay plane
+	bool BInitCompositing();
+	bool BMapVideoFrame( const AVFrame *pFrame, SVideoImage *pImage );
+	void UnmapVideoFrame();
+	void DisplayFrameComposited();
+
+	enum
+	{
+		k_nMaxVideoMappings = 4
+	};
+
+	struct SVideoMapping
+	{
+		int nFD;
+		void *pData;
+		size_t unSize;
+	};
+
+	// Passed to the commit callback for each DisplayFrame(), and freed by it
+	struct SCommit
+	{
+		CVideoDisplayDRM *pDisplay;
+		Uint32 unFrameID;
+		SOverlayBuffer *pOverlayBuffer;
+	};
+
+	SDL_Window *m_pWindow = nullptr;
 	drmprime_out_env_t *m_pDisplayOut = nullptr;
 	drmprime_video_env_t *m_pVideoOut = nullptr;
+	drmu_plane_t *m_pVideoPlane = nullptr;
+	drmu_fb_t *m_pVideoFB = nullptr;
+	drmu_fb_t *m_pLastVideoFB = nullptr;
+	bool m_bVideoRectChanged = false;
 	drmu_plane_t *m_pOverlayPlane = nullptr;
 	drmu_dmabuf_env_t *m_pOverlayDMABufEnv = nullptr;
-	drmu_fb_t *m_pOverlayFB = nullptr;
-	int m_iOverlayFB = 0;
+	SOverlayBuffer m_OverlayBuffers[ k_nOverlayBuffers ] = { };
+	SOverlayBuffer *m_pCurrentOverlayBuffer = nullptr;
+	SOverlayBuffer *m_pScanoutOverlayBuffer = nullptr;
+	SOverlayBuffer *m_pDrawOverlayBuffer = nullptr;
+	SOverlayBuffer *m_pPendingOverlayBuffer = nullptr;
+	uint32_t m_unPendingDamageBlob = 0;
+	bool m_bOverlayRectChanged = false;
+	SDL_AtomicInt m_nCommitsPending = { 0 };
+	bool m_bOverlayZeroCopy = false;
+	bool m_bOverlayDrawInPlace = false;
+	int m_nFD = -1;
+	uint32_t m_unDamageClipsProperty = 0;
+	uint32_t m_unDamageBlobs[ 2 ] = { 0, 0 };
+	int m_iDamageBlob = 0;
 	SDL_Surface *m_pOverlaySurface = nullptr;
+	CVideoCompositor *m_pCompositor = nullptr;
+	AVFrame *m_pCompositeFrame = nullptr;
+	bool m_bCompositeChanged = false;
+	int m_nCompositeWidth = 0;
+	int m_nCompositeHeight = 0;
+	SVideoMapping m_VideoMappings[ k_nMaxVideoMappings ] = { };
+	int m_nVideoMappings = 0;
 	drmu_rect_t m_OverlayRect = { 0, 0, 0, 0 };
 	drmu_rect_t m_VideoRect = { 0, 0, 0, 0 };
 };
@@ -12,6 +12,9 @@
 #include "video_display_egl.h"
 #include "video_display_rpi.h"
 
+#include <sys/stat.h>
+#include <time.h>
+
 extern "C" {
 #include <epoxy/gl.h>
 #include <epoxy/egl.h>
@@ -36,9 +39,14 @@ CVideoDisplayEGL::~CVideoDisplayEGL()
 	{
 		SDL_DestroyTexture( m_pOverlayTexture );
 	}
-	if ( m_pVideoTexture )
+	FlushVideoTextures();
+	if ( m_unProgram )
+	{
+		glDeleteProgram( m_unProgram );
+	}
+	if ( m_unVertexBuffer )
 	{
-		SDL_DestroyTexture( m_pVideoTexture );
+		glDeleteBuffers( 1, &m_unVertexBuffer );
 	}
 	if ( m_pVideoOut )
 	{
@@ -64,7 +72,8 @@ bool CVideoDisplayEGL::BInit( SDL_Window *pWindow )
 	{
 		return false;
 	}
-	SDL_SetRenderVSync( m_pRenderer, 0 );
+	SDL_SetRenderVSync( m_pRenderer, m_nSwapInterval );
+	m_pWindow = pWindow;
 
 	m_pVideoOut = vidout_simple_new();
 	if ( !m_pVideoOut )
@@ -93,6 +102,7 @@ SDL_Surface *CVideoDisplayEGL::InitOverlay( int nWidth, int nHeight )
 	{
 		return nullptr;
 	}
+	m_OverlayDamage.Init( nWidth, nHeight );
 	return m_pOverlaySurface;
 }
 
@@ -106,6 +116,7 @@ void CVideoDisplayEGL::SetOverlayRect( const SDL_Rect &rect )
 	m_OverlayRect.y = (float)rect.y;
 	m_OverlayRect.w = (float)rect.w;
 	m_OverlayRect.h = (float)rect.h;
+	m_bVerticesChanged = true;
 }
 
 
@@ -114,39 +125,83 @@ void CVideoDisplayEGL::SetOverlayRect( const SDL_Rect &rect )
 //--------------------------------------------------------------------------------------------------
 void CVideoDisplayEGL::UpdateOverlay()
 {
-	SDL_UpdateTexture( m_pOverlayTexture, nullptr, m_pOverlaySurface->pixels, m_pOverlaySurface->pitch );
+	// The texture keeps its contents, so only the damage from this frame needs to be uploaded
+	const SDL_Rect *pRects;
+	int nRects = m_OverlayDamage.GetRects( &pRects );
+	for ( int i = 0; i < nRects; ++i )
+	{
+		const Uint8 *pPixels = (const Uint8 *)m_pOverlaySurface->pixels + pRects[ i ].y * m_pOverlaySurface->pitch + pRects[ i ].x * 4;
+		SDL_UpdateTexture( m_pOverlayTexture, &pRects[ i ], pPixels, m_pOverlaySurface->pitch );
+		m_OverlayDamage.AddBytesCopied( pRects[ i ].w * pRects[ i ].h * 4 );
+	}
+	m_OverlayDamage.EndFrame();
 }
 
 
 //--------------------------------------------------------------------------------------------------
 // Initialize the video codec
 //--------------------------------------------------------------------------------------------------
-bool CVideoDisplayEGL::BInitCodec( AVCodecContext *pContext, const AVCodec *pCodec )
+bool CVideoDisplayEGL::BInitCodec( AVCodecContext *pContext, const AVCodec *pCodec, AVDictionary **ppOptions )
 {
-	return ::BInitCodec( pContext, pCodec, vidout_wayland_get_buffer2, m_pVideoOut );
+	// The decoder will allocate a new set of buffers
+	FlushVideoTextures();
+
+	return ::BInitCodec( pContext, pCodec, vidout_wayland_get_buffer2, m_pVideoOut, m_DecodeThreading, ppOptions );
 }
 
 
 //--------------------------------------------------------------------------------------------------
-// Update the video frame being displayed
+// Get the key identifying a decoder buffer and its layout
+//
+// The dmabuf inode identifies the buffer, since fd numbers can be reused for other buffers. The
+// cached EGLImage holds a reference on the dmabuf, so the inode can't be reused while it's cached.
 //--------------------------------------------------------------------------------------------------
-void CVideoDisplayEGL::UpdateVideo( AVFrame *pFrame )
+bool CVideoDisplayEGL::BGetVideoBufferKey( const AVDRMFrameDescriptor *pDesc, int nWidth, int nHeight, SVideoBufferKey *pKey )
 {
-	int nWidth = pFrame->width - (pFrame->crop_left + pFrame->crop_right);
-	int nHeight = pFrame->height - (pFrame->crop_top + pFrame->crop_bottom);
+	struct stat sb;
+	if ( pDesc->nb_objects < 1 || fstat( pDesc->objects[0].fd, &sb ) < 0 )
+	{
+		return false;
+	}
+
+	SDL_zerop( pKey );
+	pKey->unDevice = sb.st_dev;
+	pKey->unInode = sb.st_ino;
+	pKey->unModifier = pDesc->objects[0].format_modifier;
+	pKey->unFormat = pDesc->layers[0].format;
+	pKey->nWidth = nWidth;
+	pKey->nHeight = nHeight;
+	for ( int i = 0; i < pDesc->nb_layers; ++i )
+	{
+		for ( int j = 0; j < pDesc->layers[i].nb_planes; ++j )
+		{
+			if ( pKey->nPlanes == k_nMaxVideoPlanes )
+			{
+				return false;
+			}
+			const AVDRMPlaneDescriptor *const p = pDesc->layers[i].planes + j;
+			pKey->nOffsets[ pKey->nPlanes ] = (int)p->offset;
+			pKey->nPitches[ pKey->nPlanes ] = (int)p->pitch;
+			++pKey->nPlanes;
+		}
+	}
+	return true;
+}
 
-	// Free the previous texture
-	SDL_DestroyTexture( m_pVideoTexture );
 
-	m_pVideoTexture = SDL_CreateTexture( m_pRenderer, SDL_PIXELFORMAT_EXTERNAL_OES, SDL_TEXTUREACCESS_STATIC, nWidth, nHeight );
-	if ( !m_pVideoTexture )
+//--------------------------------------------------------------------------------------------------
+// Import a decoder buffer as an EGLImage bound to a new texture
+//--------------------------------------------------------------------------------------------------
+SDL_Texture *CVideoDisplayEGL::CreateVideoTexture( const AVDRMFrameDescriptor *desc, const SVideoBufferKey &key, SVideoTexture *pEntry )
+{
+	SDL_Texture *pTexture = SDL_CreateTexture( m_pRenderer, SDL_PIXELFORMAT_EXTERNAL_OES, SDL_TEXTUREACCESS_STATIC, key.nWidth, key.nHeight );
+	if ( !pTexture )
 	{
 		SDL_Log( "Couldn't create video texture: %s\n", SDL_GetError() );
-		return;
+		return nullptr;
 	}
 
 	EGLDisplay pDisplay = eglGetCurrentDisplay();
-	const AVDRMFrameDescriptor *desc = get_frame_drm_descriptor( pFrame );
 	EGLint attribs[50];
 	EGLint *a = attribs;
 	int i, j;
@@ -172,9 +227,9 @@ void CVideoDisplayEGL::UpdateVideo( AVFrame *pFrame )
 	const EGLint *b = anames;
 
 	*a++ = EGL_WIDTH;
-	*a++ = nWidth;
+	*a++ = key.nWidth;
 	*a++ = EGL_HEIGHT;
-	*a++ = nHeight;
+	*a++ = key.nHeight;
 	*a++ = EGL_LINUX_DRM_FOURCC_EXT;
 	*a++ = desc->layers[0].format;
 
@@ -202,12 +257,117 @@ void CVideoDisplayEGL::UpdateVideo( AVFrame *pFrame )
 
 	if ( !( image = eglCreateImageKHR( pDisplay, EGL_NO_CONTEXT, EGL_LINUX_DMA_BUF_EXT, NULL, attribs ) ) ) {
 		SDL_Log( "Failed to import fd %d", desc->objects[0].fd );
-		return;
+		SDL_DestroyTexture( pTexture );
+		return nullptr;
 	}
 
 	// This binds the image to the texture we just created
 	glEGLImageTargetTexture2DOES( GL_TEXTURE_EXTERNAL_OES, image );
-	eglDestroyImageKHR( pDisplay, image );
+
+	pEntry->key = key;
+	pEntry->pTexture = pTexture;
+	pEntry->pImage = image;
+	return pTexture;
+}
+
+
+//--------------------------------------------------------------------------------------------------
+// Free cached video textures
+//--------------------------------------------------------------------------------------------------
+void CVideoDisplayEGL::DestroyVideoTexture( SVideoTexture *pEntry )
+{
+	if ( pEntry->pTexture == m_pVideoTexture )
+	{
+		m_pVideoTexture = nullptr;
+	}
+	SDL_DestroyTexture( pEntry->pTexture );
+	eglDestroyImageKHR( eglGetCurrentDisplay(), (EGLImage)pEntry->pImage );
+	SDL_zerop( pEntry );
+}
+
+void CVideoDisplayEGL::FlushVideoTextures()
+{
+	for ( int i = 0; i < m_nVideoTextures; ++i )
+	{
+		DestroyVideoTexture( &m_VideoTextures[ i ] );
+	}
+	m_nVideoTextures = 0;
+}
+
+
+//--------------------------------------------------------------------------------------------------
+// Update the video frame being displayed
+//
+// The decoder recycles a small pool of buffers, so each one is imported once and its texture is
+// reused whenever the buffer comes around again.
+//--------------------------------------------------------------------------------------------------
+void CVideoDisplayEGL::UpdateVideo( AVFrame *pFrame )
+{
+	int nWidth = pFrame->width - (pFrame->crop_left + pFrame->crop_right);
+	int nHeight = pFrame->height - (pFrame->crop_top + pFrame->crop_bottom);
+	const AVDRMFrameDescriptor *desc = get_frame_drm_descriptor( pFrame );
+
+	// A new frames context means the decoder reallocated its buffers. Software frames don't have
+	// one, so a change of size or format is taken to mean the same thing.
+	const void *pFramesContext = pFrame->hw_frames_ctx ? pFrame->hw_frames_ctx->data : nullptr;
+	Uint32 unFormat = ( desc->nb_layers > 0 ) ? desc->layers[0].format : 0;
+	if ( pFramesContext != m_pVideoFramesContext ||
+	     pFrame->width != m_nVideoFrameWidth || pFrame->height != m_nVideoFrameHeight || unFormat != m_unVideoFrameFormat )
+	{
+		FlushVideoTextures();
+		m_pVideoFramesContext = pFramesContext;
+		m_nVideoFrameWidth = pFrame->width;
+		m_nVideoFrameHeight = pFrame->height;
+		m_unVideoFrameFormat = unFormat;
+	}
+
+	SVideoBufferKey key;
+	if ( !BGetVideoBufferKey( desc, nWidth, nHeight, &key ) )
+	{
+		SDL_Log( "Couldn't identify video buffer fd %d", desc->objects[0].fd );
+		return;
+	}
+
+	SVideoTexture *pEntry = nullptr;
+	for ( int i = 0; i < m_nVideoTextures; ++i )
+	{
+		if ( SDL_memcmp( &m_VideoTextures[ i ].key, &key, sizeof( key ) ) == 0 )
+		{
+			pEntry = &m_VideoTextures[ i ];
+			break;
+		}
+	}
+
+	if ( !pEntry )
+	{
+		if ( m_nVideoTextures < k_nMaxVideoTextures )
+		{
+			pEntry = &m_VideoTextures[ m_nVideoTextures++ ];
+		}
+		else
+		{
+			// Replace the least recently used texture
+			pEntry = &m_VideoTextures[ 0 ];
+			for ( int i = 1; i < m_nVideoTextures; ++i )
+			{
+				if ( m_VideoTextures[ i ].unLastUsed < pEntry->unLastUsed )
+				{
+					pEntry = &m_VideoTextures[ i ];
+				}
+			}
+			DestroyVideoTexture( pEntry );
+		}
+
+		if ( !CreateVideoTexture( desc, key, pEntry ) )
+		{
+			// Keep the cache packed
+			*pEntry = m_VideoTextures[ --m_nVideoTextures ];
+			SDL_zero( m_VideoTextures[ m_nVideoTextures ] );
+			return;
+		}
+	}
+	pEntry->unLastUsed = ++m_unVideoFrameCount;
+	m_pVideoTexture = pEntry->pTexture;
 
 	// A fence is set on the fd by the egl render - we can reuse the buffer once it goes away
 	// ( same as the direct wayland output after buffer release )
@@ -224,6 +384,7 @@ void CVideoDisplayEGL::SetVideoRect( const SDL_Rect &rect )
 	m_VideoRect.y = (float)rect.y;
 	m_VideoRect.w = (float)rect.w;
 	m_VideoRect.h = (float)rect.h;
+	m_bVerticesChanged = true;
 }
 
 
@@ -232,6 +393,12 @@ void CVideoDisplayEGL::SetVideoRect( const SDL_Rect &rect )
 //--------------------------------------------------------------------------------------------------
 void CVideoDisplayEGL::DisplayFrame()
 {
+	if ( m_bDirectPresent )
+	{
+		DisplayFrameDirect();
+		return;
+	}
+
 	if ( !m_pVideoTexture || m_VideoRect.x || m_VideoRect.y )
 	{
 		SDL_SetRenderDrawColor( m_pRenderer, 0, 0, 0, 255 );
@@ -242,8 +409,399 @@ void CVideoDisplayEGL::DisplayFrame()
 		// The video will cover the whole window
 	}
 
+	// The textures differ, so each of these is a separate draw call
 	SDL_RenderTexture( m_pRenderer, m_pVideoTexture, nullptr, &m_VideoRect );
 	SDL_RenderTexture( m_pRenderer, m_pOverlayTexture, nullptr, &m_OverlayRect );
 	SDL_RenderPresent( m_pRenderer );
+	m_unDrawCalls += m_pVideoTexture ? 2 : 1;
+}
+
+
+//--------------------------------------------------------------------------------------------------
+// Enable drawing with GLES2 directly
+//--------------------------------------------------------------------------------------------------
+bool CVideoDisplayEGL::BSetDirectPresent( bool bEnabled )
+{
+	if ( bEnabled == m_bDirectPresent )
+	{
+		return true;
+	}
+
+	// The two paths set the swap interval through different APIs
+	m_bDirectPresent = bEnabled;
+	return BSetSwapInterval( m_nSwapInterval );
+}
+
+
+//--------------------------------------------------------------------------------------------------
+// Set the number of vblanks to wait for when presenting
+//--------------------------------------------------------------------------------------------------
+bool CVideoDisplayEGL::BSetSwapInterval( int nInterval )
+{
+	m_nSwapInterval = nInterval;
+	if ( m_bDirectPresent )
+	{
+		return SDL_GL_SetSwapInterval( nInterval );
+	}
+	return SDL_SetRenderVSync( m_pRenderer, nInterval );
+}
+
+
+//--------------------------------------------------------------------------------------------------
+// Build the shader program that draws both the video and the overlay
+//
+// The vertices carry a layer in the third texture coordinate, so both quads are drawn in a single
+// draw call. The overlay quad comes second and blends over the video.
+//--------------------------------------------------------------------------------------------------
+enum
+{
+	k_nAttribPosition,
+	k_nAttribTexCoord
+};
+
+static const char s_VertexShader[] =
+	"attribute vec2 aPosition;\n"
+	"attribute vec3 aTexCoord;\n"
+	"varying vec2 vTexCoord;\n"
+	"varying float vLayer;\n"
+	"void main()\n"
+	"{\n"
+	"    gl_Position = vec4( aPosition, 0.0, 1.0 );\n"
+	"    vTexCoord = aTexCoord.xy;\n"
+	"    vLayer = aTexCoord.z;\n"
+	"}\n";
+
+// SDL stores ARGB8888 textures as RGBA bytes, so the overlay needs red and blue swapped
+static const char s_FragmentShader[] =
+	"precision mediump float;\n"
+	"uniform VIDEO_SAMPLER uVideo;\n"
+	"uniform sampler2D uOverlay;\n"
+	"varying vec2 vTexCoord;\n"
+	"varying float vLayer;\n"
+	"void main()\n"
+	"{\n"
+	"    if ( vLayer < 0.5 )\n"
+	"        gl_FragColor = vec4( texture2D( uVideo, vTexCoord ).rgb, 1.0 );\n"
+	"    else\n"
+	"        gl_FragColor = texture2D( uOverlay, vTexCoord ).bgra;\n"
+	"}\n";
+
+static GLuint CompileShader( GLenum eType, const char *pszHeader, const char *pszSource )
+{
+	const GLchar *sources[] = { pszHeader, pszSource };
+	GLint nStatus = GL_FALSE;
+
+	GLuint unShader = glCreateShader( eType );
+	glShaderSource( unShader, SDL_arraysize( sources ), sources, nullptr );
+	glCompileShader( unShader );
+	glGetShaderiv( unShader, GL_COMPILE_STATUS, &nStatus );
+	if ( nStatus != GL_TRUE )
+	{
+		char szLog[ 1024 ];
+		glGetShaderInfoLog( unShader, sizeof( szLog ), nullptr, szLog );
+		SDL_SetError( "Couldn't compile shader: %s", szLog );
+		glDeleteShader( unShader );
+		return 0;
+	}
+	return unShader;
+}
+
+bool CVideoDisplayEGL::BInitDirectProgram( unsigned int unVideoTarget )
+{
+	if ( m_unProgram && m_unProgramVideoTarget == unVideoTarget )
+	{
+		return true;
+	}
+	if ( m_unProgram )
+	{
+		glDeleteProgram( m_unProgram );
+		m_unProgram = 0;
+	}
+
+	const char *pszHeader;
+	if ( unVideoTarget == GL_TEXTURE_EXTERNAL_OES )
+	{
+		pszHeader = "#extension GL_OES_EGL_image_external : require\n#define VIDEO_SAMPLER samplerExternalOES\n";
+	}
+	else
+	{
+		pszHeader = "#define VIDEO_SAMPLER sampler2D\n";
+	}
+
+	GLuint unVertexShader = CompileShader( GL_VERTEX_SHADER, "", s_VertexShader );
+	GLuint unFragmentShader = CompileShader( GL_FRAGMENT_SHADER, pszHeader, s_FragmentShader );
+	if ( !unVertexShader || !unFragmentShader )
+	{
+		glDeleteShader( unVertexShader );
+		glDeleteShader( unFragmentShader );
+		return false;
+	}
+
+	GLuint unProgram = glCreateProgram();
+	glAttachShader( unProgram, unVertexShader );
+	glAttachShader( unProgram, unFragmentShader );
+	glBindAttribLocation( unProgram, k_nAttribPosition, "aPosition" );
+	glBindAttribLocation( unProgram, k_nAttribTexCoord, "aTexCoord" );
+	glLinkProgram( unProgram );
+	glDeleteShader( unVertexShader );
+	glDeleteShader( unFragmentShader );
+
+	GLint nStatus = GL_FALSE;
+	glGetProgramiv( unProgram, GL_LINK_STATUS, &nStatus );
+	if ( nStatus != GL_TRUE )
+	{
+		char szLog[ 1024 ];
+		glGetProgramInfoLog( unProgram, sizeof( szLog ), nullptr, szLog );
+		SDL_SetError( "Couldn't link shader program: %s", szLog );
+		glDeleteProgram( unProgram );
+		return false;
+	}
+
+	glUseProgram( unProgram );
+	glUniform1i( glGetUniformLocation( unProgram, "uVideo" ), 0 );
+	glUniform1i( glGetUniformLocation( unProgram, "uOverlay" ), 1 );
+
+	m_unProgram = unProgram;
+	m_unProgramVideoTarget = unVideoTarget;
+	return true;
+}
+
+
+//--------------------------------------------------------------------------------------------------
+// Rebuild the vertex buffer after the video or overlay rect changes
+//--------------------------------------------------------------------------------------------------
+void CVideoDisplayEGL::UpdateDirectVertices( int nOutputWidth, int nOutputHeight )
+{
+	if ( !m_bVerticesChanged && nOutputWidth == m_nOutputWidth && nOutputHeight == m_nOutputHeight )
+	{
+		return;
+	}
+
+	const SDL_FRect *rects[] = { &m_VideoRect, &m_OverlayRect };
+	GLfloat vertices[ 2 * 6 * 5 ];
+	GLfloat *v = vertices;
+	for ( int i = 0; i < (int)SDL_arraysize( rects ); ++i )
+	{
+		// Texture row 0 is the top of the image
+		float flLeft = 2.0f * rects[ i ]->x / nOutputWidth - 1.0f;
+		float flRight = 2.0f * ( rects[ i ]->x + rects[ i ]->w ) / nOutputWidth - 1.0f;
+		float flTop = 1.0f - 2.0f * rects[ i ]->y / nOutputHeight;
+		float flBottom = 1.0f - 2.0f * ( rects[ i ]->y + rects[ i ]->h ) / nOutputHeight;
+		const GLfloat corners[ 6 ][ 4 ] =
+		{
+			{ flLeft, flTop, 0.0f, 0.0f },
+			{ flLeft, flBottom, 0.0f, 1.0f },
+			{ flRight, flTop, 1.0f, 0.0f },
+			{ flRight, flTop, 1.0f, 0.0f },
+			{ flLeft, flBottom, 0.0f, 1.0f },
+			{ flRight, flBottom, 1.0f, 1.0f },
+		};
+		for ( int j = 0; j < 6; ++j )
+		{
+			*v++ = corners[ j ][ 0 ];
+			*v++ = corners[ j ][ 1 ];
+			*v++ = corners[ j ][ 2 ];
+			*v++ = corners[ j ][ 3 ];
+			*v++ = (GLfloat)i;
+		}
+	}
+
+	if ( !m_unVertexBuffer )
+	{
+		glGenBuffers( 1, &m_unVertexBuffer );
+	}
+	glBindBuffer( GL_ARRAY_BUFFER, m_unVertexBuffer );
+	glBufferData( GL_ARRAY_BUFFER, sizeof( vertices ), vertices, GL_STATIC_DRAW );
+
+	m_nOutputWidth = nOutputWidth;
+	m_nOutputHeight = nOutputHeight;
+	m_bVerticesChanged = false;
+}
+
+
+//--------------------------------------------------------------------------------------------------
+// Display the video frame and overlay with GLES2 directly
+//
+// SDL_Renderer still owns the textures and uploads the overlay, so it is flushed first, which also
+// makes it restore its own GL state the next time it draws.
+//--------------------------------------------------------------------------------------------------
+static void BindDirectTexture( SDL_Texture *pTexture, GLenum eUnit )
+{
+	SDL_PropertiesID unProps = SDL_GetTextureProperties( pTexture );
+	GLenum eTarget = (GLenum)SDL_GetNumberProperty( unProps, SDL_PROP_TEXTURE_OPENGLES2_TEXTURE_TARGET_NUMBER, GL_TEXTURE_2D );
+	GLuint unTexture = (GLuint)SDL_GetNumberProperty( unProps, SDL_PROP_TEXTURE_OPENGLES2_TEXTURE_NUMBER, 0 );
+
+	glActiveTexture( eUnit );
+	glBindTexture( eTarget, unTexture );
+	glTexParameteri( eTarget, GL_TEXTURE_MIN_FILTER, GL_LINEAR );
+	glTexParameteri( eTarget, GL_TEXTURE_MAG_FILTER, GL_LINEAR );
+	glTexParameteri( eTarget, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE );
+	glTexParameteri( eTarget, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE );
+}
+
+void CVideoDisplayEGL::DisplayFrameDirect()
+{
+	SDL_FlushRenderer( m_pRenderer );
+
+	unsigned int unVideoTarget = GL_TEXTURE_EXTERNAL_OES;
+	if ( m_pVideoTexture )
+	{
+		unVideoTarget = (unsigned int)SDL_GetNumberProperty( SDL_GetTextureProperties( m_pVideoTexture ), SDL_PROP_TEXTURE_OPENGLES2_TEXTURE_TARGET_NUMBER, GL_TEXTURE_2D );
+	}
+	if ( !BInitDirectProgram( unVideoTarget ) )
+	{
+		SDL_Log( "Couldn't create direct present program, using SDL_Renderer: %s\n", SDL_GetError() );
+		BSetDirectPresent( false );
+		DisplayFrame();
+		return;
+	}
+
+	int nOutputWidth = 0, nOutputHeight = 0;
+	SDL_GetWindowSizeInPixels( m_pWindow, &nOutputWidth, &nOutputHeight );
+	if ( nOutputWidth <= 0 || nOutputHeight <= 0 )
+	{
+		return;
+	}
+	UpdateDirectVertices( nOutputWidth, nOutputHeight );
+
+	glBindFramebuffer( GL_FRAMEBUFFER, 0 );
+	glViewport( 0, 0, nOutputWidth, nOutputHeight );
+	glDisable( GL_SCISSOR_TEST );
+	glDisable( GL_DEPTH_TEST );
+	glDisable( GL_CULL_FACE );
+
+	if ( !m_pVideoTexture || m_VideoRect.x || m_VideoRect.y )
+	{
+		glClearColor( 0.0f, 0.0f, 0.0f, 1.0f );
+		glClear( GL_COLOR_BUFFER_BIT );
+	}
+
+	glUseProgram( m_unProgram );
+	glBindBuffer( GL_ARRAY_BUFFER, m_unVertexBuffer );
+	glVertexAttribPointer( k_nAttribPosition, 2, GL_FLOAT, GL_FALSE, 5 * sizeof( GLfloat ), (const void *)0 );
+	glVertexAttribPointer( k_nAttribTexCoord, 3, GL_FLOAT, GL_FALSE, 5 * sizeof( GLfloat ), (const void *)( 2 * sizeof( GLfloat ) ) );
+	glEnableVertexAttribArray( k_nAttribPosition );
+	glEnableVertexAttribArray( k_nAttribTexCoord );
+
+	if ( m_pVideoTexture )
+	{
+		BindDirectTexture( m_pVideoTexture, GL_TEXTURE0 );
+	}
+	BindDirectTexture( m_pOverlayTexture, GL_TEXTURE1 );
+
+	glEnable( GL_BLEND );
+	glBlendFuncSeparate( GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA, GL_ONE, GL_ONE_MINUS_SRC_ALPHA );
+	if ( m_pVideoTexture )
+	{
+		glDrawArrays( GL_TRIANGLES, 0, 12 );
+	}
+	else
+	{
+		glDrawArrays( GL_TRIANGLES, 6, 6 );
+	}
+	++m_unDrawCalls;
+
+	SDL_GL_SwapWindow( m_pWindow );
+}
+
+
+//--------------------------------------------------------------------------------------------------
+// Compare the direct GLES2 path against SDL_Renderer
+//
+// This uses a 2D texture in place of decoded video, so it runs without a decoder or dmabuf import,
+// e.g. under Mesa llvmpipe with LIBGL_ALWAYS_SOFTWARE=1.
+//--------------------------------------------------------------------------------------------------
+static Uint64 GetThreadCPUTimeNS()
+{
+	struct timespec ts;
+	clock_gettime( CLOCK_THREAD_CPUTIME_ID, &ts );
+	return (Uint64)ts.tv_sec * SDL_NS_PER_SECOND + ts.tv_nsec;
+}
+
+bool CVideoDisplayEGL::BBenchmarkPresent()
+{
+	const int nWidth = 1280;
+	const int nHeight = 720;
+	const int nWarmupFrames = 30;
+	const int nFrames = 600;
+	bool bResult = true;
+
+	if ( !SDL_Init( SDL_INIT_VIDEO ) )
+	{
+		SDL_Log( "Couldn't initialize SDL: %s\n", SDL_GetError() );
+		return false;
+	}
+
+	SDL_Log( "Present benchmark, %dx%d, %d frames, video driver %s\n", nWidth, nHeight, nFrames, SDL_GetCurrentVideoDriver() );
+	SDL_Log( "%-10s %12s %12s %12s", "path", "wall us", "cpu us", "draw calls" );
+
+	static const char *s_PathNames[] = { "renderer", "direct" };
+	for ( int iPath = 0; iPath < (int)SDL_arraysize( s_PathNames ); ++iPath )
+	{
+		SDL_Window *pWindow = SDL_CreateWindow( "Present benchmark", nWidth, nHeight, 0 );
+		if ( !pWindow )
+		{
+			SDL_Log( "Couldn't create window: %s\n", SDL_GetError() );
+			bResult = false;
+			break;
+		}
+
+		CVideoDisplayEGL *pDisplay = new CVideoDisplayEGL;
+		SDL_Texture *pVideoTexture = nullptr;
+		if ( !pDisplay->BInit( pWindow ) ||
+		     !pDisplay->InitOverlay( nWidth, nHeight / 4 ) ||
+		     !pDisplay->BSetDirectPresent( iPath == 1 ) )
+		{
+			SDL_Log( "Couldn't initialize %s path: %s\n", s_PathNames[ iPath ], SDL_GetError() );
+			bResult = false;
+		}
+		else if ( ( pVideoTexture = SDL_CreateTexture( pDisplay->m_pRenderer, SDL_PIXELFORMAT_XRGB8888, SDL_TEXTUREACCESS_STATIC, nWidth, nHeight ) ) == nullptr )
+		{
+			SDL_Log( "Couldn't create video texture: %s\n", SDL_GetError() );
+			bResult = false;
+		}
+		else
+		{
+			SDL_FillSurfaceRect( pDisplay->m_pOverlaySurface, nullptr, SDL_MapSurfaceRGBA( pDisplay->m_pOverlaySurface, 32, 32, 32, 128 ) );
+			pDisplay->InvalidateOverlay();
+			pDisplay->UpdateOverlay();
+
+			SDL_Rect rect = { 0, 0, nWidth, nHeight };
+			pDisplay->SetVideoRect( rect );
+			rect.y = nHeight - nHeight / 4;
+			rect.h = nHeight / 4;
+			pDisplay->SetOverlayRect( rect );
+			pDisplay->m_pVideoTexture = pVideoTexture;
+
+			for ( int n = 0; n < nWarmupFrames; ++n )
+			{
+				pDisplay->DisplayFrame();
+			}
+
+			Uint64 unDrawCalls = pDisplay->m_unDrawCalls;
+			Uint64 unStart = SDL_GetTicksNS();
+			Uint64 unStartCPU = GetThreadCPUTimeNS();
+			for ( int n = 0; n < nFrames; ++n )
+			{
+				pDisplay->DisplayFrame();
+			}
+			Uint64 unWall = ( SDL_GetTicksNS() - unStart ) / nFrames;
+			Uint64 unCPU = ( GetThreadCPUTimeNS() - unStartCPU ) / nFrames;
+			double flDrawCalls = (double)( pDisplay->m_unDrawCalls - unDrawCalls ) / nFrames;
+
+			SDL_Log( "%-10s %12.1f %12.1f %12.1f", s_PathNames[ iPath ], unWall / 1000.0, unCPU / 1000.0, flDrawCalls );
+			pDisplay->m_pVideoTexture = nullptr;
+		}
+
+		if ( pVideoTexture )
+		{
+			SDL_DestroyTexture( pVideoTexture );
+		}
+		delete pDisplay;
+		SDL_DestroyWindow( pWindow );
+	}
+
+	SDL_QuitSubSystem( SDL_INIT_VIDEO );
+	return bResult;
 }
 
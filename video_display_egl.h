@@ -19,6 +19,7 @@
 // Forward declarations
 //--------------------------------------------------------------------------------------------------
 typedef struct vid_out_env_s vid_out_env_t;
+typedef struct AVDRMFrameDescriptor AVDRMFrameDescriptor;
 
 
 //--------------------------------------------------------------------------------------------------
@@ -36,21 +37,83 @@ public:
 
 	virtual SDL_Surface *InitOverlay( int nWidth, int nHeight ) override;
 	virtual void SetOverlayRect( const SDL_Rect &rect ) override;
+	virtual SDL_Surface *BeginOverlay() override { return m_pOverlaySurface; }
 	virtual void UpdateOverlay() override;
 
-	virtual bool BInitCodec( AVCodecContext *pContext, const AVCodec *pCodec ) override;
+	virtual bool BInitCodec( AVCodecContext *pContext, const AVCodec *pCodec, AVDictionary **ppOptions ) override;
 	virtual void SetVideoRect( const SDL_Rect &rect ) override;
 	virtual void UpdateVideo( AVFrame *pFrame ) override;
 
 	virtual void DisplayFrame() override;
+	virtual bool BSetDirectPresent( bool bEnabled ) override;
+	virtual bool BSetSwapInterval( int nInterval ) override;
+
+	// Compare the direct GLES2 path against SDL_Renderer and log the results
+	static bool BBenchmarkPresent();
 
 private:
+	enum
+	{
+		k_nMaxVideoPlanes = 4,
+		k_nMaxVideoTextures = 16
+	};
+
+	// The layout of a decoder buffer, textures are reused for buffers with the same key
+	struct SVideoBufferKey
+	{
+		Uint64 unDevice;
+		Uint64 unInode;
+		Uint64 unModifier;
+		Uint32 unFormat;
+		int nWidth;
+		int nHeight;
+		int nPlanes;
+		int nOffsets[ k_nMaxVideoPlanes ];
+		int nPitches[ k_nMaxVideoPlanes ];
+	};
+
+	struct SVideoTexture
+	{
+		SVideoBufferKey key;
+		SDL_Texture *pTexture;
+		void *pImage;
+		Uint64 unLastUsed;
+	};
+
+	bool BGetVideoBufferKey( const AVDRMFrameDescriptor *pDesc, int nWidth, int nHeight, SVideoBufferKey *pKey );
+	SDL_Texture *CreateVideoTexture( const AVDRMFrameDescriptor *pDesc, const SVideoBufferKey &key, SVideoTexture *pEntry );
+	void DestroyVideoTexture( SVideoTexture *pEntry );
+	void FlushVideoTextures();
+
+	bool BInitDirectProgram( unsigned int unVideoTarget );
+	void UpdateDirectVertices( int nOutputWidth, int nOutputHeight );
+	void DisplayFrameDirect();
+
+	SDL_Window *m_pWindow = nullptr;
 	SDL_Renderer *m_pRenderer = nullptr;
 	vid_out_env_t *m_pVideoOut = nullptr;
 	SDL_Surface *m_pOverlaySurface = nullptr;
 	SDL_Texture *m_pOverlayTexture = nullptr;
 	SDL_FRect m_OverlayRect = { 0.0f, 0.0f, 0.0f, 0.0f };
 	SDL_Texture *m_pVideoTexture = nullptr;
+	SVideoTexture m_VideoTextures[ k_nMaxVideoTextures ] = { };
+	int m_nVideoTextures = 0;
+	Uint64 m_unVideoFrameCount = 0;
+	const void *m_pVideoFramesContext = nullptr;
+	int m_nVideoFrameWidth = 0;
+	int m_nVideoFrameHeight = 0;
+	Uint32 m_unVideoFrameFormat = 0;
+
+	// Direct GLES2 presentation
+	bool m_bDirectPresent = false;
+	int m_nSwapInterval = 0;
+	unsigned int m_unProgram = 0;
+	unsigned int m_unProgramVideoTarget = 0;
+	unsigned int m_unVertexBuffer = 0;
+	bool m_bVerticesChanged = true;
+	int m_nOutputWidth = 0;
+	int m_nOutputHeight = 0;
+	Uint64 m_unDrawCalls = 0;
 	SDL_FRect m_VideoRect = { 0.0f, 0.0f, 0.0f, 0.0f };
 };
 
@@ -0,0 +1,58 @@
+/*
+  Copyright (C) 2024 Sam Lantinga <slouken@libsdl.org>
+
+  This software is provided 'as-is', without any express or implied
+  warranty.  In no event will the authors be held liable for any damages
+  arising from the use of this software.
+
+  Permission is granted to anyone to use this software for any purpose,
+  including commercial applications, and to alter it and redistribute it
+  freely.
+*/
+#include "video_display_null.h"
+#include "video_display_rpi.h"
+
+
+//--------------------------------------------------------------------------------------------------
+// CVideoDisplayNull destructor
+//--------------------------------------------------------------------------------------------------
+CVideoDisplayNull::~CVideoDisplayNull()
+{
+	if ( m_pOverlaySurface )
+	{
+		SDL_DestroySurface( m_pOverlaySurface );
+	}
+}
+
+
+//--------------------------------------------------------------------------------------------------
+// Initialize the video display
+//--------------------------------------------------------------------------------------------------
+bool CVideoDisplayNull::BInit( SDL_Window *pWindow )
+{
+	return true;
+}
+
+
+//--------------------------------------------------------------------------------------------------
+// Initialize the video overlay
+//
+// The overlay is still drawn every frame, it just isn't shown anywhere.
+//--------------------------------------------------------------------------------------------------
+SDL_Surface *CVideoDisplayNull::InitOverlay( int nWidth, int nHeight )
+{
+	m_pOverlaySurface = SDL_CreateSurface( nWidth, nHeight, SDL_PIXELFORMAT_ARGB8888 );
+	m_OverlayDamage.Init( nWidth, nHeight );
+	return m_pOverlaySurface;
+}
+
+
+//--------------------------------------------------------------------------------------------------
+// Initialize the video codec
+//
+// Frames are decoded into buffers allocated by ffmpeg, and released as soon as they're presented.
+//--------------------------------------------------------------------------------------------------
+bool CVideoDisplayNull::BInitCodec( AVCodecContext *pContext, const AVCodec *pCodec, AVDictionary **ppOptions )
+{
+	return ::BInitCodec( pContext, pCodec, avcodec_default_get_buffer2, nullptr, m_DecodeThreading, ppOptions );
+}
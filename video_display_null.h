@@ -0,0 +1,49 @@
+/*
+  Copyright (C) 2024 Sam Lantinga <slouken@libsdl.org>
+
+  This software is provided 'as-is', without any express or implied
+  warranty.  In no event will the authors be held liable for any damages
+  arising from the use of this software.
+
+  Permission is granted to anyone to use this software for any purpose,
+  including commercial applications, and to alter it and redistribute it
+  freely.
+*/
+#ifndef VIDEO_DISPLAY_NULL_H
+#define VIDEO_DISPLAY_NULL_H
+
+#include "video_display.h"
+
+
+//--------------------------------------------------------------------------------------------------
+// Video display class that doesn't show anything
+//
+// This is used with the SDL dummy and offscreen video drivers to measure demux and decode
+// throughput on systems without a display.
+//--------------------------------------------------------------------------------------------------
+class CVideoDisplayNull : public CVideoDisplay
+{
+public:
+	CVideoDisplayNull() { }
+	virtual ~CVideoDisplayNull();
+
+	virtual bool BInit( SDL_Window *pWindow ) override;
+
+	virtual EDisplayType GetDisplayType() override { return k_EDisplayTypeNull; }
+
+	virtual SDL_Surface *InitOverlay( int nWidth, int nHeight ) override;
+	virtual void SetOverlayRect( const SDL_Rect &rect ) override { }
+	virtual SDL_Surface *BeginOverlay() override { return m_pOverlaySurface; }
+	virtual void UpdateOverlay() override { m_OverlayDamage.EndFrame(); }
+
+	virtual bool BInitCodec( AVCodecContext *pContext, const AVCodec *pCodec, AVDictionary **ppOptions ) override;
+	virtual void SetVideoRect( const SDL_Rect &rect ) override { }
+	virtual void UpdateVideo( AVFrame *pFrame ) override { }
+
+	virtual void DisplayFrame() override { }
+
+private:
+	SDL_Surface *m_pOverlaySurface = nullptr;
+};
+
+#endif // VIDEO_DISPLAY_NULL_H
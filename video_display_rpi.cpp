@@ -10,6 +10,8 @@
   freely.
 */
 #include "video_display_rpi.h"
+#include "video_decoder.h"
+#include "decode_threading.h"
 
 #include <SDL3/SDL.h>
 
@@ -40,23 +42,30 @@ static AVPixelFormat get_drm_format( AVCodecContext *ctx, const AVPixelFormat *p
 
 
 //--------------------------------------------------------------------------------------------------
-// Initialize the video codec
+// Serialize calls to the display's buffer allocator
+//
+// With frame threading ffmpeg calls get_buffer2 from each decoder thread, and the display pools
+// weren't written to be allocated from concurrently. Buffers are already released from any thread
+// so only allocation needs the lock. There is only one video decoder at a time.
 //--------------------------------------------------------------------------------------------------
-bool BInitCodec( AVCodecContext *pContext, const AVCodec *pCodec, int (*get_buffer2)( AVCodecContext *s, AVFrame *frame, int flags ), void *pOpaque )
+static SDL_Mutex *s_pGetBufferLock;
+static int (*s_pGetBuffer2)( AVCodecContext *s, AVFrame *frame, int flags );
+
+static int get_buffer2_locked( AVCodecContext *s, AVFrame *frame, int flags )
 {
-	bool bAccelerated = false;
-	int iHWConfig = 0;
-	const AVCodecHWConfig *pHWConfig;
-	while ( ( pHWConfig = avcodec_get_hw_config( pCodec, iHWConfig++ ) ) != nullptr )
-	{
-		if ( pHWConfig->pix_fmt == AV_PIX_FMT_DRM_PRIME )
-		{
-			bAccelerated = true;
-			break;
-		}
-	}
+	SDL_LockMutex( s_pGetBufferLock );
+	int nResult = s_pGetBuffer2( s, frame, flags );
+	SDL_UnlockMutex( s_pGetBufferLock );
+	return nResult;
+}
 
-	if ( bAccelerated )
+
+//--------------------------------------------------------------------------------------------------
+// Initialize the video codec
+//--------------------------------------------------------------------------------------------------
+bool BInitCodec( AVCodecContext *pContext, const AVCodec *pCodec, int (*get_buffer2)( AVCodecContext *s, AVFrame *frame, int flags ), void *pOpaque, CDecodeThreading &threading, AVDictionary **ppOptions )
+{
+	if ( BVideoDecoderSupportsDRMPrime( pCodec ) )
 	{
 		pContext->get_format = get_drm_format;
 
@@ -71,9 +80,20 @@ bool BInitCodec( AVCodecContext *pContext, const AVCodec *pCodec, int (*get_buff
 		pContext->get_buffer2 = get_buffer2;
 		pContext->opaque = pOpaque;
 
-		// Allow ffmpeg to pick the number of threads
-		pContext->thread_count = 0;
-		pContext->thread_type = FF_THREAD_SLICE;
+		threading.Apply( pContext, pCodec );
+		if ( ( pContext->thread_type & FF_THREAD_FRAME ) && get_buffer2 != avcodec_default_get_buffer2 )
+		{
+			if ( !s_pGetBufferLock )
+			{
+				s_pGetBufferLock = SDL_CreateMutex();
+				if ( !s_pGetBufferLock )
+				{
+					return false;
+				}
+			}
+			s_pGetBuffer2 = get_buffer2;
+			pContext->get_buffer2 = get_buffer2_locked;
+		}
 	}
 
 #if LIBAVCODEC_VERSION_MAJOR < 60
@@ -83,7 +103,13 @@ bool BInitCodec( AVCodecContext *pContext, const AVCodec *pCodec, int (*get_buff
 #pragma GCC diagnostic pop
 #endif
 
-	if ( avcodec_open2( pContext, pCodec, nullptr ) < 0 )
+	if ( !threading.BBeginOpen() )
+	{
+		return false;
+	}
+	int nResult = avcodec_open2( pContext, pCodec, ppOptions );
+	threading.EndOpen();
+	if ( nResult < 0 )
 	{
 		SDL_SetError( "avcodec_open2() failed" );
 		return false;
@@ -16,9 +16,11 @@ extern "C" {
 #include <libavcodec/avcodec.h>
 }
 
+class CDecodeThreading;
+
 //--------------------------------------------------------------------------------------------------
 // Common functions for the Raspberry Pi video output
 //--------------------------------------------------------------------------------------------------
-bool BInitCodec( AVCodecContext *pContext, const AVCodec *pCodec, int (*get_buffer2)( AVCodecContext *s, AVFrame *frame, int flags ), void *pOpaque );
+bool BInitCodec( AVCodecContext *pContext, const AVCodec *pCodec, int (*get_buffer2)( AVCodecContext *s, AVFrame *frame, int flags ), void *pOpaque, CDecodeThreading &threading, AVDictionary **ppOptions );
 
 #endif // VIDEO_DISPLAY_RPI_H
@@ -13,7 +13,8 @@
 #include "video_display_rpi.h"
 
 #include <drm_fourcc.h>
-#include <zlib.h>
+#include <wayland-client.h>
+#include "presentation-time-client-protocol.h"
 
 //--------------------------------------------------------------------------------------------------
 // CVideoDisplayWayland event watcher
@@ -33,6 +34,35 @@ CVideoDisplayWayland::~CVideoDisplayWayland()
 {
 	SDL_RemoveEventWatch( EventWatch, this );
 
+	FreeFrame( &m_pPendingFrame );
+	for ( int i = 0; i < k_nMaxFeedback; ++i )
+	{
+		if ( m_Feedback[ i ].pFeedback )
+		{
+			wp_presentation_feedback_destroy( m_Feedback[ i ].pFeedback );
+		}
+	}
+	if ( m_pPresentation )
+	{
+		wp_presentation_destroy( m_pPresentation );
+	}
+	if ( m_pRegistry )
+	{
+		wl_registry_destroy( m_pRegistry );
+	}
+	if ( m_pEventQueue )
+	{
+		wl_event_queue_destroy( m_pEventQueue );
+	}
+
+	if ( m_pDrawFB && !m_bOverlayDrawInPlace )
+	{
+		wo_fb_unref( &m_pDrawFB );
+	}
+	for ( int i = 0; i < m_nOverlayFBSurfaces; ++i )
+	{
+		SDL_DestroySurface( m_OverlayFBSurfaces[ i ].pSurface );
+	}
 	if ( m_pLastFB )
 	{
 		wo_surface_detach_fb( m_pOverlayWaylandSurface );
@@ -96,10 +126,173 @@ bool CVideoDisplayWayland::BInit( SDL_Window *pWindow )
 
 	SDL_AddEventWatch( EventWatch, this );
 
+	m_pDisplay = pDisplay;
+	m_pWindowSurface = pSurface;
+	if ( !BInitPresentation( pDisplay ) )
+	{
+		SDL_Log( "Wayland presentation feedback isn't available, frame timing will be estimated" );
+	}
+
 	return true;
 }
 
 
+//--------------------------------------------------------------------------------------------------
+// Bind the presentation time protocol on our own event queue, so SDL doesn't dispatch its events
+//--------------------------------------------------------------------------------------------------
+bool CVideoDisplayWayland::BInitPresentation( wl_display *pDisplay )
+{
+	static const wl_registry_listener s_RegistryListener =
+	{
+		RegistryGlobal,
+		RegistryGlobalRemove
+	};
+	static const wp_presentation_listener s_PresentationListener =
+	{
+		PresentationClockID
+	};
+
+	m_pEventQueue = wl_display_create_queue( pDisplay );
+	if ( !m_pEventQueue )
+	{
+		return false;
+	}
+
+	wl_display *pWrapper = (wl_display *)wl_proxy_create_wrapper( pDisplay );
+	if ( !pWrapper )
+	{
+		return false;
+	}
+	wl_proxy_set_queue( (wl_proxy *)pWrapper, m_pEventQueue );
+	m_pRegistry = wl_display_get_registry( pWrapper );
+	wl_proxy_wrapper_destroy( pWrapper );
+	if ( !m_pRegistry )
+	{
+		return false;
+	}
+	wl_registry_add_listener( m_pRegistry, &s_RegistryListener, this );
+	wl_display_roundtrip_queue( pDisplay, m_pEventQueue );
+	if ( !m_pPresentation )
+	{
+		return false;
+	}
+
+	// Get the clock the compositor uses for timestamps
+	wp_presentation_add_listener( m_pPresentation, &s_PresentationListener, this );
+	wl_display_roundtrip_queue( pDisplay, m_pEventQueue );
+	return true;
+}
+
+void CVideoDisplayWayland::RegistryGlobal( void *pUserData, wl_registry *pRegistry, uint32_t unName, const char *pszInterface, uint32_t unVersion )
+{
+	CVideoDisplayWayland *pThis = (CVideoDisplayWayland *)pUserData;
+	if ( SDL_strcmp( pszInterface, wp_presentation_interface.name ) == 0 )
+	{
+		pThis->m_pPresentation = (wp_presentation *)wl_registry_bind( pRegistry, unName, &wp_presentation_interface, 1 );
+	}
+}
+
+void CVideoDisplayWayland::RegistryGlobalRemove( void *pUserData, wl_registry *pRegistry, uint32_t unName )
+{
+}
+
+void CVideoDisplayWayland::PresentationClockID( void *pUserData, wp_presentation *pPresentation, uint32_t unClockID )
+{
+	CVideoDisplayWayland *pThis = (CVideoDisplayWayland *)pUserData;
+	pThis->m_ePresentationClock = (clockid_t)unClockID;
+}
+
+
+//--------------------------------------------------------------------------------------------------
+// Ask the compositor to tell us when the next content update is shown
+//
+// The video is committed by wayout on a surface we don't have access to, so we make an empty
+// commit on the window surface and use its feedback. Desynchronized subsurface updates are shown
+// in the same repaint, so this reports the refresh cycle the video frame hit.
+//--------------------------------------------------------------------------------------------------
+void CVideoDisplayWayland::RequestPresentationFeedback()
+{
+	static const wp_presentation_feedback_listener s_FeedbackListener =
+	{
+		FeedbackSyncOutput,
+		FeedbackPresented,
+		FeedbackDiscarded
+	};
+
+	SFeedback *pFeedback = &m_Feedback[ m_iFeedback ];
+	m_iFeedback = ( m_iFeedback + 1 ) % k_nMaxFeedback;
+	if ( pFeedback->pFeedback )
+	{
+		// The compositor never answered, give up on it
+		wp_presentation_feedback_destroy( pFeedback->pFeedback );
+	}
+
+	pFeedback->pDisplay = this;
+	pFeedback->unFrameID = NextDisplayFrameID();
+	pFeedback->pFeedback = wp_presentation_feedback( m_pPresentation, m_pWindowSurface );
+	if ( !pFeedback->pFeedback )
+	{
+		return;
+	}
+	wp_presentation_feedback_add_listener( pFeedback->pFeedback, &s_FeedbackListener, pFeedback );
+	wl_surface_commit( m_pWindowSurface );
+	wl_display_flush( m_pDisplay );
+
+	m_unDisplayFrameID = pFeedback->unFrameID;
+}
+
+void CVideoDisplayWayland::FeedbackSyncOutput( void *pUserData, struct wp_presentation_feedback *pFeedback, wl_output *pOutput )
+{
+}
+
+void CVideoDisplayWayland::FeedbackPresented( void *pUserData, struct wp_presentation_feedback *pFeedback, uint32_t unSecondsHi, uint32_t unSecondsLo, uint32_t unNanoseconds, uint32_t unRefreshNS, uint32_t unSequenceHi, uint32_t unSequenceLo, uint32_t unFlags )
+{
+	SFeedback *pFrame = (SFeedback *)pUserData;
+	CVideoDisplayWayland *pThis = pFrame->pDisplay;
+
+	// Convert the presentation time to the SDL clock
+	Uint64 unPresentedNS = ( ( (Uint64)unSecondsHi << 32 ) | unSecondsLo ) * SDL_NS_PER_SECOND + unNanoseconds;
+	struct timespec now;
+	clock_gettime( pThis->m_ePresentationClock, &now );
+	Uint64 unClockNS = (Uint64)now.tv_sec * SDL_NS_PER_SECOND + now.tv_nsec;
+	Uint64 unTicksNS = SDL_GetTicksNS();
+	Uint64 unAgeNS = ( unClockNS > unPresentedNS ) ? ( unClockNS - unPresentedNS ) : 0;
+	Uint64 unScanoutNS = ( unTicksNS > unAgeNS ) ? ( unTicksNS - unAgeNS ) : 0;
+
+	// The sequence counts refresh cycles, any gap is a refresh that showed an older frame
+	Uint64 unSequence = ( (Uint64)unSequenceHi << 32 ) | unSequenceLo;
+	SPresentationStats &stats = pThis->m_PresentationStats;
+	if ( pThis->m_unLastSequence && unSequence > pThis->m_unLastSequence + 1 )
+	{
+		stats.unRepeatedRefreshes += unSequence - pThis->m_unLastSequence - 1;
+	}
+	pThis->m_unLastSequence = unSequence;
+	++stats.unPresented;
+	if ( unRefreshNS )
+	{
+		stats.unRefreshNS = unRefreshNS;
+	}
+	if ( unFlags & WP_PRESENTATION_FEEDBACK_KIND_VSYNC )
+	{
+		pThis->m_unLastVBlankNS = unScanoutNS;
+	}
+
+	pThis->AddScanout( pFrame->unFrameID, unScanoutNS );
+
+	wp_presentation_feedback_destroy( pFrame->pFeedback );
+	pFrame->pFeedback = nullptr;
+}
+
+void CVideoDisplayWayland::FeedbackDiscarded( void *pUserData, struct wp_presentation_feedback *pFeedback )
+{
+	SFeedback *pFrame = (SFeedback *)pUserData;
+	++pFrame->pDisplay->m_PresentationStats.unDiscarded;
+
+	wp_presentation_feedback_destroy( pFrame->pFeedback );
+	pFrame->pFeedback = nullptr;
+}
+
+
 //--------------------------------------------------------------------------------------------------
 // Handle window resize events
 //--------------------------------------------------------------------------------------------------
@@ -141,6 +334,7 @@ SDL_Surface *CVideoDisplayWayland::InitOverlay( int nWidth, int nHeight )
 	{
 		return nullptr;
 	}
+	m_OverlayDamage.Init( nWidth, nHeight );
 	return m_pOverlaySurface;
 }
 
@@ -157,18 +351,172 @@ void CVideoDisplayWayland::SetOverlayRect( const SDL_Rect &rect )
 }
 
 
+//--------------------------------------------------------------------------------------------------
+// Synchronize CPU access to an overlay framebuffer
+//--------------------------------------------------------------------------------------------------
+void CVideoDisplayWayland::BeginOverlayWrite( wo_fb_t *pFB )
+{
+	Uint64 unStartNS = SDL_GetTicksNS();
+	wo_fb_write_start( pFB );
+	m_OverlayDamage.AddSyncTime( SDL_GetTicksNS() - unStartNS );
+}
+
+void CVideoDisplayWayland::EndOverlayWrite( wo_fb_t *pFB )
+{
+	Uint64 unStartNS = SDL_GetTicksNS();
+	wo_fb_write_end( pFB );
+	m_OverlayDamage.AddSyncTime( SDL_GetTicksNS() - unStartNS );
+}
+
+
+//--------------------------------------------------------------------------------------------------
+// Show a new overlay framebuffer, taking ownership of it
+//--------------------------------------------------------------------------------------------------
+void CVideoDisplayWayland::AttachOverlay( wo_fb_t *pFB )
+{
+	if ( pFB != m_pLastFB )
+	{
+		wo_fb_unref( &m_pLastFB );
+		m_pLastFB = pFB;
+	}
+
+	wo_surface_attach_fb( m_pOverlayWaylandSurface, pFB, m_OverlayRect );
+	wo_surface_commit( m_pOverlayWaylandSurface );
+}
+
+
+//--------------------------------------------------------------------------------------------------
+// Return a surface that wraps the mapped memory of an overlay framebuffer
+//
+// The pool recycles a small number of buffers, so the surfaces are kept for as long as we run.
+//--------------------------------------------------------------------------------------------------
+SDL_Surface *CVideoDisplayWayland::GetOverlayFBSurface( wo_fb_t *pFB )
+{
+	void *pPixels = wo_fb_data( pFB, 0 );
+	for ( int i = 0; i < m_nOverlayFBSurfaces; ++i )
+	{
+		if ( m_OverlayFBSurfaces[ i ].pPixels == pPixels )
+		{
+			return m_OverlayFBSurfaces[ i ].pSurface;
+		}
+	}
+
+	if ( m_nOverlayFBSurfaces == (int)SDL_arraysize( m_OverlayFBSurfaces ) )
+	{
+		return nullptr;
+	}
+
+	SDL_Surface *pSurface = SDL_CreateSurfaceFrom( m_pOverlaySurface->w, m_pOverlaySurface->h, SDL_PIXELFORMAT_ARGB8888, pPixels, (int)wo_fb_pitch( pFB, 0 ) );
+	if ( pSurface )
+	{
+		m_OverlayFBSurfaces[ m_nOverlayFBSurfaces ].pPixels = pPixels;
+		m_OverlayFBSurfaces[ m_nOverlayFBSurfaces ].pSurface = pSurface;
+		++m_nOverlayFBSurfaces;
+	}
+	return pSurface;
+}
+
+
+//--------------------------------------------------------------------------------------------------
+// Enable drawing directly into the overlay framebuffers
+//--------------------------------------------------------------------------------------------------
+bool CVideoDisplayWayland::BSetOverlayZeroCopy( bool bEnabled )
+{
+	m_bOverlayZeroCopy = bEnabled;
+	return true;
+}
+
+
+//--------------------------------------------------------------------------------------------------
+// Return the surface to draw the next overlay frame into
+//--------------------------------------------------------------------------------------------------
+SDL_Surface *CVideoDisplayWayland::BeginOverlay()
+{
+	if ( !m_bOverlayZeroCopy )
+	{
+		return m_pOverlaySurface;
+	}
+
+	if ( m_pDrawFB )
+	{
+		return GetOverlayFBSurface( m_pDrawFB );
+	}
+
+	wo_fb_t *pFB = fb_pool_fb_new( m_pFramebufferPool, m_pOverlaySurface->w, m_pOverlaySurface->h, DRM_FORMAT_ARGB8888, DRM_FORMAT_MOD_LINEAR );
+	SDL_Surface *pSurface = pFB ? GetOverlayFBSurface( pFB ) : nullptr;
+	if ( !pSurface )
+	{
+		wo_fb_unref( &pFB );
+
+		// Draw into the buffer the compositor has and accept some tearing
+		pSurface = m_pLastFB ? GetOverlayFBSurface( m_pLastFB ) : nullptr;
+		if ( !pSurface )
+		{
+			return m_pOverlaySurface;
+		}
+		m_bOverlayDrawInPlace = true;
+		m_pDrawFB = m_pLastFB;
+		BeginOverlayWrite( m_pDrawFB );
+		return pSurface;
+	}
+
+	// Bring the buffer up to date with the previous frame so we can draw on top of it,
+	// the first frame starts from whatever was drawn into the InitOverlay() surface.
+	SDL_Surface *pPrevious = m_pLastFB ? GetOverlayFBSurface( m_pLastFB ) : nullptr;
+	if ( !pPrevious )
+	{
+		pPrevious = m_pOverlaySurface;
+	}
+	SDL_Rect rects[ COverlayDamage::k_nMaxRects ];
+	int nRects = m_OverlayDamage.GetBufferDamage( pSurface->pixels, rects, SDL_arraysize( rects ) );
+
+	BeginOverlayWrite( pFB );
+	m_OverlayDamage.CopyRects( (const Uint8 *)pPrevious->pixels, pPrevious->pitch, (Uint8 *)pSurface->pixels, pSurface->pitch, rects, nRects );
+
+	m_pDrawFB = pFB;
+	return pSurface;
+}
+
+
 //--------------------------------------------------------------------------------------------------
 // Update the overlay with new content
 //--------------------------------------------------------------------------------------------------
 void CVideoDisplayWayland::UpdateOverlay()
 {
-	// Check to see whether the overlay has changed
-	Uint32 unCRC = crc32(0, (Uint8 *)m_pOverlaySurface->pixels, m_pOverlaySurface->h * m_pOverlaySurface->pitch);
-	if ( unCRC == m_unOverlayCRC )
+	if ( m_bOverlayZeroCopy )
+	{
+		if ( !m_pDrawFB )
+		{
+			m_OverlayDamage.EndFrame();
+			return;
+		}
+
+		if ( m_OverlayDamage.BEmpty() && m_pLastFB && !m_bOverlayDrawInPlace )
+		{
+			// Nothing was drawn, keep the buffer for the next frame
+			m_OverlayDamage.EndFrame();
+			return;
+		}
+
+		wo_fb_t *pFB = m_pDrawFB;
+		m_pDrawFB = nullptr;
+		m_bOverlayDrawInPlace = false;
+
+		EndOverlayWrite( pFB );
+		m_OverlayDamage.SetBufferCurrent( wo_fb_data( pFB, 0 ) );
+		m_OverlayDamage.EndFrame();
+
+		AttachOverlay( pFB );
+		return;
+	}
+
+	// Nothing to do if the overlay hasn't changed since it was last attached
+	Uint32 unGeneration = m_OverlayDamage.GetGeneration();
+	if ( unGeneration == m_unOverlayGeneration )
 	{
+		m_OverlayDamage.EndFrame();
 		return;
 	}
-	m_unOverlayCRC = unCRC;
 
 	wo_fb_t *pFB = fb_pool_fb_new( m_pFramebufferPool, m_pOverlaySurface->w, m_pOverlaySurface->h, DRM_FORMAT_ARGB8888, DRM_FORMAT_MOD_LINEAR );
 	if ( !pFB )
@@ -177,41 +525,30 @@ void CVideoDisplayWayland::UpdateOverlay()
 		return;
 	}
 
-	wo_fb_write_start( pFB );
-	const uint8_t *pSrc = (uint8_t *)m_pOverlaySurface->pixels;
-	int nSrcPitch = m_pOverlaySurface->pitch;
+	// The pool hands out buffers that were used a few frames ago, so copy everything that
+	// changed since this buffer was last written.
 	uint8_t *pDst = (uint8_t *)wo_fb_data( pFB, 0 );
-	int nDstPitch = (int)wo_fb_pitch( pFB, 0 );
-	if ( nSrcPitch == nDstPitch )
-	{
-		memcpy( pDst, pSrc, m_pOverlaySurface->h * nSrcPitch );
-	}
-	else
-	{
-		size_t unLength = m_pOverlaySurface->w * 4;
-		for ( int i = m_pOverlaySurface->h; i--; )
-		{
-			memcpy( pDst, pSrc, unLength );
-			pSrc += nSrcPitch;
-			pDst += nDstPitch;
-		}
-	}
-	wo_fb_write_end( pFB );
+	SDL_Rect rects[ COverlayDamage::k_nMaxRects ];
+	int nRects = m_OverlayDamage.GetBufferDamage( pDst, rects, SDL_arraysize( rects ) );
 
-	wo_fb_unref( &m_pLastFB );
-	m_pLastFB = pFB;
+	BeginOverlayWrite( pFB );
+	m_OverlayDamage.CopyRects( (const Uint8 *)m_pOverlaySurface->pixels, m_pOverlaySurface->pitch, pDst, (int)wo_fb_pitch( pFB, 0 ), rects, nRects );
+	EndOverlayWrite( pFB );
 
-	wo_surface_attach_fb( m_pOverlayWaylandSurface, pFB, m_OverlayRect );
-	wo_surface_commit( m_pOverlayWaylandSurface );
+	m_OverlayDamage.SetBufferCurrent( pDst );
+	m_OverlayDamage.EndFrame();
+	m_unOverlayGeneration = unGeneration;
+
+	AttachOverlay( pFB );
 }
 
 
 //--------------------------------------------------------------------------------------------------
 // Initialize the video codec
 //--------------------------------------------------------------------------------------------------
-bool CVideoDisplayWayland::BInitCodec( AVCodecContext *pContext, const AVCodec *pCodec )
+bool CVideoDisplayWayland::BInitCodec( AVCodecContext *pContext, const AVCodec *pCodec, AVDictionary **ppOptions )
 {
-	return ::BInitCodec( pContext, pCodec, vidout_wayland_get_buffer2, m_pVideoOut );
+	return ::BInitCodec( pContext, pCodec, vidout_wayland_get_buffer2, m_pVideoOut, m_DecodeThreading, ppOptions );
 }
 
 
@@ -220,13 +557,65 @@ bool CVideoDisplayWayland::BInitCodec( AVCodecContext *pContext, const AVCodec *
 //--------------------------------------------------------------------------------------------------
 void CVideoDisplayWayland::UpdateVideo( AVFrame *pFrame )
 {
-	if ( vidout_wayland_in_flight( m_pVideoOut ) > 2 )
+	// Hold on to the frame until DisplayFrame(), so frame pacing decides when it is committed
+	FreeFrame( &m_pPendingFrame );
+	m_pPendingFrame = CloneFrame( pFrame );
+}
+
+
+//--------------------------------------------------------------------------------------------------
+// Measure how long the compositor holds on to video buffers
+//
+// wayout only reports how many buffers are in flight, so releases are noticed when the count drops
+// and the latency includes up to one frame of polling delay.
+//--------------------------------------------------------------------------------------------------
+void CVideoDisplayWayland::UpdateVideoRelease( Uint64 unNowNS )
+{
+	int nInFlight = vidout_wayland_in_flight( m_pVideoOut );
+	while ( m_nVideoSubmits > nInFlight )
 	{
-		// Too many frames queued, drop it
-		return;
+		Uint64 unReleaseNS = unNowNS - m_unVideoSubmitNS[ m_iVideoSubmit ];
+		m_iVideoSubmit = ( m_iVideoSubmit + 1 ) % SDL_arraysize( m_unVideoSubmitNS );
+		--m_nVideoSubmits;
+
+		Uint64 &unAverageNS = m_PresentationStats.unReleaseNS;
+		if ( unAverageNS == 0 )
+		{
+			unAverageNS = unReleaseNS;
+		}
+		else
+		{
+			unAverageNS = ( unAverageNS * 7 + unReleaseNS ) / 8;
+		}
+	}
+}
+
+
+//--------------------------------------------------------------------------------------------------
+// Return the number of video buffers allowed in flight
+//
+// Enough buffers are needed to cover the release latency at the content frame rate, plus the one
+// being submitted. Any more just adds latency without smoothing anything.
+//--------------------------------------------------------------------------------------------------
+int CVideoDisplayWayland::GetInFlightLimit() const
+{
+	Uint64 unFrameNS = m_unVideoFrameNS ? m_unVideoFrameNS : m_PresentationStats.unRefreshNS;
+	if ( !unFrameNS || !m_PresentationStats.unReleaseNS )
+	{
+		return k_nDefaultInFlight;
 	}
 
-	vidout_wayland_display( m_pVideoOut, pFrame );
+	int nLimit = (int)( ( m_PresentationStats.unReleaseNS + unFrameNS - 1 ) / unFrameNS ) + 1;
+	return SDL_clamp( nLimit, (int)k_nMinInFlight, (int)k_nMaxInFlight );
+}
+
+
+//--------------------------------------------------------------------------------------------------
+// Return the number of video buffers held by the compositor
+//--------------------------------------------------------------------------------------------------
+int CVideoDisplayWayland::GetVideoBuffersInFlight()
+{
+	return vidout_wayland_in_flight( m_pVideoOut );
 }
 
 
@@ -243,5 +632,46 @@ void CVideoDisplayWayland::SetVideoRect( const SDL_Rect &rect )
 //--------------------------------------------------------------------------------------------------
 void CVideoDisplayWayland::DisplayFrame()
 {
+	m_unDisplayFrameID = 0;
+
+	if ( m_pEventQueue )
+	{
+		wl_display_dispatch_queue_pending( m_pDisplay, m_pEventQueue );
+	}
+
+	if ( !m_pPendingFrame )
+	{
+		return;
+	}
+
+	Uint64 unNowNS = SDL_GetTicksNS();
+	UpdateVideoRelease( unNowNS );
+
+	m_PresentationStats.nInFlightLimit = GetInFlightLimit();
+	if ( vidout_wayland_in_flight( m_pVideoOut ) >= m_PresentationStats.nInFlightLimit )
+	{
+		// The compositor hasn't released enough buffers, drop it
+		++m_PresentationStats.unBackpressure;
+		FreeFrame( &m_pPendingFrame );
+		return;
+	}
+
+	vidout_wayland_display( m_pVideoOut, m_pPendingFrame );
+	FreeFrame( &m_pPendingFrame );
+
+	m_unVideoSubmitNS[ ( m_iVideoSubmit + m_nVideoSubmits ) % SDL_arraysize( m_unVideoSubmitNS ) ] = unNowNS;
+	if ( m_nVideoSubmits < (int)SDL_arraysize( m_unVideoSubmitNS ) )
+	{
+		++m_nVideoSubmits;
+	}
+	else
+	{
+		m_iVideoSubmit = ( m_iVideoSubmit + 1 ) % SDL_arraysize( m_unVideoSubmitNS );
+	}
+
+	if ( m_pPresentation )
+	{
+		RequestPresentationFeedback();
+	}
 }
 
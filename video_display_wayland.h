@@ -19,6 +19,18 @@ extern "C" {
 #include "external/hello_wayland/fb_pool.h"
 }
 
+#include <time.h>
+
+
+//--------------------------------------------------------------------------------------------------
+// Forward declarations
+//--------------------------------------------------------------------------------------------------
+struct wl_event_queue;
+struct wl_registry;
+struct wl_output;
+struct wp_presentation;
+struct wp_presentation_feedback;
+
 
 //--------------------------------------------------------------------------------------------------
 // Video display class using Wayland
@@ -35,25 +47,87 @@ public:
 
 	virtual SDL_Surface *InitOverlay( int nWidth, int nHeight ) override;
 	virtual void SetOverlayRect( const SDL_Rect &rect ) override;
+	virtual bool BSetOverlayZeroCopy( bool bEnabled ) override;
+	virtual SDL_Surface *BeginOverlay() override;
 	virtual void UpdateOverlay() override;
 
-	virtual bool BInitCodec( AVCodecContext *pContext, const AVCodec *pCodec ) override;
+	virtual bool BInitCodec( AVCodecContext *pContext, const AVCodec *pCodec, AVDictionary **ppOptions ) override;
 	virtual void SetVideoRect( const SDL_Rect &rect ) override;
 	virtual void UpdateVideo( AVFrame *pFrame ) override;
+	virtual int GetVideoBuffersInFlight() override;
 
 	virtual void DisplayFrame() override;
 
 	void HandleEvent( const SDL_Event *pEvent );
 
 private:
+	enum
+	{
+		k_nMaxFeedback = 8,
+
+		// Video buffers allowed in flight before frames are dropped
+		k_nMinInFlight = 2,
+		k_nDefaultInFlight = 3,
+		k_nMaxInFlight = 6
+	};
+
+	// Presentation feedback requested for one DisplayFrame()
+	struct SFeedback
+	{
+		CVideoDisplayWayland *pDisplay;
+		struct wp_presentation_feedback *pFeedback;
+		Uint32 unFrameID;
+	};
+
+	bool BInitPresentation( wl_display *pDisplay );
+	void RequestPresentationFeedback();
+	void UpdateVideoRelease( Uint64 unNowNS );
+	int GetInFlightLimit() const;
+
+	static void RegistryGlobal( void *pUserData, wl_registry *pRegistry, uint32_t unName, const char *pszInterface, uint32_t unVersion );
+	static void RegistryGlobalRemove( void *pUserData, wl_registry *pRegistry, uint32_t unName );
+	static void PresentationClockID( void *pUserData, wp_presentation *pPresentation, uint32_t unClockID );
+	static void FeedbackSyncOutput( void *pUserData, struct wp_presentation_feedback *pFeedback, wl_output *pOutput );
+	static void FeedbackPresented( void *pUserData, struct wp_presentation_feedback *pFeedback, uint32_t unSecondsHi, uint32_t unSecondsLo, uint32_t unNanoseconds, uint32_t unRefreshNS, uint32_t unSequenceHi, uint32_t unSequenceLo, uint32_t unFlags );
+	static void FeedbackDiscarded( void *pUserData, struct wp_presentation_feedback *pFeedback );
+
+	struct SOverlayFBSurface
+	{
+		void *pPixels;
+		SDL_Surface *pSurface;
+	};
+
+	SDL_Surface *GetOverlayFBSurface( wo_fb_t *pFB );
+	void BeginOverlayWrite( wo_fb_t *pFB );
+	void EndOverlayWrite( wo_fb_t *pFB );
+	void AttachOverlay( wo_fb_t *pFB );
+
 	SDL_WindowID m_unWindowID = 0;
+	wl_display *m_pDisplay = nullptr;
+	wl_surface *m_pWindowSurface = nullptr;
+	wl_event_queue *m_pEventQueue = nullptr;
+	wl_registry *m_pRegistry = nullptr;
+	wp_presentation *m_pPresentation = nullptr;
+	clockid_t m_ePresentationClock = CLOCK_MONOTONIC;
+	SFeedback m_Feedback[ k_nMaxFeedback ] = { };
+	int m_iFeedback = 0;
+	Uint64 m_unLastSequence = 0;
+	AVFrame *m_pPendingFrame = nullptr;
+	Uint64 m_unVideoSubmitNS[ k_nMaxInFlight + 1 ] = { };
+	int m_iVideoSubmit = 0;
+	int m_nVideoSubmits = 0;
 	vid_out_env_t *m_pVideoOut = nullptr;
 	wo_surface_t *m_pOverlayWaylandSurface = nullptr;
 	fb_pool_t *m_pFramebufferPool = nullptr;
 	wo_fb_t *m_pLastFB = nullptr;
 	SDL_Surface *m_pOverlaySurface;
 	wo_rect_t m_OverlayRect = { 0, 0, 0, 0 };
-	Uint32 m_unOverlayCRC = 0;
+	Uint32 m_unOverlayGeneration = 0;
+	SOverlayFBSurface m_OverlayFBSurfaces[ COverlayDamage::k_nMaxBuffers ] = { };
+	int m_nOverlayFBSurfaces = 0;
+	wo_fb_t *m_pDrawFB = nullptr;
+	bool m_bOverlayZeroCopy = false;
+	bool m_bOverlayDrawInPlace = false;
 };
 
 #endif // VIDEO_DISPLAY_WAYLAND_H